@@ -0,0 +1,529 @@
+#ifndef AOT_H
+#define AOT_H
+
+// Feature test macros, for getline()
+#include "platform.h"
+
+// Includes from std
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <dlfcn.h>
+
+// Includes from project
+#include "token.h"
+#include "tokenlist.h"
+#include "scanner.h"
+#include "parser.h"
+#include "expr.h"
+#include "exprlist.h"
+#include "functions.h"
+#include "evaluator.h"
+
+// Ahead of time compilation of a set of formulas. aot_generate() reads a formula file, one function definition per
+// line as in "area(w, h) = w * h", and writes C source with one function per formula. Parameters become C parameters
+// and every subtree that doesn't depend on them is folded to a literal, so the C compiler gets straight-line code it
+// can inline and vectorize. For a formula named area the source has:
+//
+//     int expreval_area(int a0, int a1);                                          // The formula itself.
+//     void expreval__batch_area(int n, int const *a0, int const *a1, int *out);   // Over arrays, for vectorization.
+//     AotFormula const expreval__formulas[];                                      // Name, arity, NativeFunction and ranges of every formula, NULL terminated.
+//
+// The source doesn't depend on any header. Built into a shared object ("cc -O2 -shared -fPIC formulas.c -o
+// formulas.so"), aot_library_load() loads it and adds every formula to a FunctionTable as a native function, which the
+// Evaluator then calls like any builtin. Formulas defined at runtime are still parsed and interpreted as usual.
+//
+// The generated code computes exactly what the interpreter would, including the wrap around on overflow, but it's
+// never checked: a division by zero traps even when the calling Evaluator is checked. The declared parameter ranges
+// are loaded along with the formula, so a checked Evaluator still rejects calls that are out of them, but calls from
+// one formula to another inside the library don't check them. Names that start with '_' are rejected since the
+// generated helpers use them.
+
+typedef struct {
+	char const *name;
+	int arity;
+	NativeFunction native;
+	int const *ranges; // Declared min and max of every parameter in turn, NULL when the formula declares none.
+} AotFormula;
+
+typedef struct {
+	FILE *out;
+	FunctionTable *functions; // Holds the formulas, whose bodies live in its ExprList.
+	bool has_failed;
+} AotGenerator;
+
+typedef struct {
+	void *handle; // From dlopen(), NULL when nothing is loaded.
+	int formula_count;
+} AotLibrary;
+
+// Forward declarations
+void AotGenerator_Init(AotGenerator*, FILE*, FunctionTable*);
+void AotGenerator_Free(AotGenerator*);
+
+void AotLibrary_Init(AotLibrary*);
+void AotLibrary_Free(AotLibrary*);
+
+bool aot_generate(FILE*, FILE*);
+bool aot_generate_table(AotGenerator*);
+bool aot_is_formula(Function*);
+bool aot_is_constant(AotGenerator*, int);
+char const *aot_operator_name(int);
+char const *aot_builtin_name(NativeFunction);
+void aot_emit_function(AotGenerator*, Function*);
+void aot_emit_signature(AotGenerator*, Function*);
+void aot_emit_expr(AotGenerator*, int);
+void aot_emit_literal(AotGenerator*, int);
+void aot_emit_call(AotGenerator*, Expr*);
+void aot_emit_chain(AotGenerator*, Expr*);
+
+bool aot_library_load(AotLibrary*, char const*, FunctionTable*);
+
+// Copies of the builtins for the generated source.
+static char const AotPrelude[] =
+    "static inline int expreval__min(int a, int b) { return a < b ? a : b; }\n"
+    "static inline int expreval__max(int a, int b) { return a > b ? a : b; }\n"
+    "static inline int expreval__abs(int a) { return a < 0 ? (int)(0u - (unsigned int)a) : a; }\n"
+    "static inline int expreval__clamp(int x, int lo, int hi) { return x < lo ? lo : x > hi ? hi : x; }\n"
+    "static inline int expreval__pow(int a, int b)\n"
+    "{\n"
+    "    if(b < 0) return a == 1 ? 1 : a == -1 ? (b & 1 ? -1 : 1) : 0;\n"
+    "    unsigned int base = (unsigned int)a, ans = 1;\n"
+    "    for(; b > 0; b >>= 1, base *= base) if(b & 1) ans *= base;\n"
+    "    return (int)ans;\n"
+    "}\n"
+    "// Dividing by zero or INT_MIN by -1 is undefined in C, so it's trapped explicitly instead of letting the compiler\n"
+    "// assume it never happens.\n"
+    "static inline int expreval__div(int a, int b)\n"
+    "{\n"
+    "    if(b == 0 || (a == -2147483647 - 1 && b == -1)) __builtin_trap();\n"
+    "    return a / b;\n"
+    "}\n";
+
+// Implementation
+
+void AotGenerator_Init(AotGenerator *self, FILE *out, FunctionTable *functions)
+{
+	self->out = out;
+	self->functions = functions;
+	self->has_failed = false;
+}
+
+void AotGenerator_Free(AotGenerator *self)
+{
+	self->out = NULL;
+	self->functions = NULL;
+	self->has_failed = false;
+}
+
+void AotLibrary_Init(AotLibrary *self)
+{
+	self->handle = NULL;
+	self->formula_count = 0;
+}
+
+// The FunctionTable the formulas were loaded into must not be used after this, its natives point into the library.
+void AotLibrary_Free(AotLibrary *self)
+{
+	if(self->handle) dlclose(self->handle);
+	self->handle = NULL;
+	self->formula_count = 0;
+}
+
+// Reads the formula file from in and writes the C source to out. Returns false, without writing anything, if any
+// line is not a valid definition.
+bool aot_generate(FILE *in, FILE *out)
+{
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    int line_number = 0;
+    bool has_failed = false;
+
+    TokenList tokens;
+    TokenList_Init(&tokens);
+
+    FunctionTable functions;
+    FunctionTable_Init(&functions);
+
+    while((line_len = getline(&line, &line_cap, in)) >= 0)
+    {
+        line_number += 1;
+        if(line_len > 0 && line[line_len - 1] == '\n') line[line_len - 1] = '\0';
+        TokenList_Clear(&tokens);
+
+        Scanner scanner;
+        Scanner_Init(&scanner, &tokens, line);
+        scanner_scan(&scanner);
+        bool has_line_failed = scanner.has_failed;
+        Scanner_Free(&scanner);
+        if(!has_line_failed && TokenList_Length(&tokens) == 0) continue;
+
+        Parser parser;
+        Parser_Init(&parser, &tokens, &functions.exprs, &functions, line);
+        if(!has_line_failed && !parser_is_at_definition(&parser))
+        {
+            fprintf(stderr, "Line %d is not a formula definition\n", line_number);
+            has_line_failed = true;
+        }
+        if(!has_line_failed) has_line_failed = parser_parse_definition(&parser) < 0;
+        Parser_Free(&parser);
+        has_failed |= has_line_failed;
+    }
+
+    if(!has_failed)
+    {
+        AotGenerator generator;
+        AotGenerator_Init(&generator, out, &functions);
+        has_failed = !aot_generate_table(&generator);
+        AotGenerator_Free(&generator);
+    }
+
+    free(line);
+    TokenList_Free(&tokens);
+    FunctionTable_Free(&functions);
+    return !has_failed;
+}
+
+bool aot_is_formula(Function *function)
+{
+    return !function->native && function->body >= 0;
+}
+
+// Writes the source for every user function of the table. Formulas are declared first, so that they can call each
+// other in any order.
+bool aot_generate_table(AotGenerator *self)
+{
+    int count = FunctionTable_Length(self->functions);
+    for(int i = 0; i < count; ++i)
+    {
+        Function *function = FunctionTable_Get(self->functions, i);
+        if(aot_is_formula(function) && function->name[0] == '_')
+        {
+            fprintf(stderr, "Formula '%s' can't be compiled, names that start with '_' are reserved\n", function->name);
+            return false;
+        }
+    }
+
+    fprintf(self->out, "// Generated from a formula file. Build with: cc -O2 -shared -fPIC formulas.c -o formulas.so\n\n");
+    fputs(AotPrelude, self->out);
+    fputs("\n", self->out);
+    for(int i = 0; i < count; ++i)
+    {
+        Function *function = FunctionTable_Get(self->functions, i);
+        if(!aot_is_formula(function)) continue;
+        aot_emit_signature(self, function);
+        fputs(";\n", self->out);
+    }
+    for(int i = 0; i < count && !self->has_failed; ++i)
+    {
+        Function *function = FunctionTable_Get(self->functions, i);
+        if(aot_is_formula(function)) aot_emit_function(self, function);
+    }
+
+    fputs("\nstruct ExprevalFormula { char const *name; int arity; int (*native)(int const *args); int const *ranges; };\n\n", self->out);
+    fputs("struct ExprevalFormula const expreval__formulas[] = {\n", self->out);
+    for(int i = 0; i < count; ++i)
+    {
+        Function *function = FunctionTable_Get(self->functions, i);
+        if(!aot_is_formula(function)) continue;
+        fprintf(self->out, "    {\"%s\", %d, expreval__args_%s, ", function->name, function->arity, function->name);
+        if(function->has_ranges) fprintf(self->out, "expreval__ranges_%s},\n", function->name);
+        else fputs("0},\n", self->out);
+    }
+    fputs("    {0, 0, 0},\n};\n", self->out);
+    return !self->has_failed;
+}
+
+void aot_emit_signature(AotGenerator *self, Function *function)
+{
+    fprintf(self->out, "int expreval_%s(", function->name);
+    for(int i = 0; i < function->arity; ++i) fprintf(self->out, "%sint a%d", i > 0 ? ", " : "", i);
+    fputs(function->arity == 0 ? "void)" : ")", self->out);
+}
+
+// Writes the formula, its batch version, the wrapper with the NativeFunction signature that the table refers to and the
+// declared ranges of its parameters, if any.
+void aot_emit_function(AotGenerator *self, Function *function)
+{
+    FILE *out = self->out;
+    char const *name = function->name;
+    int arity = function->arity;
+
+    fputs("\n", out);
+    aot_emit_signature(self, function);
+    fputs("\n{\n    return ", out);
+    aot_emit_expr(self, function->body);
+    fputs(";\n}\n\n", out);
+
+    fprintf(out, "void expreval__batch_%s(int n", name);
+    for(int i = 0; i < arity; ++i) fprintf(out, ", int const *restrict a%d", i);
+    fputs(", int *restrict out)\n{\n", out);
+    fprintf(out, "    for(int i = 0; i < n; ++i) out[i] = expreval_%s(", name);
+    for(int i = 0; i < arity; ++i) fprintf(out, "%sa%d[i]", i > 0 ? ", " : "", i);
+    fputs(");\n}\n\n", out);
+
+    fprintf(out, "static int expreval__args_%s(int const *args)\n{\n", name);
+    if(arity == 0) fputs("    (void)args;\n", out);
+    fprintf(out, "    return expreval_%s(", name);
+    for(int i = 0; i < arity; ++i) fprintf(out, "%sargs[%d]", i > 0 ? ", " : "", i);
+    fputs(");\n}\n", out);
+
+    if(!function->has_ranges) return;
+    fprintf(out, "\nstatic int const expreval__ranges_%s[] = {", name);
+    for(int i = 0; i < arity; ++i)
+    {
+        fputs(i > 0 ? ", " : "", out);
+        aot_emit_literal(self, function->param_min[i]);
+        fputs(", ", out);
+        aot_emit_literal(self, function->param_max[i]);
+    }
+    fputs("};\n", out);
+}
+
+// A subtree is constant when it doesn't read a parameter. Calls to user functions are never folded, they could
+// recurse forever.
+bool aot_is_constant(AotGenerator *self, int idx)
+{
+    // The rhs is followed in a loop, so the operands of a chain (or the arguments of a call) don't recurse once each.
+    for(Expr *expr; idx >= 0; idx = expr->rhs)
+    {
+        expr = ExprList_Get(&self->functions->exprs, idx);
+        if(expr->type == EXPR_PARAM || expr->type == EXPR_LITERAL_DOUBLE) return false;
+        if(expr->type == EXPR_CALL && !FunctionTable_Get(self->functions, expr->value)->native) return false;
+        if(!aot_is_constant(self, expr->lhs) || !aot_is_constant(self, expr->cond)) return false;
+    }
+    return true;
+}
+
+// C operator of a comparison or logical node, or of an EXPR_CHAIN operand. It gives 1 or 0 just like the Evaluator.
+char const *aot_operator_name(int type)
+{
+    switch(type)
+    {
+        case EXPR_LT: return "<";
+        case EXPR_LE: return "<=";
+        case EXPR_GT: return ">";
+        case EXPR_GE: return ">=";
+        case EXPR_EQ: return "==";
+        case EXPR_NE: return "!=";
+        // The compiler picks between branches and branchless code on its own, so the eager forms are the same here.
+        case EXPR_AND: case EXPR_AND_EAGER: return "&&";
+        case EXPR_OR: case EXPR_OR_EAGER: return "||";
+        default: return NULL;
+    }
+}
+
+char const *aot_builtin_name(NativeFunction native)
+{
+    if(native == builtin_min) return "expreval__min";
+    if(native == builtin_max) return "expreval__max";
+    if(native == builtin_abs) return "expreval__abs";
+    if(native == builtin_clamp) return "expreval__clamp";
+    if(native == builtin_pow) return "expreval__pow";
+    return NULL;
+}
+
+void aot_emit_literal(AotGenerator *self, int value)
+{
+    if(value == INT_MIN) fprintf(self->out, "(%d - 1)", INT_MIN + 1); // -2147483648 would be the negation of a long.
+    else fprintf(self->out, value < 0 ? "(%d)" : "%d", value);
+}
+
+// Everything is emitted as a literal, a parameter, a call, a cast or in parentheses, so it can be used as an operand of
+// any C operator as is. "+", "-" and "*" are done in unsigned ints to wrap around like the Evaluator does, and "/" goes
+// through expreval__div() so that it traps instead of being undefined.
+void aot_emit_expr(AotGenerator *self, int idx)
+{
+    FILE *out = self->out;
+    Expr *expr = ExprList_Get(&self->functions->exprs, idx);
+    if(expr->type != EXPR_LITERAL && aot_is_constant(self, idx))
+    {
+        Evaluator evaluator;
+        Evaluator_Init(&evaluator, &self->functions->exprs, self->functions, NULL);
+        evaluator.is_checked = true;
+        int value = evaluator_eval(&evaluator, idx);
+        bool has_failed = evaluator.has_failed;
+        Evaluator_Free(&evaluator);
+        // Subtrees that divide by zero are kept as they are. Their divisions are calls to expreval__div(), so they trap
+        // when evaluated just like in the interpreter.
+        if(!has_failed)
+        {
+            aot_emit_literal(self, value);
+            return;
+        }
+    }
+
+    char const *op = NULL;
+    switch(expr->type)
+    {
+        case EXPR_LITERAL: aot_emit_literal(self, expr->value); return;
+        case EXPR_PARAM: fprintf(out, "a%d", expr->value); return;
+        case EXPR_NEG: case EXPR_NEG_UNCHECKED: {
+            fputs("(int)(0u - (unsigned int)", out);
+            aot_emit_expr(self, expr->lhs);
+            fputs(")", out);
+        } return;
+
+        case EXPR_ADD: case EXPR_ADD_UNCHECKED: op = "+"; break;
+        case EXPR_SUB: case EXPR_SUB_UNCHECKED: op = "-"; break;
+        case EXPR_MUL: case EXPR_MUL_UNCHECKED: op = "*"; break;
+        case EXPR_DIV: case EXPR_DIV_UNCHECKED: {
+            fputs("expreval__div(", out);
+            aot_emit_expr(self, expr->lhs);
+            fputs(", ", out);
+            aot_emit_expr(self, expr->rhs);
+            fputs(")", out);
+        } return;
+        case EXPR_LT: case EXPR_LE: case EXPR_GT: case EXPR_GE: case EXPR_EQ: case EXPR_NE:
+        case EXPR_AND: case EXPR_AND_EAGER: case EXPR_OR: case EXPR_OR_EAGER: op = aot_operator_name(expr->type); break;
+
+        case EXPR_TERNARY: case EXPR_SELECT: {
+            fputs("(", out);
+            aot_emit_expr(self, expr->cond);
+            fputs(" ? ", out);
+            aot_emit_expr(self, expr->lhs);
+            fputs(" : ", out);
+            aot_emit_expr(self, expr->rhs);
+            fputs(")", out);
+        } return;
+
+        case EXPR_CALL: aot_emit_call(self, expr); return;
+        case EXPR_SUM: case EXPR_PRODUCT: case EXPR_CHAIN: aot_emit_chain(self, expr); return;
+
+        default: {
+            self->has_failed = true;
+            fprintf(stderr, "Expression can't be compiled (%s)\n", expr->type >= 0 && expr->type < EXPR_COUNT ? ExprTypeName[expr->type] : "?");
+            fputs("0", out);
+        } return;
+    }
+
+    bool is_wrapping = op[0] == '+' || op[0] == '-' || op[0] == '*';
+    fputs(is_wrapping ? "(int)((unsigned int)" : "(", out);
+    aot_emit_expr(self, expr->lhs);
+    fprintf(out, is_wrapping ? " %s (unsigned int)" : " %s ", op);
+    aot_emit_expr(self, expr->rhs);
+    fputs(")", out);
+}
+
+void aot_emit_call(AotGenerator *self, Expr *expr)
+{
+    Function *function = FunctionTable_Get(self->functions, expr->value);
+    char const *builtin = aot_builtin_name(function->native);
+    if(function->native && !builtin)
+    {
+        self->has_failed = true;
+        fprintf(stderr, "Native function '%s' can't be compiled\n", function->name);
+        fputs("0", self->out);
+        return;
+    }
+    if(builtin) fprintf(self->out, "%s(", builtin);
+    else fprintf(self->out, "expreval_%s(", function->name);
+    for(int idx = expr->lhs; idx >= 0; idx = ExprList_Get(&self->functions->exprs, idx)->rhs)
+    {
+        if(idx != expr->lhs) fputs(", ", self->out);
+        aot_emit_expr(self, ExprList_Get(&self->functions->exprs, idx)->lhs);
+    }
+    fputs(")", self->out);
+}
+
+// Sums, and products without divisions, are a single unsigned expression. Divisions are not associative and must be
+// signed, so products with divisions nest every step in the previous ones, to fold them left to right. Division steps
+// are calls to expreval__div(). Comparison and logical chains nest every step the same way, which is also how C groups
+// "a < b < c".
+void aot_emit_chain(AotGenerator *self, Expr *expr)
+{
+    FILE *out = self->out;
+    Expr *operands = ExprList_Get(&self->functions->exprs, expr->lhs);
+    int count = expr->value;
+    if(expr->type == EXPR_CHAIN)
+    {
+        for(int i = 1; i < count; ++i) fputs("(", out);
+        aot_emit_expr(self, operands[0].lhs);
+        for(int i = 1; i < count; ++i)
+        {
+            fprintf(out, " %s ", aot_operator_name(operands[i].value));
+            aot_emit_expr(self, operands[i].lhs);
+            fputs(")", out);
+        }
+        return;
+    }
+
+    bool has_div = false;
+    for(int i = 1; i < count; ++i) has_div |= expr_checked_type(operands[i].value) == EXPR_DIV;
+
+    if(!has_div)
+    {
+        fputs("(int)((unsigned int)", out);
+        aot_emit_expr(self, operands[0].lhs);
+        for(int i = 1; i < count; ++i)
+        {
+            int op = expr_checked_type(operands[i].value);
+            fprintf(out, " %c (unsigned int)", op == EXPR_ADD ? '+' : op == EXPR_SUB ? '-' : '*');
+            aot_emit_expr(self, operands[i].lhs);
+        }
+        fputs(")", out);
+        return;
+    }
+
+    for(int i = count - 1; i >= 1; --i)
+    {
+        fputs(expr_checked_type(operands[i].value) == EXPR_DIV ? "expreval__div(" : "(int)((unsigned int)", out);
+    }
+    aot_emit_expr(self, operands[0].lhs);
+    for(int i = 1; i < count; ++i)
+    {
+        bool is_div = expr_checked_type(operands[i].value) == EXPR_DIV;
+        fputs(is_div ? ", " : " * (unsigned int)", out);
+        aot_emit_expr(self, operands[i].lhs);
+        fputs(")", out);
+    }
+}
+
+// Loads the formulas of a library built from the output of aot_generate() into functions, as native functions.
+// Formulas whose name is already in the table are skipped. Their declared ranges are declared on the natives too, which
+// checked Evaluators check before calling them. Returns false, leaving the table as it was, if the library
+// can't be loaded. An AotLibrary holds a single library.
+bool aot_library_load(AotLibrary *self, char const *path, FunctionTable *functions)
+{
+    if(self->handle)
+    {
+        fprintf(stderr, "A library is already loaded\n");
+        return false;
+    }
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if(!handle)
+    {
+        fprintf(stderr, "Could not load '%s': %s\n", path, dlerror());
+        return false;
+    }
+    AotFormula const *formulas = (AotFormula const*)dlsym(handle, "expreval__formulas");
+    if(!formulas)
+    {
+        fprintf(stderr, "'%s' has no formulas\n", path);
+        dlclose(handle);
+        return false;
+    }
+
+    self->handle = handle;
+    self->formula_count = 0;
+    for(int i = 0; formulas[i].name; ++i)
+    {
+        int name_length = (int)strlen(formulas[i].name);
+        if(FunctionTable_Find(functions, formulas[i].name, name_length) >= 0) continue;
+        int function_idx = FunctionTable_Add(functions, formulas[i].name, name_length, formulas[i].arity, formulas[i].native);
+        if(function_idx < 0) continue;
+        self->formula_count += 1;
+        Function *function = FunctionTable_Get(functions, function_idx);
+        for(int param = 0; formulas[i].ranges && param < function->arity; ++param)
+        {
+            int lo = formulas[i].ranges[2 * param], hi = formulas[i].ranges[2 * param + 1];
+            if(lo != INT_MIN || hi != INT_MAX) function_declare_range(function, param, lo, hi);
+        }
+    }
+    return true;
+}
+
+#endif
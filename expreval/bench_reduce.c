@@ -0,0 +1,166 @@
+// Benchmark for the parallel reduction of long "+ -" and "*" chains and for the parallel scanner.
+// Generates expressions of the given sizes in MB (10 and 100 by default), parses each one once and then times its
+// evaluation with thread pools of 1, 4, 16 and 32 threads. The parallel scan of the same input is timed with the same
+// pools and checked against the tokens of the serial Scanner, and its paren matches against a serial scan.
+//
+// Build: cc -O2 -pthread bench_reduce.c -o bench_reduce
+// Usage: ./bench_reduce [size_mb...]
+
+#include "platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "eval.h"
+#include "parallelscanner.h"
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Generates a top level chain of terms, where every term is either a literal or a short parenthesized product of
+// literals. The expected result is computed on the fly with wrap around arithmetic, in the same order a left to right
+// fold would.
+static char *generate_expression(size_t size, unsigned int *expected)
+{
+    char *buf = (char*)malloc(size + 64);
+    if(!buf) return NULL;
+    size_t len = 0;
+    unsigned int sum = 0;
+    unsigned int seed = 12345;
+    bool first = true;
+    while(len < size)
+    {
+        seed = seed * 1103515245u + 12345u;
+        bool minus = !first && (seed >> 16) % 4 == 0;
+        if(!first) buf[len++] = minus ? '-' : '+';
+        first = false;
+
+        unsigned int term = 1;
+        int factors = 1 + (seed >> 20) % 3;
+        if(factors > 1) buf[len++] = '(';
+        for(int i = 0; i < factors; ++i)
+        {
+            seed = seed * 1103515245u + 12345u;
+            unsigned int literal = (seed >> 16) % 100000;
+            if(i > 0) buf[len++] = '*';
+            len += sprintf(buf + len, "%u", literal);
+            term *= literal;
+        }
+        if(factors > 1) buf[len++] = ')';
+        sum += minus ? 0u - term : term;
+    }
+    buf[len] = '\0';
+    *expected = sum;
+    return buf;
+}
+
+static void run_benchmark(size_t size_mb)
+{
+    unsigned int expected = 0;
+    char *source = generate_expression(size_mb * 1024 * 1024, &expected);
+    if(!source)
+    {
+        fprintf(stderr, "Could not allocate a %zu MB expression\n", size_mb);
+        return;
+    }
+
+    TokenList tokens;
+    TokenList_Init(&tokens);
+    ExprList exprs;
+    ExprList_Init(&exprs);
+    FunctionTable functions;
+    FunctionTable_Init(&functions);
+
+    double t0 = now_seconds();
+    Scanner scanner;
+    Scanner_Init(&scanner, &tokens, source);
+    scanner_scan(&scanner);
+    double t1 = now_seconds();
+    Parser parser;
+    Parser_Init(&parser, &tokens, &exprs, &functions, source);
+    int root = parser_parse_expr(&parser);
+    double t2 = now_seconds();
+    printf("%zu MB: %d tokens, %d nodes, scan %.3fs, parse %.3fs\n", size_mb, TokenList_Length(&tokens), ExprList_Length(&exprs), t1 - t0, t2 - t1);
+
+    if(scanner.has_failed || parser.has_failed)
+    {
+        fprintf(stderr, "Failed to parse generated expression\n");
+    }
+    else
+    {
+        // Without a pool the scan is serial, which gives the paren matches to check the parallel ones against.
+        TokenList serial_tokens;
+        TokenList_Init(&serial_tokens);
+        ParallelScanner serial_scanner;
+        ParallelScanner_Init(&serial_scanner, &serial_tokens, source, scanner.source_length, NULL);
+        parallel_scanner_scan(&serial_scanner);
+
+        int const thread_counts[] = {1, 4, 16, 32};
+        double baseline = 0.0;
+        for(int i = 0; i < (int)(sizeof(thread_counts) / sizeof(thread_counts[0])); ++i)
+        {
+            ThreadPool pool;
+            ThreadPool_Init(&pool, thread_counts[i]);
+            Evaluator evaluator;
+            Evaluator_Init(&evaluator, &exprs, &functions, &pool);
+
+            // Best of a few runs to keep noise out of the comparison.
+            double best = 1e30;
+            int ans = 0;
+            for(int run = 0; run < 5; ++run)
+            {
+                double start = now_seconds();
+                ans = evaluator_eval(&evaluator, root);
+                double elapsed = now_seconds() - start;
+                if(elapsed < best) best = elapsed;
+            }
+            if(i == 0) baseline = best;
+            printf("  %2d threads: eval %.4fs, speedup %.2fx, result %d (%s)\n", thread_counts[i], best, baseline / best, ans, (unsigned int)ans == expected ? "ok" : "MISMATCH");
+
+            TokenList parallel_tokens;
+            TokenList_Init(&parallel_tokens);
+            ParallelScanner parallel_scanner;
+            ParallelScanner_Init(&parallel_scanner, &parallel_tokens, source, scanner.source_length, &pool);
+            double start = now_seconds();
+            parallel_scanner_scan(&parallel_scanner);
+            double elapsed = now_seconds() - start;
+            bool same = TokenList_Length(&parallel_tokens) == TokenList_Length(&tokens) && memcmp(parallel_tokens.data, tokens.data, TokenList_Length(&tokens) * sizeof(Token)) == 0;
+            same = same && memcmp(parallel_scanner.matches, serial_scanner.matches, TokenList_Length(&tokens) * sizeof(int)) == 0;
+            printf("              scan %.4fs, speedup %.2fx over serial (%s)\n", elapsed, (t1 - t0) / elapsed, same ? "identical" : "MISMATCH");
+            ParallelScanner_Free(&parallel_scanner);
+            TokenList_Free(&parallel_tokens);
+
+            Evaluator_Free(&evaluator);
+            ThreadPool_Free(&pool);
+        }
+        ParallelScanner_Free(&serial_scanner);
+        TokenList_Free(&serial_tokens);
+    }
+
+    Parser_Free(&parser);
+    Scanner_Free(&scanner);
+    FunctionTable_Free(&functions);
+    ExprList_Free(&exprs);
+    TokenList_Free(&tokens);
+    free(source);
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 2)
+    {
+        run_benchmark(10);
+        run_benchmark(100);
+        return 0;
+    }
+    for(int i = 1; i < argc; ++i)
+    {
+        run_benchmark((size_t)atoi(argv[i]));
+    }
+    return 0;
+}
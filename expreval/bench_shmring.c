@@ -0,0 +1,239 @@
+// Benchmark of the shared memory ring against eval_loop() behind a pair of pipes.
+// A forked child evaluates, the parent produces expressions with a bounded number of them in flight and measures the
+// time from submission to result of each one. Reports throughput and latency percentiles for every window size.
+//
+// Build: cc -O2 -pthread bench_shmring.c -o bench_shmring
+// Usage: ./bench_shmring [expression_count]
+
+#include "platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "eval.h"
+#include "shmring.h"
+
+#define BENCH_EXPR_MAX 64
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_doubles(void const *a, void const *b)
+{
+    double x = *(double const*)a, y = *(double const*)b;
+    return (x > y) - (x < y);
+}
+
+// Small expressions of the kind producers send, with their expected results computed by the tree evaluator.
+static char (*generate_expressions(int count, int **expected))[BENCH_EXPR_MAX]
+{
+    char (*exprs)[BENCH_EXPR_MAX] = malloc((size_t)count * BENCH_EXPR_MAX);
+    *expected = (int*)malloc(count * sizeof(int));
+    if(!exprs || !*expected) return NULL;
+
+    TokenList tokens;
+    TokenList_Init(&tokens);
+    ExprList list;
+    ExprList_Init(&list);
+    unsigned int seed = 42;
+    for(int i = 0; i < count; ++i)
+    {
+        unsigned int v[5];
+        for(int j = 0; j < 5; ++j)
+        {
+            seed = seed * 1103515245u + 12345u;
+            v[j] = (seed >> 16) % 1000 + 1;
+        }
+        snprintf(exprs[i], BENCH_EXPR_MAX, "(%u + %u) * %u - %u / %u > %u ? 1 : %u", v[0], v[1], v[2], v[3], v[4], v[0], v[2]);
+
+        TokenList_Clear(&tokens);
+        ExprList_Clear(&list);
+        Scanner scanner;
+        Scanner_Init(&scanner, &tokens, exprs[i]);
+        scanner_scan(&scanner);
+        Parser parser;
+        Parser_Init(&parser, &tokens, &list, NULL, exprs[i]);
+        int root = parser_parse_expr(&parser);
+        Evaluator evaluator;
+        Evaluator_Init(&evaluator, &list, NULL, NULL);
+        (*expected)[i] = evaluator_eval(&evaluator, root);
+        Parser_Free(&parser);
+        Scanner_Free(&scanner);
+    }
+    TokenList_Free(&tokens);
+    ExprList_Free(&list);
+    return exprs;
+}
+
+static void report(char const *name, int window, int count, double elapsed, double *latencies, int mismatches)
+{
+    qsort(latencies, count, sizeof(double), compare_doubles);
+    printf("%-6s window %3d: %9.0f expr/s, latency p50 %7.2fus p99 %8.2fus p99.9 %8.2fus max %9.2fus%s\n",
+        name, window, count / elapsed,
+        latencies[count / 2] * 1e6, latencies[(int)(count * 0.99)] * 1e6, latencies[(int)(count * 0.999)] * 1e6, latencies[count - 1] * 1e6,
+        mismatches ? " (MISMATCH)" : "");
+}
+
+static void bench_shm_ring(char (*exprs)[BENCH_EXPR_MAX], int const *expected, int count, int window, double *submitted, double *latencies)
+{
+    ShmRing ring;
+    if(!ShmRing_Init(&ring, NULL, 256, BENCH_EXPR_MAX))
+    {
+        fprintf(stderr, "Could not create the shared memory ring\n");
+        return;
+    }
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        FunctionTable functions;
+        FunctionTable_Init(&functions);
+        shm_ring_serve(&ring, &functions, NULL);
+        FunctionTable_Free(&functions);
+        _exit(0);
+    }
+
+    int mismatches = 0, received = 0;
+    double start = now_seconds();
+    for(int i = 0; i < count || received < count; )
+    {
+        if(i < count && i - received < window)
+        {
+            submitted[i] = now_seconds();
+            shm_ring_submit(&ring, exprs[i], (int)strlen(exprs[i]), (uint64_t)i);
+            ++i;
+            continue;
+        }
+        ShmRingResult result;
+        if(!shm_ring_wait_result(&ring, &result)) break;
+        latencies[received++] = now_seconds() - submitted[result.id];
+        mismatches += result.status != SHM_RING_OK || result.value != expected[result.id];
+    }
+    double elapsed = now_seconds() - start;
+
+    shm_ring_close(&ring);
+    waitpid(pid, NULL, 0);
+    ShmRing_Free(&ring);
+    report("shm", window, received, elapsed, latencies, mismatches);
+}
+
+static char pipe_buf[65536];
+static int pipe_len = 0;
+
+// Parses the "\n> value\n" replies of eval_loop() as they come.
+static int read_pipe_results(int fd, int *values, int max_values)
+{
+    char *buf = pipe_buf;
+    int len = pipe_len;
+    int got = 0;
+    while(got == 0)
+    {
+        ssize_t n = read(fd, buf + len, sizeof(pipe_buf) - len - 1);
+        if(n <= 0) return -1;
+        len += (int)n;
+        buf[len] = '\0';
+        char *p = buf;
+        char *line_end;
+        while(got < max_values && (p = strstr(p, "> ")) && (line_end = strchr(p, '\n')))
+        {
+            values[got++] = atoi(p + 2);
+            p = line_end + 1;
+        }
+        if(!p) p = buf + len - (len > 0 && buf[len - 1] == '>'); // Keep a prompt that was cut in half.
+        int rest = (int)(buf + len - p);
+        if(rest > 0 && p != buf) memmove(buf, p, rest);
+        len = rest > 0 ? rest : 0;
+    }
+    pipe_len = len;
+    return got;
+}
+
+static void bench_pipe(char (*exprs)[BENCH_EXPR_MAX], int const *expected, int count, int window, double *submitted, double *latencies)
+{
+    int to_child[2], from_child[2];
+    if(pipe(to_child) != 0 || pipe(from_child) != 0)
+    {
+        fprintf(stderr, "Could not create pipes\n");
+        return;
+    }
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        dup2(to_child[0], STDIN_FILENO);
+        dup2(from_child[1], STDOUT_FILENO);
+        close(to_child[1]);
+        close(from_child[0]);
+        setvbuf(stdout, NULL, _IOLBF, 0); // Otherwise results would sit in the stdio buffer of the child.
+        eval_loop();
+        _exit(0);
+    }
+    close(to_child[0]);
+    close(from_child[1]);
+
+    pipe_len = 0;
+    int mismatches = 0, received = 0;
+    int values[256];
+    char line[BENCH_EXPR_MAX + 1];
+    double start = now_seconds();
+    for(int i = 0; i < count || received < count; )
+    {
+        if(i < count && i - received < window)
+        {
+            int len = snprintf(line, sizeof(line), "%s\n", exprs[i]);
+            submitted[i] = now_seconds();
+            if(write(to_child[1], line, len) != len) break;
+            ++i;
+            continue;
+        }
+        int got = read_pipe_results(from_child[0], values, (int)(sizeof(values) / sizeof(values[0])));
+        if(got < 0) break;
+        double t = now_seconds();
+        for(int j = 0; j < got; ++j, ++received)
+        {
+            // eval_loop answers in order, so the result is for the oldest expression in flight.
+            latencies[received] = t - submitted[received];
+            mismatches += values[j] != expected[received];
+        }
+    }
+    double elapsed = now_seconds() - start;
+
+    if(write(to_child[1], "q\n", 2) != 2) kill(pid, SIGTERM);
+    close(to_child[1]);
+    close(from_child[0]);
+    waitpid(pid, NULL, 0);
+    report("pipe", window, received, elapsed, latencies, mismatches);
+}
+
+int main(int argc, char **argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : 200000;
+    int *expected = NULL;
+    char (*exprs)[BENCH_EXPR_MAX] = generate_expressions(count, &expected);
+    double *submitted = (double*)malloc(count * sizeof(double));
+    double *latencies = (double*)malloc(count * sizeof(double));
+    if(!exprs || !submitted || !latencies)
+    {
+        fprintf(stderr, "Could not allocate %d expressions\n", count);
+        return 1;
+    }
+
+    int const windows[] = {1, 32};
+    for(int i = 0; i < (int)(sizeof(windows) / sizeof(windows[0])); ++i)
+    {
+        bench_shm_ring(exprs, expected, count, windows[i], submitted, latencies);
+        bench_pipe(exprs, expected, count, windows[i], submitted, latencies);
+    }
+
+    free(latencies);
+    free(submitted);
+    free(expected);
+    free(exprs);
+    return 0;
+}
@@ -1,13 +1,35 @@
 #ifndef EVAL_H
 #define EVAL_H
 
+#include "platform.h" // getline()
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "token.h"
 #include "tokenlist.h"
 #include "scanner.h"
 #include "parser.h"
+#include "exprlist.h"
+#include "functions.h"
+#include "evaluator.h"
+#include "streameval.h"
+#include "governor.h"
+#include "memo.h"
+#include "range.h"
+#include "doubleprint.h"
+#include "uring.h"
+
+#ifndef EVAL_READ_CHUNK
+#define EVAL_READ_CHUNK 1024 // Bytes of a line read at once by eval_read_line() when its length is limited.
+#endif
+
+#ifndef EVAL_BATCH_MEMO_CAPACITY
+#define EVAL_BATCH_MEMO_CAPACITY 4096 // Number of groups remembered by eval_batch() across lines.
+#endif
 
 static inline bool is_quit_message(char const *buf)
 {
@@ -24,10 +46,17 @@ static inline int eval_loop(void)
 	TokenList tokens;
 	TokenList_Init(&tokens);
 	
+	ExprList exprs;
+	ExprList_Init(&exprs);
+	
+	FunctionTable functions;
+	FunctionTable_Init(&functions);
+	
 	while(!has_to_quit)
 	{
 		buf[0] = 0;
 		TokenList_Clear(&tokens);
+		ExprList_Clear(&exprs);
 		
 		printf("\n> ");
 		scanf("%1024[^\n]", buf);
@@ -52,22 +81,294 @@ static inline int eval_loop(void)
 		Scanner_Free(&scanner);
 		
 		Parser parser;
-		Parser_Init(&parser, &tokens);
-		ans = parser_parse_expr(&parser);
-		if(parser.has_failed)
+		Parser_Init(&parser, &tokens, &exprs, &functions, buf);
+		if(parser_is_at_definition(&parser))
 		{
-			// fprintf(stderr, "Failed to parse expression!\n");
+			// Function bodies are kept in the function table so that they outlive the current line.
+			Parser_Init(&parser, &tokens, &functions.exprs, &functions, buf);
+			parser_parse_definition(&parser);
+			Parser_Free(&parser);
 			continue;
 		}
+		int root = parser_parse_expr(&parser);
+		bool has_failed = parser.has_failed;
 		Parser_Free(&parser);
+		if(has_failed)
+		{
+			// fprintf(stderr, "Failed to parse expression!\n");
+			continue;
+		}
+		
+		Evaluator evaluator;
+		Evaluator_Init(&evaluator, &exprs, &functions, NULL);
+		ans = evaluator_eval(&evaluator, root);
+		if(evaluator.has_failed)
+		{
+			continue;
+		}
+		Evaluator_Free(&evaluator);
 		
 		// printf("%s = %d\n", buf, ans);
 		printf("%d\n", ans);
 	}
 
 	TokenList_Free(&tokens);
+	ExprList_Free(&exprs);
+	FunctionTable_Free(&functions);
     
 	return ans;
 }
 
+// Reads a line of in into *line like getline(), without the newline. When max_len is more than 0, only the first
+// max_len bytes are kept and the rest of a longer line is read and dropped, so a huge line can't make the buffer grow
+// past that. Returns the length of the whole line (more than max_len when it was cut), or -1 at the end of the input.
+static inline long long eval_read_line(FILE *in, char **line, size_t *line_cap, long long max_len)
+{
+	if(max_len <= 0)
+	{
+		ssize_t len = getline(line, line_cap, in);
+		if(len > 0 && (*line)[len - 1] == '\n') (*line)[--len] = '\0';
+		return len;
+	}
+	
+	long long len = 0;
+	bool has_read = false;
+	char scratch[EVAL_READ_CHUNK]; // Where the dropped part of a long line is read.
+	for(;;)
+	{
+		char *buf = scratch;
+		int size = EVAL_READ_CHUNK;
+		if(len < max_len)
+		{
+			if((size_t)len + 2 > *line_cap)
+			{
+				size_t new_cap = *line_cap ? *line_cap * 2 : 128;
+				if(new_cap > (size_t)max_len + 1) new_cap = (size_t)max_len + 1;
+				char *temp = (char*)realloc(*line, new_cap);
+				if(!temp) return -1;
+				*line = temp;
+				*line_cap = new_cap;
+			}
+			buf = *line + len;
+			if(*line_cap - len < (size_t)size) size = (int)(*line_cap - len);
+		}
+		// fgets() doesn't tell how much it read, and the line may hold a '\0'. The chunk is filled with '\n' first, so
+		// the first '\n' is either the end of the line, right before the '\0' that fgets() adds, or the first filler
+		// right after it.
+		memset(buf, '\n', size);
+		if(!fgets(buf, size, in)) break;
+		has_read = true;
+		char *newline = (char*)memchr(buf, '\n', size);
+		if(newline && newline + 1 < buf + size && newline[1] == '\0')
+		{
+			len += newline - buf;
+			break;
+		}
+		len += newline ? newline - buf - 1 : size - 1;
+	}
+	if(!has_read) return -1;
+	(*line)[len < max_len ? len : max_len] = '\0';
+	return len;
+}
+
+// Evaluates every line of in and prints one result per line, without prompts. Lines can be of any length, except when
+// governor limits the input size: then longer lines are dropped as they're read, without ever being held in memory. Definitions
+// are added to functions, which can already hold some, like the formulas loaded by aot_library_load(). When memo
+// is not NULL, groups without identifiers are only evaluated the first time they're seen during the run. When governor
+// is not NULL, every line gets its own budget and lines that exceed it are skipped. When is_checked, overflows and
+// divisions by zero make a line fail, and every expression and definition goes through the range analysis first, with
+// the number of checks it removed printed to stderr.
+static inline void eval_batch(FILE *in, FunctionTable *functions, SubexprMemo *memo, Governor *governor, bool is_checked)
+{
+	char *line = NULL;
+	size_t line_cap = 0;
+	long long line_len;
+	long long max_len = governor ? governor->limits.max_input_bytes : 0;
+	
+	TokenList tokens;
+	TokenList_Init(&tokens);
+	
+	ExprList exprs;
+	ExprList_Init(&exprs);
+	
+	while((line_len = eval_read_line(in, &line, &line_cap, max_len)) >= 0)
+	{
+		TokenList_Clear(&tokens);
+		ExprList_Clear(&exprs);
+		if(governor) governor_start(governor);
+		if(governor && !governor_check_input(governor, line_len)) continue;
+		
+		Scanner scanner;
+		Scanner_Init(&scanner, &tokens, line);
+		scanner.governor = governor;
+		scanner_scan(&scanner);
+		bool has_failed = scanner.has_failed;
+		Scanner_Free(&scanner);
+		if(has_failed || TokenList_Length(&tokens) == 0) continue;
+		
+		Parser parser;
+		Parser_Init(&parser, &tokens, &exprs, functions, line);
+		parser.memo = memo;
+		parser.governor = governor;
+		if(parser_is_at_definition(&parser))
+		{
+			parser.exprs = &functions->exprs;
+			int function_idx = parser_parse_definition(&parser);
+			Parser_Free(&parser);
+			if(is_checked && function_idx >= 0)
+			{
+				RangeAnalysis analysis;
+				RangeAnalysis_Init(&analysis, &exprs, functions);
+				range_analysis_function(&analysis, function_idx);
+				fprintf(stderr, "%d of %d checks removed\n", analysis.removed_count, analysis.check_count);
+				RangeAnalysis_Free(&analysis);
+			}
+			continue;
+		}
+		int root = parser_parse_expr(&parser);
+		has_failed = parser.has_failed;
+		Parser_Free(&parser);
+		if(has_failed) continue;
+		
+		if(is_checked)
+		{
+			RangeAnalysis analysis;
+			RangeAnalysis_Init(&analysis, &exprs, functions);
+			range_analysis_run(&analysis, root);
+			fprintf(stderr, "%d of %d checks removed\n", analysis.removed_count, analysis.check_count);
+			RangeAnalysis_Free(&analysis);
+		}
+		
+		Evaluator evaluator;
+		Evaluator_Init(&evaluator, &exprs, functions, NULL);
+		evaluator.governor = governor;
+		evaluator.is_checked = is_checked;
+		evaluator.is_overflow_checked = is_checked;
+		int ans = evaluator_eval(&evaluator, root);
+		has_failed = evaluator.has_failed;
+		Evaluator_Free(&evaluator);
+		if(has_failed) continue;
+		
+		printf("%d\n", ans);
+	}
+	
+	free(line);
+	TokenList_Free(&tokens);
+	ExprList_Free(&exprs);
+}
+
+// Same as eval_batch() but in double mode: literals can have a fraction and an exponent, everything is evaluated in
+// doubles and results are printed in their shortest form that parses back to the same double.
+static inline void eval_batch_double(FILE *in)
+{
+	char *line = NULL;
+	size_t line_cap = 0;
+	ssize_t line_len;
+	char buf[DOUBLE_PRINT_MAX_LENGTH]; // The terminating '\0' is replaced with a newline.
+	
+	TokenList tokens;
+	TokenList_Init(&tokens);
+	
+	ExprList exprs;
+	ExprList_Init(&exprs);
+	
+	FunctionTable functions;
+	FunctionTable_Init(&functions);
+	
+	while((line_len = getline(&line, &line_cap, in)) >= 0)
+	{
+		if(line_len > 0 && line[line_len - 1] == '\n') line[line_len - 1] = '\0';
+		TokenList_Clear(&tokens);
+		ExprList_Clear(&exprs);
+		
+		Scanner scanner;
+		Scanner_Init(&scanner, &tokens, line);
+		scanner.is_double = true;
+		scanner_scan(&scanner);
+		bool has_failed = scanner.has_failed;
+		Scanner_Free(&scanner);
+		if(has_failed || TokenList_Length(&tokens) == 0) continue;
+		
+		Parser parser;
+		Parser_Init(&parser, &tokens, &exprs, &functions, line);
+		parser.is_double = true;
+		if(parser_is_at_definition(&parser))
+		{
+			parser.exprs = &functions.exprs;
+			parser_parse_definition(&parser);
+			Parser_Free(&parser);
+			continue;
+		}
+		int root = parser_parse_expr(&parser);
+		has_failed = parser.has_failed;
+		Parser_Free(&parser);
+		if(has_failed) continue;
+		
+		Evaluator evaluator;
+		Evaluator_Init(&evaluator, &exprs, &functions, NULL);
+		double ans = evaluator_eval_double(&evaluator, root);
+		has_failed = evaluator.has_failed;
+		Evaluator_Free(&evaluator);
+		if(has_failed) continue;
+		
+		int len = double_print(ans, buf);
+		buf[len] = '\n';
+		fwrite(buf, 1, len + 1, stdout);
+	}
+	
+	free(line);
+	TokenList_Free(&tokens);
+	ExprList_Free(&exprs);
+	FunctionTable_Free(&functions);
+}
+
+static inline void eval_stream_print_result(void *ctx, int value, bool has_failed)
+{
+	(void)ctx;
+	if(!has_failed) printf("%d\n", value);
+}
+
+// Evaluates the newline separated expressions read from fd, printing each result as soon as its line is complete.
+// Reads are done in small chunks and nothing is buffered between them, so there's no limit on the length of a line.
+// When governor is not NULL, every line gets its own budget, see streameval.h.
+static inline void eval_stream_loop(int fd, Governor *governor)
+{
+	char buf[4096];
+	
+	FunctionTable functions;
+	FunctionTable_Init(&functions);
+	
+	StreamEvaluator stream;
+	StreamEvaluator_Init(&stream, &functions, eval_stream_print_result, NULL);
+	stream.governor = governor;
+	
+	ssize_t len;
+	while((len = read(fd, buf, sizeof(buf))) > 0)
+	{
+		stream_evaluator_feed(&stream, buf, (int)len);
+		fflush(stdout);
+	}
+	stream_evaluator_finish(&stream);
+	
+	StreamEvaluator_Free(&stream);
+	FunctionTable_Free(&functions);
+}
+
+// Same as eval_stream_loop() but through an io_uring (see uring.h), so that reading the input and writing the
+// results overlap with the evaluation. Results go to out_fd.
+static inline void eval_uring_loop(int in_fd, int out_fd, Governor *governor)
+{
+	FunctionTable functions;
+	FunctionTable_Init(&functions);
+	
+	UringPipeline pipeline;
+	bool has_buffers = UringPipeline_Init(&pipeline, in_fd, out_fd, &functions);
+	pipeline.stream.governor = governor;
+	if(has_buffers) uring_pipeline_run(&pipeline);
+	else fprintf(stderr, "Could not allocate the pipeline buffers\n");
+	
+	UringPipeline_Free(&pipeline);
+	FunctionTable_Free(&functions);
+}
+
 #endif
@@ -0,0 +1,534 @@
+#ifndef EVALUATOR_H
+#define EVALUATOR_H
+
+// Feature test macros, for the clock_gettime() of governor.h
+#include "platform.h"
+
+// Includes from std
+#include <stdio.h>
+#include <limits.h>
+#include <stdbool.h>
+
+// Includes from project
+#include "expr.h"
+#include "exprlist.h"
+#include "functions.h"
+#include "threadpool.h"
+#include "governor.h"
+
+// Defines
+#ifndef EVALUATOR_PARALLEL_MIN_OPERANDS
+#define EVALUATOR_PARALLEL_MIN_OPERANDS 16384 // Min number of operands a chain needs to be split across the thread pool.
+#endif
+
+#ifndef EVALUATOR_TASKS_PER_THREAD
+#define EVALUATOR_TASKS_PER_THREAD 4 // More tasks than threads so that threads that finish early can pick up more work.
+#endif
+
+#ifndef EVALUATOR_MAX_CALL_DEPTH
+#define EVALUATOR_MAX_CALL_DEPTH 4096 // Max nesting of user function calls, so that runaway recursion fails instead of overflowing the stack.
+#endif
+
+typedef struct {
+	ExprList *exprs;
+	FunctionTable *functions;
+	ThreadPool *pool; // Can be NULL, in which case everything is evaluated on the calling thread.
+	int const *frame; // Arguments of the user function being evaluated.
+	double const *frame_double; // Same as frame, in double mode.
+	bool is_checked; // Divisions by zero (and INT_MIN / -1) fail instead of trapping.
+	bool is_overflow_checked; // "+", "-", "*" and negations that overflow fail instead of wrapping around.
+	Governor *governor; // Can be NULL. When set, evaluated operations, time and call depth are limited.
+	int call_depth; // Number of user function calls being evaluated, bounded by EVALUATOR_MAX_CALL_DEPTH.
+	bool has_failed;
+} Evaluator;
+
+// Shared state of a chain being reduced in parallel. Each task folds a contiguous range of operands into its own
+// partial result, and the partials are then folded in order by the calling thread.
+typedef struct {
+	Evaluator *evaluator;
+	Expr *operands;
+	int operand_count;
+	int task_count;
+	unsigned int *partials;
+	bool *failed;
+	bool is_product;
+} EvaluatorChainJob;
+
+// Forward declarations
+void Evaluator_Init(Evaluator*, ExprList*, FunctionTable*, ThreadPool*);
+void Evaluator_Free(Evaluator*);
+
+int evaluator_eval(Evaluator*, int);
+int evaluator_div(Evaluator*, int, int);
+int evaluator_neg(Evaluator*, int);
+int evaluator_add(Evaluator*, int, int);
+int evaluator_sub(Evaluator*, int, int);
+int evaluator_mul(Evaluator*, int, int);
+int evaluator_apply(Evaluator*, int, int, int);
+int evaluator_compare(int, int, int);
+int evaluator_eval_call(Evaluator*, Expr*);
+int evaluator_call_function(Evaluator*, int, int const*);
+int evaluator_eval_chain(Evaluator*, Expr*);
+int evaluator_eval_fold(Evaluator*, Expr*);
+int evaluator_eval_chain_parallel(Evaluator*, Expr*);
+void evaluator_chain_task(void*, int);
+unsigned int evaluator_fold_operands(Evaluator*, Expr*, int, bool);
+
+double evaluator_eval_double(Evaluator*, int);
+double evaluator_apply_double(int, double, double);
+double evaluator_eval_call_double(Evaluator*, Expr*);
+double evaluator_call_function_double(Evaluator*, int, double const*);
+
+// Implementation
+
+void Evaluator_Init(Evaluator *self, ExprList *expr_list, FunctionTable *functions, ThreadPool *pool)
+{
+	self->exprs = expr_list;
+	self->functions = functions;
+	self->pool = pool;
+	self->frame = NULL;
+	self->frame_double = NULL;
+	self->is_checked = false;
+	self->is_overflow_checked = false;
+	self->governor = NULL;
+	self->call_depth = 0;
+	self->has_failed = false;
+}
+
+void Evaluator_Free(Evaluator *self)
+{
+	self->exprs = NULL;
+	self->functions = NULL;
+	self->pool = NULL;
+	self->frame = NULL;
+	self->frame_double = NULL;
+	self->is_checked = false;
+	self->is_overflow_checked = false;
+	self->governor = NULL;
+	self->call_depth = 0;
+	self->has_failed = false;
+}
+
+// Integer arithmetic wraps around on overflow. It's done through unsigned ints because signed overflow is undefined in
+// C, and because it makes "+" and "*" associative, which is what allows long chains to be split across threads.
+static inline int evaluator_wrap_add(int a, int b) { return (int)((unsigned int)a + (unsigned int)b); }
+static inline int evaluator_wrap_sub(int a, int b) { return (int)((unsigned int)a - (unsigned int)b); }
+static inline int evaluator_wrap_mul(int a, int b) { return (int)((unsigned int)a * (unsigned int)b); }
+
+int evaluator_div(Evaluator *self, int a, int b)
+{
+    if(self->is_checked && (b == 0 || (a == INT_MIN && b == -1)))
+    {
+        self->has_failed = true;
+        return 0;
+    }
+    return a / b;
+}
+
+int evaluator_neg(Evaluator *self, int a)
+{
+    return evaluator_sub(self, 0, a);
+}
+
+int evaluator_add(Evaluator *self, int a, int b)
+{
+    int ans;
+    if(!self->is_overflow_checked) return evaluator_wrap_add(a, b);
+    if(__builtin_add_overflow(a, b, &ans)) self->has_failed = true;
+    return ans;
+}
+
+int evaluator_sub(Evaluator *self, int a, int b)
+{
+    int ans;
+    if(!self->is_overflow_checked) return evaluator_wrap_sub(a, b);
+    if(__builtin_sub_overflow(a, b, &ans)) self->has_failed = true;
+    return ans;
+}
+
+int evaluator_mul(Evaluator *self, int a, int b)
+{
+    int ans;
+    if(!self->is_overflow_checked) return evaluator_wrap_mul(a, b);
+    if(__builtin_mul_overflow(a, b, &ans)) self->has_failed = true;
+    return ans;
+}
+
+// Applies the operation of a chain operand (or of a binary node) to a and b. The unchecked operations were proven safe
+// by the range analysis, so they skip the checks even when the evaluator is checked.
+int evaluator_apply(Evaluator *self, int op, int a, int b)
+{
+    switch(op)
+    {
+        case EXPR_ADD: return evaluator_add(self, a, b);
+        case EXPR_SUB: return evaluator_sub(self, a, b);
+        case EXPR_MUL: return evaluator_mul(self, a, b);
+        case EXPR_DIV: return evaluator_div(self, a, b);
+        case EXPR_ADD_UNCHECKED: return evaluator_wrap_add(a, b);
+        case EXPR_SUB_UNCHECKED: return evaluator_wrap_sub(a, b);
+        case EXPR_MUL_UNCHECKED: return evaluator_wrap_mul(a, b);
+        case EXPR_DIV_UNCHECKED: return a / b;
+        default: return evaluator_compare(op, a, b);
+    }
+}
+
+// Applies a comparison (the op of a binary node or of an EXPR_CHAIN operand) to a and b. Comparisons never fail.
+int evaluator_compare(int op, int a, int b)
+{
+    switch(op)
+    {
+        case EXPR_LT: return a < b;
+        case EXPR_LE: return a <= b;
+        case EXPR_GT: return a > b;
+        case EXPR_GE: return a >= b;
+        case EXPR_EQ: return a == b;
+        case EXPR_NE: return a != b;
+        default: return 0;
+    }
+}
+
+int evaluator_eval(Evaluator *self, int idx)
+{
+    if(self->governor && !governor_step(self->governor))
+    {
+        // Every node fails from now on, so the evaluation unwinds without doing any more real work.
+        self->has_failed = true;
+        return 0;
+    }
+    Expr *expr = ExprList_Get(self->exprs, idx);
+    switch(expr->type)
+    {
+        case EXPR_LITERAL: return expr->value;
+        case EXPR_NEG: return evaluator_neg(self, evaluator_eval(self, expr->lhs));
+
+        case EXPR_ADD: case EXPR_SUB: case EXPR_MUL: case EXPR_DIV: {
+            int l = evaluator_eval(self, expr->lhs);
+            return evaluator_apply(self, expr->type, l, evaluator_eval(self, expr->rhs));
+        }
+
+        // Proven safe by the range analysis, these never overflow nor divide by zero.
+        case EXPR_NEG_UNCHECKED: return evaluator_wrap_sub(0, evaluator_eval(self, expr->lhs));
+        case EXPR_ADD_UNCHECKED: return evaluator_wrap_add(evaluator_eval(self, expr->lhs), evaluator_eval(self, expr->rhs));
+        case EXPR_SUB_UNCHECKED: return evaluator_wrap_sub(evaluator_eval(self, expr->lhs), evaluator_eval(self, expr->rhs));
+        case EXPR_MUL_UNCHECKED: return evaluator_wrap_mul(evaluator_eval(self, expr->lhs), evaluator_eval(self, expr->rhs));
+        case EXPR_DIV_UNCHECKED: {
+            int l = evaluator_eval(self, expr->lhs);
+            return l / evaluator_eval(self, expr->rhs);
+        }
+
+        case EXPR_LT: return evaluator_eval(self, expr->lhs) < evaluator_eval(self, expr->rhs);
+        case EXPR_LE: return evaluator_eval(self, expr->lhs) <= evaluator_eval(self, expr->rhs);
+        case EXPR_GT: return evaluator_eval(self, expr->lhs) > evaluator_eval(self, expr->rhs);
+        case EXPR_GE: return evaluator_eval(self, expr->lhs) >= evaluator_eval(self, expr->rhs);
+        case EXPR_EQ: return evaluator_eval(self, expr->lhs) == evaluator_eval(self, expr->rhs);
+        case EXPR_NE: return evaluator_eval(self, expr->lhs) != evaluator_eval(self, expr->rhs);
+
+        // The C operators already short-circuit, so the rhs is only evaluated when it is needed.
+        case EXPR_AND: return evaluator_eval(self, expr->lhs) && evaluator_eval(self, expr->rhs);
+        case EXPR_OR: return evaluator_eval(self, expr->lhs) || evaluator_eval(self, expr->rhs);
+        case EXPR_TERNARY: return evaluator_eval(self, expr->cond) ? evaluator_eval(self, expr->lhs) : evaluator_eval(self, expr->rhs);
+
+        // The parser only emits these when every operand is cheap and can't trap, so we evaluate all of them and combine
+        // the results with bitwise ops. That way there's no data dependent branch to mispredict. Overflows do trap when
+        // they're checked though, so then the skipped operand must not be evaluated.
+        case EXPR_AND_EAGER: {
+            if(self->is_overflow_checked) return evaluator_eval(self, expr->lhs) && evaluator_eval(self, expr->rhs);
+            int l = evaluator_eval(self, expr->lhs) != 0;
+            int r = evaluator_eval(self, expr->rhs) != 0;
+            return l & r;
+        }
+        case EXPR_OR_EAGER: {
+            if(self->is_overflow_checked) return evaluator_eval(self, expr->lhs) || evaluator_eval(self, expr->rhs);
+            int l = evaluator_eval(self, expr->lhs) != 0;
+            int r = evaluator_eval(self, expr->rhs) != 0;
+            return l | r;
+        }
+        case EXPR_SELECT: {
+            if(self->is_overflow_checked) return evaluator_eval(self, expr->cond) ? evaluator_eval(self, expr->lhs) : evaluator_eval(self, expr->rhs);
+            int mask = -(evaluator_eval(self, expr->cond) != 0); // All bits set when the condition is true.
+            int l = evaluator_eval(self, expr->lhs);
+            int r = evaluator_eval(self, expr->rhs);
+            return (l & mask) | (r & ~mask);
+        }
+
+        case EXPR_PARAM: return self->frame[expr->value];
+        case EXPR_CALL: return evaluator_eval_call(self, expr);
+        case EXPR_SUM: case EXPR_PRODUCT: return evaluator_eval_chain(self, expr);
+        case EXPR_CHAIN: return evaluator_eval_fold(self, expr);
+
+        default: {
+            self->has_failed = true;
+            fprintf(stderr, "Unknown expression found (%s)\n", expr->type >= 0 && expr->type < EXPR_COUNT ? ExprTypeName[expr->type] : "?");
+        } break;
+    }
+    return 0;
+}
+
+int evaluator_eval_call(Evaluator *self, Expr *expr)
+{
+    int args[FUNCTION_MAX_ARGS];
+    int arg_count = 0;
+    for(int idx = expr->lhs; idx >= 0; idx = ExprList_Get(self->exprs, idx)->rhs)
+    {
+        args[arg_count++] = evaluator_eval(self, ExprList_Get(self->exprs, idx)->lhs);
+    }
+    return evaluator_call_function(self, expr->value, args);
+}
+
+int evaluator_call_function(Evaluator *self, int function_idx, int const *args)
+{
+    Function *function = FunctionTable_Get(self->functions, function_idx);
+    // The body was analyzed assuming the declared ranges, so they must hold for it to skip its checks. Compiled formulas
+    // are loaded with the ranges they were declared with, and don't check them themselves.
+    if(function->has_ranges && (self->is_checked || self->is_overflow_checked) && !function_args_in_range(function, args))
+    {
+        self->has_failed = true;
+        return 0;
+    }
+    if(function->native) return function->native(args);
+    
+    if(self->call_depth >= EVALUATOR_MAX_CALL_DEPTH || (self->governor && !governor_enter(self->governor)))
+    {
+        self->has_failed = true;
+        return 0;
+    }
+    
+    // User function bodies live in the function table's ExprList, so switch to it for the duration of the call.
+    ExprList *exprs = self->exprs;
+    int const *frame = self->frame;
+    self->exprs = &self->functions->exprs;
+    self->frame = args;
+    self->call_depth += 1;
+    int ans = evaluator_eval(self, function->body);
+    self->call_depth -= 1;
+    self->exprs = exprs;
+    self->frame = frame;
+    if(self->governor) governor_leave(self->governor, 1);
+    return ans;
+}
+
+// Folds count contiguous operands starting at operands. For sums, subtracting is the same as adding the negated
+// operand in wrap around arithmetic, so the fold only needs "+" (or "*"), which makes partial folds combinable.
+unsigned int evaluator_fold_operands(Evaluator *self, Expr *operands, int count, bool is_product)
+{
+    unsigned int ans = is_product ? 1 : 0;
+    for(int i = 0; i < count; ++i)
+    {
+        unsigned int v = (unsigned int)evaluator_eval(self, operands[i].lhs);
+        if(is_product) ans *= v;
+        else ans += expr_checked_type(operands[i].value) == EXPR_SUB ? 0u - v : v;
+    }
+    return ans;
+}
+
+int evaluator_eval_chain(Evaluator *self, Expr *expr)
+{
+    Expr *operands = ExprList_Get(self->exprs, expr->lhs);
+    bool is_product = expr->type == EXPR_PRODUCT;
+    
+    // Divisions are not associative, so products with divisions are always folded left to right. So are checked
+    // chains, whether a partial result overflows depends on the order in which the operands are folded.
+    if((is_product && (expr->flags & EXPR_FLAG_MAY_TRAP)) || self->is_overflow_checked)
+    {
+        int ans = evaluator_eval(self, operands[0].lhs);
+        for(int i = 1; i < expr->value; ++i)
+        {
+            int v = evaluator_eval(self, operands[i].lhs);
+            ans = evaluator_apply(self, operands[i].value, ans, v);
+        }
+        return ans;
+    }
+    
+    // Governed evaluations stay on the calling thread, a single request must not be able to take over the whole pool.
+    if(self->pool && !self->governor && self->pool->thread_count > 1 && expr->value >= EVALUATOR_PARALLEL_MIN_OPERANDS)
+    {
+        return evaluator_eval_chain_parallel(self, expr);
+    }
+    return (int)evaluator_fold_operands(self, operands, expr->value, is_product);
+}
+
+// Comparison and logical chains are folded left to right, the same way as the left deep tree they stand for, and
+// "&&" and "||" still skip the operands they don't need.
+int evaluator_eval_fold(Evaluator *self, Expr *expr)
+{
+    Expr *operands = ExprList_Get(self->exprs, expr->lhs);
+    int ans = evaluator_eval(self, operands[0].lhs);
+    for(int i = 1; i < expr->value; ++i)
+    {
+        switch(operands[i].value)
+        {
+            case EXPR_AND: ans = ans && evaluator_eval(self, operands[i].lhs); break;
+            case EXPR_OR: ans = ans || evaluator_eval(self, operands[i].lhs); break;
+            default: ans = evaluator_apply(self, operands[i].value, ans, evaluator_eval(self, operands[i].lhs)); break;
+        }
+    }
+    return ans;
+}
+
+void evaluator_chain_task(void *ctx, int task)
+{
+    EvaluatorChainJob *job = (EvaluatorChainJob*)ctx;
+    int begin = (int)((long long)job->operand_count * task / job->task_count);
+    int end = (int)((long long)job->operand_count * (task + 1) / job->task_count);
+    
+    // Every task works on its own copy of the evaluator, with no pool so that nested chains are folded serially.
+    Evaluator evaluator = *job->evaluator;
+    evaluator.pool = NULL;
+    evaluator.has_failed = false;
+    job->partials[task] = evaluator_fold_operands(&evaluator, job->operands + begin, end - begin, job->is_product);
+    job->failed[task] = evaluator.has_failed;
+}
+
+int evaluator_eval_chain_parallel(Evaluator *self, Expr *expr)
+{
+    EvaluatorChainJob job;
+    job.evaluator = self;
+    job.operands = ExprList_Get(self->exprs, expr->lhs);
+    job.operand_count = expr->value;
+    job.task_count = self->pool->thread_count * EVALUATOR_TASKS_PER_THREAD;
+    job.is_product = expr->type == EXPR_PRODUCT;
+    job.partials = (unsigned int*)malloc(job.task_count * (sizeof(unsigned int) + sizeof(bool)));
+    if(!job.partials)
+    {
+        return (int)evaluator_fold_operands(self, job.operands, job.operand_count, job.is_product);
+    }
+    job.failed = (bool*)(job.partials + job.task_count);
+    
+    threadpool_run(self->pool, evaluator_chain_task, &job, job.task_count);
+    
+    unsigned int ans = job.is_product ? 1 : 0;
+    for(int i = 0; i < job.task_count; ++i)
+    {
+        if(job.is_product) ans *= job.partials[i];
+        else ans += job.partials[i];
+        self->has_failed |= job.failed[i];
+    }
+    free(job.partials);
+    return (int)ans;
+}
+
+// Double mode evaluates the same trees (with EXPR_LITERAL_DOUBLE literals) in IEEE 754 arithmetic. Nothing traps, a
+// division by zero gives an infinity or NaN, so is_checked and is_overflow_checked don't apply and the eager nodes are
+// evaluated like their short-circuiting versions. Comparisons and logical operators give 1 or 0, and any value other
+// than 0 (NaN included) is true, same as in C.
+double evaluator_apply_double(int op, double a, double b)
+{
+    switch(expr_checked_type(op))
+    {
+        case EXPR_ADD: return a + b;
+        case EXPR_SUB: return a - b;
+        case EXPR_MUL: return a * b;
+        case EXPR_DIV: return a / b;
+        case EXPR_LT: return a < b;
+        case EXPR_LE: return a <= b;
+        case EXPR_GT: return a > b;
+        case EXPR_GE: return a >= b;
+        case EXPR_EQ: return a == b;
+        case EXPR_NE: return a != b;
+        default: return 0;
+    }
+}
+
+double evaluator_eval_double(Evaluator *self, int idx)
+{
+    if(self->governor && !governor_step(self->governor))
+    {
+        self->has_failed = true;
+        return 0;
+    }
+    Expr *expr = ExprList_Get(self->exprs, idx);
+    switch(expr->type)
+    {
+        case EXPR_LITERAL: return expr->value;
+        case EXPR_LITERAL_DOUBLE: return ExprList_GetDouble(self->exprs, expr->value);
+        case EXPR_NEG: case EXPR_NEG_UNCHECKED: return -evaluator_eval_double(self, expr->lhs);
+
+        case EXPR_ADD: case EXPR_SUB: case EXPR_MUL: case EXPR_DIV:
+        case EXPR_ADD_UNCHECKED: case EXPR_SUB_UNCHECKED: case EXPR_MUL_UNCHECKED: case EXPR_DIV_UNCHECKED: {
+            double l = evaluator_eval_double(self, expr->lhs);
+            return evaluator_apply_double(expr->type, l, evaluator_eval_double(self, expr->rhs));
+        }
+
+        case EXPR_LT: return evaluator_eval_double(self, expr->lhs) < evaluator_eval_double(self, expr->rhs);
+        case EXPR_LE: return evaluator_eval_double(self, expr->lhs) <= evaluator_eval_double(self, expr->rhs);
+        case EXPR_GT: return evaluator_eval_double(self, expr->lhs) > evaluator_eval_double(self, expr->rhs);
+        case EXPR_GE: return evaluator_eval_double(self, expr->lhs) >= evaluator_eval_double(self, expr->rhs);
+        case EXPR_EQ: return evaluator_eval_double(self, expr->lhs) == evaluator_eval_double(self, expr->rhs);
+        case EXPR_NE: return evaluator_eval_double(self, expr->lhs) != evaluator_eval_double(self, expr->rhs);
+
+        case EXPR_AND: case EXPR_AND_EAGER: return evaluator_eval_double(self, expr->lhs) != 0 && evaluator_eval_double(self, expr->rhs) != 0;
+        case EXPR_OR: case EXPR_OR_EAGER: return evaluator_eval_double(self, expr->lhs) != 0 || evaluator_eval_double(self, expr->rhs) != 0;
+        case EXPR_TERNARY: case EXPR_SELECT: {
+            return evaluator_eval_double(self, expr->cond) != 0 ? evaluator_eval_double(self, expr->lhs) : evaluator_eval_double(self, expr->rhs);
+        }
+
+        case EXPR_PARAM: return self->frame_double[expr->value];
+        case EXPR_CALL: return evaluator_eval_call_double(self, expr);
+
+        // Floating point "+" and "*" are not associative, so chains are always folded left to right.
+        case EXPR_SUM: case EXPR_PRODUCT: case EXPR_CHAIN: {
+            Expr *operands = ExprList_Get(self->exprs, expr->lhs);
+            double ans = evaluator_eval_double(self, operands[0].lhs);
+            for(int i = 1; i < expr->value; ++i)
+            {
+                switch(operands[i].value)
+                {
+                    case EXPR_AND: ans = ans != 0 && evaluator_eval_double(self, operands[i].lhs) != 0; break;
+                    case EXPR_OR: ans = ans != 0 || evaluator_eval_double(self, operands[i].lhs) != 0; break;
+                    default: ans = evaluator_apply_double(operands[i].value, ans, evaluator_eval_double(self, operands[i].lhs)); break;
+                }
+            }
+            return ans;
+        }
+
+        default: {
+            self->has_failed = true;
+            fprintf(stderr, "Unknown expression found (%s)\n", expr->type >= 0 && expr->type < EXPR_COUNT ? ExprTypeName[expr->type] : "?");
+        } break;
+    }
+    return 0;
+}
+
+double evaluator_eval_call_double(Evaluator *self, Expr *expr)
+{
+    double args[FUNCTION_MAX_ARGS];
+    int arg_count = 0;
+    for(int idx = expr->lhs; idx >= 0; idx = ExprList_Get(self->exprs, idx)->rhs)
+    {
+        args[arg_count++] = evaluator_eval_double(self, ExprList_Get(self->exprs, idx)->lhs);
+    }
+    return evaluator_call_function_double(self, expr->value, args);
+}
+
+// Declared parameter ranges are int ranges, they're ignored in double mode.
+double evaluator_call_function_double(Evaluator *self, int function_idx, double const *args)
+{
+    Function *function = FunctionTable_Get(self->functions, function_idx);
+    if(function->native_double) return function->native_double(args);
+    if(function->native)
+    {
+        self->has_failed = true;
+        fprintf(stderr, "Function '%s' has no double version\n", function->name);
+        return 0;
+    }
+    
+    if(self->call_depth >= EVALUATOR_MAX_CALL_DEPTH || (self->governor && !governor_enter(self->governor)))
+    {
+        self->has_failed = true;
+        return 0;
+    }
+    
+    ExprList *exprs = self->exprs;
+    double const *frame = self->frame_double;
+    self->exprs = &self->functions->exprs;
+    self->frame_double = args;
+    self->call_depth += 1;
+    double ans = evaluator_eval_double(self, function->body);
+    self->call_depth -= 1;
+    self->exprs = exprs;
+    self->frame_double = frame;
+    if(self->governor) governor_leave(self->governor, 1);
+    return ans;
+}
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+// Includes from std
+#include <stdbool.h>
+
+// Expression nodes produced by the parser. Nodes live in a flat ExprList and refer to their children by index, so a whole
+// expression is a single allocation that can be cleared and reused just like a TokenList.
+
+enum ExprType
+{
+    EXPR_NONE = 0,
+    EXPR_LITERAL,
+    EXPR_NEG,
+    EXPR_ADD, EXPR_SUB, EXPR_MUL, EXPR_DIV,
+    EXPR_LT, EXPR_LE, EXPR_GT, EXPR_GE, EXPR_EQ, EXPR_NE,
+    EXPR_AND, EXPR_OR, EXPR_TERNARY, // Short-circuit, only the operands that are needed are evaluated.
+    EXPR_AND_EAGER, EXPR_OR_EAGER, EXPR_SELECT, // Branchless, all operands are evaluated. Only emitted for cheap operands that can't trap.
+    EXPR_PARAM, // Parameter of the user function being evaluated, value is the parameter index.
+    EXPR_CALL, // Call to a function that was not inlined, value is the function index and lhs is the first EXPR_ARG.
+    EXPR_ARG, // Argument of a call, lhs is the argument expression and rhs the next EXPR_ARG (or -1).
+    EXPR_SUM, EXPR_PRODUCT, // Long "+ -" / "* /" chains, value is the operand count and lhs the first EXPR_OPERAND.
+    EXPR_OPERAND, // Operand of a chain, value is EXPR_ADD / EXPR_SUB or EXPR_MUL / EXPR_DIV (the binary type for EXPR_CHAIN), lhs the operand expression and rhs the next EXPR_OPERAND (or -1). All the operands of a chain are contiguous.
+    EXPR_NEG_UNCHECKED, EXPR_ADD_UNCHECKED, EXPR_SUB_UNCHECKED, EXPR_MUL_UNCHECKED, EXPR_DIV_UNCHECKED, // Proven by the range analysis (range.h) to never overflow or divide by zero, so they're never checked. Also used as the op of chain operands.
+    EXPR_LITERAL_DOUBLE, // Literal of double mode, value is its index in the doubles of the ExprList.
+    EXPR_CHAIN, // Long chains of comparisons, "==" / "!=", "&&" or "||", laid out like EXPR_SUM. The op of every operand is the binary type (EXPR_LT, ..., EXPR_AND, EXPR_OR) and the chain is folded left to right, with "&&" and "||" still short-circuiting.
+    EXPR_COUNT,
+};
+
+static char const * const ExprTypeName[] = {
+    "EXPR_NONE",
+    "EXPR_LITERAL",
+    "EXPR_NEG",
+    "EXPR_ADD", "EXPR_SUB", "EXPR_MUL", "EXPR_DIV",
+    "EXPR_LT", "EXPR_LE", "EXPR_GT", "EXPR_GE", "EXPR_EQ", "EXPR_NE",
+    "EXPR_AND", "EXPR_OR", "EXPR_TERNARY",
+    "EXPR_AND_EAGER", "EXPR_OR_EAGER", "EXPR_SELECT",
+    "EXPR_PARAM", "EXPR_CALL", "EXPR_ARG",
+    "EXPR_SUM", "EXPR_PRODUCT",
+    "EXPR_OPERAND",
+    "EXPR_NEG_UNCHECKED", "EXPR_ADD_UNCHECKED", "EXPR_SUB_UNCHECKED", "EXPR_MUL_UNCHECKED", "EXPR_DIV_UNCHECKED",
+    "EXPR_LITERAL_DOUBLE",
+    "EXPR_CHAIN",
+    "EXPR_COUNT",
+};
+
+// Flags
+#define EXPR_FLAG_MAY_TRAP 0x1 // The node (or one of its children) can fault when evaluated, eg: division by zero.
+
+typedef struct {
+    int type;
+    int value; // Literal value, parameter index or function index depending on the type.
+    int lhs, rhs; // Children. For ternaries, lhs and rhs are the "then" and "else" branches.
+    int cond; // Condition of ternaries and selects.
+    int cost; // Number of nodes in the subtree rooted at this node.
+    int flags;
+} Expr;
+
+// Whether the node is a chain whose operands are contiguous EXPR_OPERAND nodes starting at lhs.
+static inline bool expr_is_chain(int type)
+{
+    return type == EXPR_SUM || type == EXPR_PRODUCT || type == EXPR_CHAIN;
+}
+
+// Returns the checked version of an arithmetic operation, and any other type as is.
+static inline int expr_checked_type(int type)
+{
+    switch(type)
+    {
+        case EXPR_NEG_UNCHECKED: return EXPR_NEG;
+        case EXPR_ADD_UNCHECKED: return EXPR_ADD;
+        case EXPR_SUB_UNCHECKED: return EXPR_SUB;
+        case EXPR_MUL_UNCHECKED: return EXPR_MUL;
+        case EXPR_DIV_UNCHECKED: return EXPR_DIV;
+        default: return type;
+    }
+}
+
+// Returns the unchecked version of an arithmetic operation, and any other type as is.
+static inline int expr_unchecked_type(int type)
+{
+    switch(type)
+    {
+        case EXPR_NEG: return EXPR_NEG_UNCHECKED;
+        case EXPR_ADD: return EXPR_ADD_UNCHECKED;
+        case EXPR_SUB: return EXPR_SUB_UNCHECKED;
+        case EXPR_MUL: return EXPR_MUL_UNCHECKED;
+        case EXPR_DIV: return EXPR_DIV_UNCHECKED;
+        default: return type;
+    }
+}
+
+#endif
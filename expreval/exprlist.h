@@ -0,0 +1,124 @@
+#ifndef EXPR_LIST_H
+#define EXPR_LIST_H
+
+#include "expr.h"
+
+#ifndef EXPR_LIST_FREE
+#define EXPR_LIST_FREE free
+#define EXPR_LIST_MUST_INCLUDE_STDLIB
+#endif
+
+#ifndef EXPR_LIST_MALLOC
+#define EXPR_LIST_MALLOC malloc
+#define EXPR_LIST_MUST_INCLUDE_STDLIB
+#endif
+
+#ifndef EXPR_LIST_REALLOC
+#define EXPR_LIST_REALLOC realloc
+#define EXPR_LIST_MUST_INCLUDE_STDLIB
+#endif
+
+#ifndef EXPR_LIST_INITIAL_CAPACITY
+#define EXPR_LIST_INITIAL_CAPACITY 8
+#endif
+
+#ifdef EXPR_LIST_MUST_INCLUDE_STDLIB
+#include <stdlib.h>
+#endif
+
+typedef struct {
+    Expr *data;
+    int len, cap;
+    double *doubles; // Values of the EXPR_LITERAL_DOUBLE nodes, only allocated once one is added.
+    int doubles_len, doubles_cap;
+} ExprList;
+
+void ExprList_Init(ExprList *self)
+{
+    self->data = (Expr*)EXPR_LIST_MALLOC(EXPR_LIST_INITIAL_CAPACITY * sizeof(Expr));
+    self->len = 0;
+    self->cap = EXPR_LIST_INITIAL_CAPACITY;
+    self->doubles = NULL;
+    self->doubles_len = 0;
+    self->doubles_cap = 0;
+}
+
+void ExprList_Free(ExprList *self)
+{
+    if(self->data) EXPR_LIST_FREE(self->data);
+    self->data = NULL;
+    self->len = 0;
+    self->cap = 0;
+    if(self->doubles) EXPR_LIST_FREE(self->doubles);
+    self->doubles = NULL;
+    self->doubles_len = 0;
+    self->doubles_cap = 0;
+}
+
+Expr *ExprList_Get(ExprList *self, int idx)
+{
+    return &self->data[idx];
+}
+
+void ExprList_Realloc(ExprList *self, int new_cap)
+{
+    Expr *temp = (Expr*)EXPR_LIST_REALLOC(self->data, new_cap * sizeof(Expr));
+    if(temp)
+    {
+        self->data = temp;
+        self->cap = new_cap;
+    }
+}
+
+void ExprList_TryRealloc(ExprList *self)
+{
+    if(self->len >= self->cap) ExprList_Realloc(self, self->cap * 2);
+}
+
+// Returns the index of the newly added node, which is what parent nodes use to refer to it.
+int ExprList_Add(ExprList *self, Expr expr)
+{
+    ExprList_TryRealloc(self);
+    self->data[self->len] = expr;
+    self->len += 1;
+    return self->len - 1;
+}
+
+// Returns the index of the newly added double, which is the value of the EXPR_LITERAL_DOUBLE node that refers to it.
+int ExprList_AddDouble(ExprList *self, double value)
+{
+    if(self->doubles_len >= self->doubles_cap)
+    {
+        int new_cap = self->doubles_cap ? self->doubles_cap * 2 : EXPR_LIST_INITIAL_CAPACITY;
+        double *temp = (double*)EXPR_LIST_REALLOC(self->doubles, new_cap * sizeof(double));
+        if(!temp) return -1;
+        self->doubles = temp;
+        self->doubles_cap = new_cap;
+    }
+    self->doubles[self->doubles_len] = value;
+    self->doubles_len += 1;
+    return self->doubles_len - 1;
+}
+
+double ExprList_GetDouble(ExprList *self, int idx)
+{
+    return self->doubles[idx];
+}
+
+void ExprList_Clear(ExprList *self)
+{
+	self->len = 0; // Same as with the TokenList, Expr is a POD type so the memory can be reused as is.
+	self->doubles_len = 0;
+}
+
+int ExprList_Length(ExprList *self)
+{
+	return self->len;
+}
+
+int ExprList_Capacity(ExprList *self)
+{
+	return self->cap;
+}
+
+#endif
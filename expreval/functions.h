@@ -0,0 +1,270 @@
+#ifndef FUNCTIONS_H
+#define FUNCTIONS_H
+
+// Includes from std
+#include <string.h>
+#include <limits.h>
+#include <stdbool.h>
+
+// Includes from project
+#include "expr.h"
+#include "exprlist.h"
+
+// Defines
+#ifndef FUNCTION_NAME_MAX
+#define FUNCTION_NAME_MAX 32
+#endif
+
+#ifndef FUNCTION_MAX_ARGS
+#define FUNCTION_MAX_ARGS 8 // Arguments are evaluated into a fixed size array on the stack, so calls never allocate.
+#endif
+
+#ifndef FUNCTION_INLINE_MAX_COST
+#define FUNCTION_INLINE_MAX_COST 32 // Max number of nodes a user function body can have for its calls to be inlined.
+#endif
+
+#ifndef FUNCTION_TABLE_INITIAL_CAPACITY
+#define FUNCTION_TABLE_INITIAL_CAPACITY 16
+#endif
+
+typedef int (*NativeFunction)(int const *args);
+typedef double (*NativeDoubleFunction)(double const *args);
+
+typedef struct {
+    char name[FUNCTION_NAME_MAX];
+    int arity;
+    NativeFunction native; // NULL for user defined functions.
+    NativeDoubleFunction native_double; // Version of native for double mode. NULL if the function has none.
+    int body; // Root node of the body within the function table's ExprList, or -1 while the body is still being parsed.
+    int body_begin, body_end; // Every node of the body is in this range of the ExprList, no other node refers to them.
+    int doubles_begin, doubles_end; // Same for the doubles of the body's EXPR_LITERAL_DOUBLE nodes.
+    int param_uses[FUNCTION_MAX_ARGS]; // How many times each parameter shows up in the body, used to decide if a call can be inlined.
+    int param_min[FUNCTION_MAX_ARGS], param_max[FUNCTION_MAX_ARGS]; // Declared range of each parameter, inclusive.
+    bool has_ranges; // Some parameter has a declared range. Checked calls fail when an argument is out of it.
+    bool is_inlined; // Some call to it was inlined into the body of another function, so it can't be redefined.
+} Function;
+
+// Both the builtins and the user defined functions live in the same table. User function bodies are stored in the
+// table's own ExprList, where parameters are EXPR_PARAM nodes that refer to the arguments of the current call.
+typedef struct {
+    Function *data;
+    int len, cap;
+    ExprList exprs;
+} FunctionTable;
+
+// Forward declarations
+void FunctionTable_Init(FunctionTable*);
+void FunctionTable_Free(FunctionTable*);
+
+Function *FunctionTable_Get(FunctionTable*, int);
+int FunctionTable_Find(FunctionTable*, char const*, int);
+int FunctionTable_Add(FunctionTable*, char const*, int, int, NativeFunction);
+int FunctionTable_Length(FunctionTable*);
+
+void function_table_remove_body(FunctionTable*, int, int, int, int);
+void function_count_param_uses(ExprList*, int, int*);
+void function_clear_ranges(Function*);
+void function_declare_range(Function*, int, int, int);
+bool function_args_in_range(Function*, int const*);
+
+int powi(int, int);
+double powd(double, double);
+
+// Builtins
+int builtin_min(int const *args) { return args[0] < args[1] ? args[0] : args[1]; }
+int builtin_max(int const *args) { return args[0] > args[1] ? args[0] : args[1]; }
+int builtin_abs(int const *args) { return args[0] < 0 ? (int)(0u - (unsigned int)args[0]) : args[0]; } // abs(INT_MIN) wraps around to INT_MIN.
+int builtin_clamp(int const *args) { return args[0] < args[1] ? args[1] : args[0] > args[2] ? args[2] : args[0]; }
+int builtin_pow(int const *args) { return powi(args[0], args[1]); }
+
+double builtin_min_double(double const *args) { return args[0] < args[1] ? args[0] : args[1]; }
+double builtin_max_double(double const *args) { return args[0] > args[1] ? args[0] : args[1]; }
+double builtin_abs_double(double const *args) { return __builtin_fabs(args[0]); }
+double builtin_clamp_double(double const *args) { return args[0] < args[1] ? args[1] : args[0] > args[2] ? args[2] : args[0]; }
+double builtin_pow_double(double const *args) { return powd(args[0], args[1]); }
+
+// Implementation
+
+void FunctionTable_Init(FunctionTable *self)
+{
+	self->data = (Function*)EXPR_LIST_MALLOC(FUNCTION_TABLE_INITIAL_CAPACITY * sizeof(Function));
+	self->len = 0;
+	self->cap = FUNCTION_TABLE_INITIAL_CAPACITY;
+	ExprList_Init(&self->exprs);
+
+	FunctionTable_Add(self, "min", 3, 2, builtin_min);
+	FunctionTable_Add(self, "max", 3, 2, builtin_max);
+	FunctionTable_Add(self, "abs", 3, 1, builtin_abs);
+	FunctionTable_Add(self, "clamp", 5, 3, builtin_clamp);
+	FunctionTable_Add(self, "pow", 3, 2, builtin_pow);
+
+	NativeDoubleFunction doubles[] = {builtin_min_double, builtin_max_double, builtin_abs_double, builtin_clamp_double, builtin_pow_double};
+	for(int i = 0; i < (int)(sizeof(doubles) / sizeof(doubles[0])); ++i) self->data[i].native_double = doubles[i];
+}
+
+void FunctionTable_Free(FunctionTable *self)
+{
+	if(self->data) EXPR_LIST_FREE(self->data);
+	self->data = NULL;
+	self->len = 0;
+	self->cap = 0;
+	ExprList_Free(&self->exprs);
+}
+
+Function *FunctionTable_Get(FunctionTable *self, int idx)
+{
+    return &self->data[idx];
+}
+
+// Returns the index of the function with the given name, or -1 if there is none.
+int FunctionTable_Find(FunctionTable *self, char const *name, int name_length)
+{
+    for(int i = 0; i < self->len; ++i)
+    {
+        if(strncmp(self->data[i].name, name, name_length) == 0 && self->data[i].name[name_length] == '\0')
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Returns the index of the newly added function, or -1 if it could not be added.
+int FunctionTable_Add(FunctionTable *self, char const *name, int name_length, int arity, NativeFunction native)
+{
+    if(name_length >= FUNCTION_NAME_MAX || arity > FUNCTION_MAX_ARGS) return -1;
+    if(self->len >= self->cap)
+    {
+        Function *temp = (Function*)EXPR_LIST_REALLOC(self->data, self->cap * 2 * sizeof(Function));
+        if(!temp) return -1;
+        self->data = temp;
+        self->cap *= 2;
+    }
+    Function *function = &self->data[self->len];
+    memset(function, 0, sizeof(Function));
+    memcpy(function->name, name, name_length);
+    function->arity = arity;
+    function->native = native;
+    function->body = -1;
+    function_clear_ranges(function);
+    self->len += 1;
+    return self->len - 1;
+}
+
+int FunctionTable_Length(FunctionTable *self)
+{
+	return self->len;
+}
+
+// Removes the nodes in [begin, end) and the doubles in [doubles_begin, doubles_end) of a body that is not used anymore,
+// like the old body of a redefined function. Everything after them is moved down, along with the indices that refer to it.
+void function_table_remove_body(FunctionTable *self, int begin, int end, int doubles_begin, int doubles_end)
+{
+    ExprList *exprs = &self->exprs;
+    int count = end - begin, doubles_count = doubles_end - doubles_begin;
+    memmove(exprs->data + begin, exprs->data + end, (exprs->len - end) * sizeof(Expr));
+    exprs->len -= count;
+    for(int i = begin; i < exprs->len; ++i)
+    {
+        Expr *expr = &exprs->data[i];
+        if(expr->lhs >= end) expr->lhs -= count;
+        if(expr->rhs >= end) expr->rhs -= count;
+        if(expr->cond >= end) expr->cond -= count;
+        if(expr->type == EXPR_LITERAL_DOUBLE && expr->value >= doubles_end) expr->value -= doubles_count;
+    }
+    if(doubles_count > 0)
+    {
+        memmove(exprs->doubles + doubles_begin, exprs->doubles + doubles_end, (exprs->doubles_len - doubles_end) * sizeof(double));
+        exprs->doubles_len -= doubles_count;
+    }
+    for(int i = 0; i < self->len; ++i)
+    {
+        Function *function = &self->data[i];
+        if(function->body >= end) function->body -= count;
+        if(function->body_begin >= end)
+        {
+            function->body_begin -= count;
+            function->body_end -= count;
+        }
+        if(function->doubles_begin >= doubles_end)
+        {
+            function->doubles_begin -= doubles_count;
+            function->doubles_end -= doubles_count;
+        }
+    }
+}
+
+void function_count_param_uses(ExprList *exprs, int idx, int *uses)
+{
+    // The rhs is followed in a loop, so the operands of a long chain don't recurse once each.
+    for(Expr *expr; idx >= 0; idx = expr->rhs)
+    {
+        expr = ExprList_Get(exprs, idx);
+        if(expr->type == EXPR_PARAM)
+        {
+            uses[expr->value] += 1;
+            return;
+        }
+        function_count_param_uses(exprs, expr->lhs, uses);
+        function_count_param_uses(exprs, expr->cond, uses);
+    }
+}
+
+void function_clear_ranges(Function *self)
+{
+    for(int i = 0; i < FUNCTION_MAX_ARGS; ++i)
+    {
+        self->param_min[i] = INT_MIN;
+        self->param_max[i] = INT_MAX;
+    }
+    self->has_ranges = false;
+}
+
+// Declares that the given parameter is always in [lo, hi]. The range analysis relies on it for the function's body.
+void function_declare_range(Function *self, int param, int lo, int hi)
+{
+    self->param_min[param] = lo;
+    self->param_max[param] = hi;
+    self->has_ranges = true;
+}
+
+bool function_args_in_range(Function *self, int const *args)
+{
+    for(int i = 0; i < self->arity; ++i)
+    {
+        if(args[i] < self->param_min[i] || args[i] > self->param_max[i]) return false;
+    }
+    return true;
+}
+
+// Integer power by squaring. Negative exponents truncate towards 0 just like integer division would.
+int powi(int a, int b)
+{
+    if(b < 0) return a == 1 ? 1 : a == -1 ? (b & 1 ? -1 : 1) : 0;
+    unsigned int base = (unsigned int)a, ans = 1;
+    while(b > 0)
+    {
+        if(b & 1) ans *= base;
+        base *= base;
+        b >>= 1;
+    }
+    return (int)ans;
+}
+
+// Only integral exponents are supported, same as powi(), so that double mode doesn't need libm. Any other exponent gives
+// NaN.
+double powd(double a, double b)
+{
+    if(!(b > -9.2e18 && b < 9.2e18) || b != (double)(long long)b) return __builtin_nan("");
+    unsigned long long n = b < 0 ? (unsigned long long)-b : (unsigned long long)b;
+    double ans = 1.0;
+    while(n > 0)
+    {
+        if(n & 1) ans *= a;
+        a *= a;
+        n >>= 1;
+    }
+    return b < 0 ? 1.0 / ans : ans;
+}
+
+#endif
@@ -0,0 +1,204 @@
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+// Feature test macros, for clock_gettime()
+#include "platform.h"
+
+// Includes from std
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+
+// Resource limits for expressions coming from untrusted sources. A Governor is shared by the Scanner, Parser and
+// Evaluator working on the same request, and records the first limit that was exceeded so the caller can tell why
+// the request failed.
+//
+// Checks are meant to be cheap enough to stay on all the time. Input size and token count are checked as they grow,
+// depth on every nested parse / call, and evaluated operations are counted down in a plain int so that the actual
+// accounting (and the clock read for the time budget) only happens once every GOVERNOR_CHECK_INTERVAL operations.
+//
+// A limit of 0 means no limit.
+
+// Defines
+#ifndef GOVERNOR_CHECK_INTERVAL
+#define GOVERNOR_CHECK_INTERVAL 4096 // Max number of operations evaluated between two checks of the operation and time budgets.
+#endif
+
+#define GOVERNOR_DEFAULT_MAX_INPUT_BYTES (1 << 20)
+#define GOVERNOR_DEFAULT_MAX_TOKENS (1 << 16)
+#define GOVERNOR_DEFAULT_MAX_DEPTH 256
+#define GOVERNOR_DEFAULT_MAX_OPERATIONS 10000000LL
+#define GOVERNOR_DEFAULT_MAX_NANOSECONDS 100000000LL // 100ms
+
+enum GovernorError
+{
+    GOVERNOR_OK = 0,
+    GOVERNOR_ERROR_INPUT_BYTES,
+    GOVERNOR_ERROR_TOKENS,
+    GOVERNOR_ERROR_DEPTH,
+    GOVERNOR_ERROR_OPERATIONS,
+    GOVERNOR_ERROR_TIME,
+    GOVERNOR_ERROR_COUNT,
+};
+
+static char const * const GovernorErrorName[] = {
+    "GOVERNOR_OK",
+    "GOVERNOR_ERROR_INPUT_BYTES",
+    "GOVERNOR_ERROR_TOKENS",
+    "GOVERNOR_ERROR_DEPTH",
+    "GOVERNOR_ERROR_OPERATIONS",
+    "GOVERNOR_ERROR_TIME",
+    "GOVERNOR_ERROR_COUNT",
+};
+
+typedef struct {
+	long long max_input_bytes;
+	int max_tokens;
+	int max_depth; // Nesting of groups, calls and operator chains while parsing, and of user function calls while evaluating.
+	long long max_operations; // Expression nodes evaluated.
+	long long max_nanoseconds; // Wall clock time since governor_start().
+} GovernorLimits;
+
+typedef struct {
+	GovernorLimits limits;
+	int error; // GovernorError, the first limit that was exceeded.
+	int depth;
+	long long operations; // Operations accounted for by the previous checks.
+	int interval; // Operations allowed between the previous check and the next one.
+	int countdown; // Operations left before the next check.
+	long long deadline; // In nanoseconds of CLOCK_MONOTONIC, 0 if there is no time budget.
+	bool is_quiet; // Don't print errors, only record them.
+} Governor;
+
+// Forward declarations
+void Governor_Init(Governor*, GovernorLimits);
+void Governor_Free(Governor*);
+
+GovernorLimits governor_default_limits(void);
+void governor_start(Governor*);
+bool governor_fail(Governor*, int);
+bool governor_check_input(Governor*, long long);
+bool governor_check_tokens(Governor*, int);
+bool governor_enter(Governor*);
+void governor_leave(Governor*, int);
+bool governor_tick(Governor*);
+long long governor_now(void);
+
+// Implementation
+
+void Governor_Init(Governor *self, GovernorLimits limits)
+{
+	self->limits = limits;
+	self->is_quiet = false;
+	governor_start(self);
+}
+
+void Governor_Free(Governor *self)
+{
+	self->error = GOVERNOR_OK;
+	self->depth = 0;
+	self->operations = 0;
+	self->interval = 0;
+	self->countdown = 0;
+	self->deadline = 0;
+}
+
+GovernorLimits governor_default_limits(void)
+{
+    GovernorLimits limits = {
+        GOVERNOR_DEFAULT_MAX_INPUT_BYTES,
+        GOVERNOR_DEFAULT_MAX_TOKENS,
+        GOVERNOR_DEFAULT_MAX_DEPTH,
+        GOVERNOR_DEFAULT_MAX_OPERATIONS,
+        GOVERNOR_DEFAULT_MAX_NANOSECONDS,
+    };
+    return limits;
+}
+
+long long governor_now(void)
+{
+    // CLOCK_MONOTONIC is served from the vDSO on Linux, so this is not a real syscall.
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline int governor_next_interval(Governor *self)
+{
+    long long interval = GOVERNOR_CHECK_INTERVAL;
+    // Check right on the first operation over the budget, so the operation limit is exact.
+    if(self->limits.max_operations > 0 && self->limits.max_operations - self->operations + 1 < interval)
+    {
+        interval = self->limits.max_operations - self->operations + 1;
+    }
+    return (int)interval;
+}
+
+// Resets the counters and starts the clock for a new request.
+void governor_start(Governor *self)
+{
+    self->error = GOVERNOR_OK;
+    self->depth = 0;
+    self->operations = 0;
+    self->interval = governor_next_interval(self);
+    self->countdown = self->interval;
+    self->deadline = self->limits.max_nanoseconds > 0 ? governor_now() + self->limits.max_nanoseconds : 0;
+}
+
+// Records the error (only the first one is kept) and always returns false.
+bool governor_fail(Governor *self, int error)
+{
+    if(self->error == GOVERNOR_OK)
+    {
+        self->error = error;
+        if(!self->is_quiet) fprintf(stderr, "Limit exceeded (%s)\n", GovernorErrorName[error]);
+    }
+    // Every following operation goes through governor_tick(), which keeps failing.
+    self->interval = 0;
+    self->countdown = 0;
+    return false;
+}
+
+bool governor_check_input(Governor *self, long long bytes)
+{
+    if(self->limits.max_input_bytes > 0 && bytes > self->limits.max_input_bytes) return governor_fail(self, GOVERNOR_ERROR_INPUT_BYTES);
+    return self->error == GOVERNOR_OK;
+}
+
+bool governor_check_tokens(Governor *self, int count)
+{
+    if(self->limits.max_tokens > 0 && count > self->limits.max_tokens) return governor_fail(self, GOVERNOR_ERROR_TOKENS);
+    return self->error == GOVERNOR_OK;
+}
+
+bool governor_enter(Governor *self)
+{
+    self->depth += 1;
+    if(self->limits.max_depth > 0 && self->depth > self->limits.max_depth) return governor_fail(self, GOVERNOR_ERROR_DEPTH);
+    return self->error == GOVERNOR_OK;
+}
+
+void governor_leave(Governor *self, int count)
+{
+    self->depth -= count;
+}
+
+// Slow path of governor_step(), accounts for the operations of the last interval and checks the budgets.
+bool governor_tick(Governor *self)
+{
+    if(self->error != GOVERNOR_OK) return governor_fail(self, self->error);
+    self->operations += self->interval;
+    if(self->limits.max_operations > 0 && self->operations > self->limits.max_operations) return governor_fail(self, GOVERNOR_ERROR_OPERATIONS);
+    if(self->deadline > 0 && governor_now() > self->deadline) return governor_fail(self, GOVERNOR_ERROR_TIME);
+    self->interval = governor_next_interval(self);
+    self->countdown = self->interval;
+    return true;
+}
+
+// Called for every evaluated operation. Returns false once a budget is exceeded.
+static inline bool governor_step(Governor *self)
+{
+    return --self->countdown > 0 || governor_tick(self);
+}
+
+#endif
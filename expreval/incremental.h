@@ -0,0 +1,916 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+// Feature test macros, for the clock_gettime() of governor.h
+#include "platform.h"
+
+// Includes from std
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <stdbool.h>
+
+// Includes from project
+#include "token.h"
+#include "tokenlist.h"
+#include "scanner.h"
+#include "expr.h"
+#include "exprlist.h"
+#include "functions.h"
+#include "evaluator.h"
+#include "parser.h"
+
+// Incremental parser for editors that re-evaluate a (possibly huge) formula on every keystroke. It keeps the text, its
+// tokens and its tree between edits. An edit replaces a byte range of the text, and only the tokens around it are
+// scanned again. The tree is then re-parsed from the smallest node that contains the changed tokens, at the grammar
+// level that node was parsed at, and the new subtree is spliced in place of the old one. Every other subtree is kept
+// as is, values included, so evaluating after an edit only recomputes the nodes on the path to the root.
+//
+// Re-parsing a node from its first token is only equivalent to a full parse if it ends right where the old node ended
+// (the tokens after it are untouched, so the enclosing productions go on just like before). When it doesn't, like when
+// the edit turned "2" into "2 + 3" inside of a product, the enclosing node is tried instead, up to the root.
+//
+// Calls are never re-parsed partially: their arguments can end up shared or copied when the call is inlined. Dead
+// subtrees pile up at the end of the ExprList, and the whole tree is rebuilt once they outnumber the live nodes.
+//
+// Nothing outside of the edited window is touched when an edit adds or removes chars. The text and the tokens are gap
+// buffers, so an edit only moves what lies between it and the previous one, and token starts are locations in the
+// text buffer, which don't change for the text after the gap. Node spans are token indices, and are shifted lazily.
+//
+// Function definitions can't be edited. The function table must not change between edits, otherwise set the text
+// again to re-parse with the new definitions.
+
+// Defines
+#ifndef INCREMENTAL_PARSER_MIN_GARBAGE
+#define INCREMENTAL_PARSER_MIN_GARBAGE 1024 // Dead nodes always allowed before the tree is rebuilt.
+#endif
+
+#ifndef INCREMENTAL_PARSER_MAX_SHIFTS
+#define INCREMENTAL_PARSER_MAX_SHIFTS 64 // Edits whose token shifts are logged before they're applied to every node.
+#endif
+
+// Tokens from at onwards moved by delta. Spans are only shifted when they're looked at: nodes that were already there
+// when the log was started go through offsets, which is all of the logged shifts combined, and the others replay the
+// shifts that were logged after them.
+typedef struct {
+	int at;
+	int delta;
+} IncrementalShift;
+
+typedef struct {
+	int begin, end; // Tokens the node was parsed from, [begin, end).
+	int level; // ParserLevel the node was returned from, PARSER_LEVEL_NONE for the inner nodes of short chains, operands and arguments.
+	int parent; // -1 for the root.
+	int value;
+	bool has_failed; // Evaluating the node failed, eg: division by zero.
+	bool is_valid; // Whether value is up to date.
+	bool is_opaque; // Calls (inlined or not). Never re-parsed partially.
+	int pending; // Sum chains only, operand whose term is missing from value, or -1. The others are still accounted for.
+	int epoch; // Number of logged shifts already applied to begin and end. 0 for spans from before the log was started.
+} IncrementalNode;
+
+typedef struct {
+	// The text is text[0, text_gap) followed by the last text_len - text_gap bytes of the buffer before its last one,
+	// which is kept for a '\0'. Use incremental_parser_text() to get it in one piece.
+	char *text;
+	int text_len, text_cap;
+	int text_gap, text_gap_len;
+	// Same for the tokens: tokens.len includes the token_gap_len unused ones at token_gap. Their starts are locations in
+	// the text buffer, not in the text.
+	TokenList tokens;
+	int token_gap, token_gap_len;
+	TokenList window; // Tokens of the last re-scanned window.
+	ExprList exprs;
+	IncrementalNode *nodes; // One per node of exprs.
+	int nodes_cap;
+	IncrementalShift shifts[INCREMENTAL_PARSER_MAX_SHIFTS];
+	int shifts_len;
+	IncrementalShift offsets[2 * INCREMENTAL_PARSER_MAX_SHIFTS + 2]; // Sorted, spans from at to the next at moved by delta.
+	int offsets_len;
+	FunctionTable *functions; // Can be NULL, in which case function calls are not allowed.
+	int root;
+	int live_len; // Approximate number of nodes reachable from the root.
+	bool is_valid; // Whether the current text parsed successfully.
+	// Statistics
+	int edit_count;
+	int full_parse_count;
+	int last_scanned_tokens; // Tokens scanned by the last edit.
+	int last_parsed_tokens; // Tokens parsed by the last edit.
+} IncrementalParser;
+
+// Forward declarations
+void IncrementalParser_Init(IncrementalParser*, FunctionTable*);
+void IncrementalParser_Free(IncrementalParser*);
+
+bool incremental_parser_set_text(IncrementalParser*, char const*, int);
+bool incremental_parser_edit(IncrementalParser*, int, int, char const*, int);
+bool incremental_parser_eval(IncrementalParser*, int*);
+char const *incremental_parser_text(IncrementalParser*);
+
+bool incremental_parser_parse_all(IncrementalParser*);
+bool incremental_parser_replace_text(IncrementalParser*, int, int, char const*, int);
+bool incremental_parser_reserve_text_gap(IncrementalParser*, int);
+void incremental_parser_move_text_gap(IncrementalParser*, int);
+char incremental_parser_char(IncrementalParser*, int);
+int incremental_parser_token_count(IncrementalParser*);
+Token *incremental_parser_token(IncrementalParser*, int);
+int incremental_parser_token_start(IncrementalParser*, int);
+void incremental_parser_clear_tokens(IncrementalParser*);
+bool incremental_parser_reserve_token_gap(IncrementalParser*, int);
+void incremental_parser_move_token_gap(IncrementalParser*, int);
+bool incremental_parser_insert_tokens(IncrementalParser*);
+bool incremental_parser_reserve_nodes(IncrementalParser*, int);
+void incremental_parser_index_nodes(IncrementalParser*, Parser*, int);
+bool incremental_parser_can_join(char, char);
+int incremental_parser_find_token(IncrementalParser*, int, bool);
+IncrementalNode *incremental_parser_node(IncrementalParser*, int);
+int incremental_parser_offset(IncrementalParser*, int);
+void incremental_parser_shift(IncrementalParser*, int, int);
+bool incremental_parser_contains(IncrementalParser*, int, int, int);
+int incremental_parser_find_node(IncrementalParser*, int, int);
+void incremental_parser_update_path(IncrementalParser*, Parser*, int, int);
+int incremental_parser_eval_node(IncrementalParser*, int, bool*);
+
+// Implementation
+
+void IncrementalParser_Init(IncrementalParser *self, FunctionTable *functions)
+{
+	self->text = NULL;
+	self->text_len = 0;
+	self->text_cap = 0;
+	self->text_gap = 0;
+	self->text_gap_len = 0;
+	TokenList_Init(&self->tokens);
+	self->token_gap = 0;
+	self->token_gap_len = 0;
+	TokenList_Init(&self->window);
+	ExprList_Init(&self->exprs);
+	self->nodes = NULL;
+	self->nodes_cap = 0;
+	self->shifts_len = 0;
+	self->offsets_len = 0;
+	self->functions = functions;
+	self->root = -1;
+	self->live_len = 0;
+	self->is_valid = false;
+	self->edit_count = 0;
+	self->full_parse_count = 0;
+	self->last_scanned_tokens = 0;
+	self->last_parsed_tokens = 0;
+}
+
+void IncrementalParser_Free(IncrementalParser *self)
+{
+	if(self->text) TOKEN_LIST_FREE(self->text);
+	self->text = NULL;
+	self->text_len = 0;
+	self->text_cap = 0;
+	self->text_gap = 0;
+	self->text_gap_len = 0;
+	TokenList_Free(&self->tokens);
+	self->token_gap = 0;
+	self->token_gap_len = 0;
+	TokenList_Free(&self->window);
+	ExprList_Free(&self->exprs);
+	if(self->nodes) EXPR_LIST_FREE(self->nodes);
+	self->nodes = NULL;
+	self->nodes_cap = 0;
+	self->shifts_len = 0;
+	self->offsets_len = 0;
+	self->functions = NULL;
+	self->root = -1;
+	self->live_len = 0;
+	self->is_valid = false;
+}
+
+// Replaces the whole text and parses it from scratch. Returns whether it parsed successfully.
+bool incremental_parser_set_text(IncrementalParser *self, char const *text, int len)
+{
+    incremental_parser_clear_tokens(self);
+    if(!incremental_parser_replace_text(self, 0, self->text_len, text, len)) return false;
+    return incremental_parser_parse_all(self);
+}
+
+// Returns the text, null terminated. The gap is moved to its end for this, which copies everything after the last edit.
+char const *incremental_parser_text(IncrementalParser *self)
+{
+    if(!self->text) return "";
+    incremental_parser_move_text_gap(self, self->text_len);
+    self->text[self->text_len] = '\0';
+    return self->text;
+}
+
+// Replaces the bytes in [begin, end) of the text with the len bytes of text, and leaves the gap right after them. The
+// starts of the tokens that were in [begin, end) are left pointing into the gap.
+bool incremental_parser_replace_text(IncrementalParser *self, int begin, int end, char const *text, int len)
+{
+    incremental_parser_move_text_gap(self, end);
+    if(!incremental_parser_reserve_text_gap(self, len - (end - begin))) return false;
+    self->text_gap_len += end - begin;
+    self->text_gap = begin;
+    memcpy(self->text + begin, text, len);
+    self->text_gap += len;
+    self->text_gap_len -= len;
+    self->text_len += len - (end - begin);
+    return true;
+}
+
+// Makes sure the text gap can take count more bytes. When it grows, the text after it moves to the end of the new
+// buffer, and so do the starts of its tokens.
+bool incremental_parser_reserve_text_gap(IncrementalParser *self, int count)
+{
+    if(self->text && count <= self->text_gap_len) return true;
+    int new_cap = self->text_cap ? self->text_cap : 64;
+    while(new_cap < self->text_len + count + 1) new_cap *= 2;
+    char *temp = (char*)TOKEN_LIST_REALLOC(self->text, new_cap);
+    if(!temp)
+    {
+        fprintf(stderr, "Out of memory while editing text\n");
+        return false;
+    }
+    int after = self->text_len - self->text_gap;
+    int from = self->text_gap + self->text_gap_len, to = new_cap - 1 - after;
+    memmove(temp + to, temp + from, after);
+    int token_count = incremental_parser_token_count(self);
+    for(int i = incremental_parser_find_token(self, self->text_gap - 1, true); i < token_count; ++i)
+    {
+        incremental_parser_token(self, i)->start += to - from;
+    }
+    self->text = temp;
+    self->text_cap = new_cap;
+    self->text_gap_len = to - self->text_gap;
+    return true;
+}
+
+// Moves the text gap to pos, along with the starts of the tokens whose chars move.
+void incremental_parser_move_text_gap(IncrementalParser *self, int pos)
+{
+    int gap = self->text_gap, gap_len = self->text_gap_len;
+    if(pos == gap) return;
+    int lo = pos < gap ? pos : gap, hi = pos < gap ? gap : pos;
+    int token_count = incremental_parser_token_count(self);
+    for(int i = incremental_parser_find_token(self, lo - 1, true); i < token_count && incremental_parser_token_start(self, i) < hi; ++i)
+    {
+        incremental_parser_token(self, i)->start += pos < gap ? gap_len : -gap_len;
+    }
+    if(pos < gap) memmove(self->text + pos + gap_len, self->text + pos, gap - pos);
+    else memmove(self->text + gap, self->text + gap + gap_len, pos - gap);
+    self->text_gap = pos;
+}
+
+char incremental_parser_char(IncrementalParser *self, int pos)
+{
+    return self->text[pos < self->text_gap ? pos : pos + self->text_gap_len];
+}
+
+int incremental_parser_token_count(IncrementalParser *self)
+{
+    return TokenList_Length(&self->tokens) - self->token_gap_len;
+}
+
+Token *incremental_parser_token(IncrementalParser *self, int idx)
+{
+    return &self->tokens.data[idx < self->token_gap ? idx : idx + self->token_gap_len];
+}
+
+// Returns the location of a token in the text.
+int incremental_parser_token_start(IncrementalParser *self, int idx)
+{
+    int start = incremental_parser_token(self, idx)->start;
+    return start < self->text_gap ? start : start - self->text_gap_len;
+}
+
+void incremental_parser_clear_tokens(IncrementalParser *self)
+{
+    TokenList_Clear(&self->tokens);
+    self->token_gap = 0;
+    self->token_gap_len = 0;
+}
+
+// Makes sure the token gap can take count more tokens. The tokens after it move to the end of the list, which is grown
+// first when it doesn't have the room.
+bool incremental_parser_reserve_token_gap(IncrementalParser *self, int count)
+{
+    TokenList *tokens = &self->tokens;
+    if(count <= self->token_gap_len) return true;
+    int needed = tokens->len - self->token_gap_len + count;
+    if(needed > tokens->cap)
+    {
+        int new_cap = tokens->cap ? tokens->cap : TOKEN_LIST_INITIAL_CAPACITY;
+        while(new_cap < needed) new_cap *= 2;
+        TokenList_Realloc(tokens, new_cap);
+        if(tokens->cap < needed)
+        {
+            fprintf(stderr, "Out of memory while editing tokens\n");
+            return false;
+        }
+    }
+    int after = tokens->len - self->token_gap - self->token_gap_len;
+    memmove(tokens->data + tokens->cap - after, tokens->data + self->token_gap + self->token_gap_len, after * sizeof(Token));
+    self->token_gap_len = tokens->cap - after - self->token_gap;
+    tokens->len = tokens->cap;
+    return true;
+}
+
+void incremental_parser_move_token_gap(IncrementalParser *self, int idx)
+{
+    Token *data = self->tokens.data;
+    int gap = self->token_gap, gap_len = self->token_gap_len;
+    if(idx < gap) memmove(data + idx + gap_len, data + idx, (gap - idx) * sizeof(Token));
+    else memmove(data + gap, data + gap + gap_len, (idx - gap) * sizeof(Token));
+    self->token_gap = idx;
+}
+
+// Inserts the tokens of the window at the token gap.
+bool incremental_parser_insert_tokens(IncrementalParser *self)
+{
+    int count = TokenList_Length(&self->window);
+    if(!incremental_parser_reserve_token_gap(self, count)) return false;
+    memcpy(self->tokens.data + self->token_gap, self->window.data, count * sizeof(Token));
+    self->token_gap += count;
+    self->token_gap_len -= count;
+    return true;
+}
+
+bool incremental_parser_reserve_nodes(IncrementalParser *self, int count)
+{
+    if(count <= self->nodes_cap) return true;
+    int new_cap = self->nodes_cap ? self->nodes_cap : 64;
+    while(new_cap < count) new_cap *= 2;
+    IncrementalNode *temp = (IncrementalNode*)EXPR_LIST_REALLOC(self->nodes, new_cap * sizeof(IncrementalNode));
+    if(!temp)
+    {
+        fprintf(stderr, "Out of memory while indexing nodes\n");
+        return false;
+    }
+    self->nodes = temp;
+    self->nodes_cap = new_cap;
+    return true;
+}
+
+bool incremental_parser_parse_all(IncrementalParser *self)
+{
+    self->is_valid = false;
+    self->root = -1;
+    self->live_len = 0;
+    self->full_parse_count += 1;
+    self->shifts_len = 0;
+    self->offsets_len = 0;
+    incremental_parser_clear_tokens(self);
+    ExprList_Clear(&self->exprs);
+
+    Scanner scanner;
+    Scanner_Init(&scanner, &self->tokens, incremental_parser_text(self));
+    scanner_scan(&scanner);
+    bool has_failed = scanner.has_failed;
+    Scanner_Free(&scanner);
+    self->last_scanned_tokens = TokenList_Length(&self->tokens);
+    self->last_parsed_tokens = TokenList_Length(&self->tokens);
+    if(has_failed || TokenList_Length(&self->tokens) == 0) return false;
+
+    Parser parser;
+    Parser_Init(&parser, &self->tokens, &self->exprs, self->functions, self->text);
+    if(parser_is_at_definition(&parser))
+    {
+        Parser_Free(&parser);
+        fprintf(stderr, "Function definitions can't be edited incrementally\n");
+        return false;
+    }
+    parser.is_recording_spans = true;
+    int root = parser_parse_expr(&parser);
+    if(!parser.has_failed) incremental_parser_index_nodes(self, &parser, 0);
+    has_failed = parser.has_failed;
+    Parser_Free(&parser);
+    if(has_failed) return false;
+
+    self->root = root;
+    self->nodes[root].parent = -1;
+    self->live_len = ExprList_Length(&self->exprs);
+    self->is_valid = true;
+    return true;
+}
+
+// Fills in the nodes added to the ExprList since mark, from the spans the parser recorded while adding them. Nodes
+// that were not returned by any parse function get the span of their children.
+void incremental_parser_index_nodes(IncrementalParser *self, Parser *parser, int mark)
+{
+    int len = ExprList_Length(&self->exprs);
+    if(!incremental_parser_reserve_nodes(self, len))
+    {
+        parser->has_failed = true;
+        return;
+    }
+    for(int i = mark; i < len; ++i)
+    {
+        IncrementalNode node = {-1, -1, PARSER_LEVEL_NONE, -1, 0, false, false, false, -1, self->shifts_len};
+        self->nodes[i] = node;
+    }
+    // Nodes returned by several levels are recorded once per level, from the tightest to the loosest. The loosest one
+    // is the level the enclosing production asked for, which is the one to re-parse the node at.
+    for(int i = 0; i < parser->spans_len; ++i)
+    {
+        ParserSpan span = parser->spans[i];
+        if(span.node < mark) continue;
+        IncrementalNode *node = &self->nodes[span.node];
+        node->level = span.level;
+        node->begin = span.begin;
+        node->end = span.end;
+        // A primary can also be parsed past the last token, as 0, like the rhs of "1 +".
+        if(span.level == PARSER_LEVEL_PRIMARY && span.begin < incremental_parser_token_count(self) && incremental_parser_token(self, span.begin)->type == TOKEN_IDENTIFIER)
+        {
+            node->is_opaque = true;
+        }
+    }
+    // Children are always added before their parents, so a single pass in order is enough.
+    for(int i = mark; i < len; ++i)
+    {
+        Expr *expr = ExprList_Get(&self->exprs, i);
+        int children[3] = {expr->lhs, -1, -1};
+        if(expr_is_chain(expr->type)) children[1] = expr->lhs + expr->value - 1;
+        else if(expr->type != EXPR_OPERAND && expr->type != EXPR_ARG)
+        {
+            children[1] = expr->rhs;
+            children[2] = expr->cond;
+        }
+        IncrementalNode *node = &self->nodes[i];
+        for(int j = 0; j < 3; ++j)
+        {
+            if(children[j] < 0) continue;
+            IncrementalNode *child = &self->nodes[children[j]];
+            child->parent = i;
+            if(node->level != PARSER_LEVEL_NONE || child->begin < 0) continue;
+            if(node->begin < 0 || child->begin < node->begin) node->begin = child->begin;
+            if(child->end > node->end) node->end = child->end;
+        }
+        if(expr_is_chain(expr->type))
+        {
+            for(int j = 1; j < expr->value - 1; ++j) self->nodes[expr->lhs + j].parent = i;
+        }
+    }
+}
+
+// Whether the chars a and b could belong to the same token, in which case the token boundary between them can move.
+bool incremental_parser_can_join(char a, char b)
+{
+    if(scanner_is_identifier(a) && scanner_is_identifier(b)) return true;
+    if(b == '=' && (a == '<' || a == '>' || a == '=' || a == '!')) return true;
+    return (a == '&' || a == '|') && a == b;
+}
+
+// Returns the first token that ends at or after pos, or (when is_after is set) the first one that starts after pos.
+int incremental_parser_find_token(IncrementalParser *self, int pos, bool is_after)
+{
+    int lo = 0, hi = incremental_parser_token_count(self);
+    while(lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        int start = incremental_parser_token_start(self, mid);
+        bool is_before = is_after ? start <= pos : start + incremental_parser_token(self, mid)->length < pos;
+        if(is_before) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Returns the node info with its span up to date.
+IncrementalNode *incremental_parser_node(IncrementalParser *self, int idx)
+{
+    IncrementalNode *node = &self->nodes[idx];
+    if(node->epoch == 0 && self->shifts_len > 0)
+    {
+        node->begin += incremental_parser_offset(self, node->begin);
+        node->end += incremental_parser_offset(self, node->end);
+        node->epoch = self->shifts_len;
+    }
+    for(; node->epoch < self->shifts_len; ++node->epoch)
+    {
+        IncrementalShift shift = self->shifts[node->epoch];
+        if(node->begin >= shift.at) node->begin += shift.delta;
+        if(node->end >= shift.at) node->end += shift.delta;
+    }
+    return node;
+}
+
+// Returns how far the logged shifts moved a location from before the log was started.
+int incremental_parser_offset(IncrementalParser *self, int at)
+{
+    int lo = 0, hi = self->offsets_len;
+    while(lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if(self->offsets[mid].at <= at) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo > 0 ? self->offsets[lo - 1].delta : 0;
+}
+
+// Logs that the tokens from at onwards moved by delta. Once the log is full, it's applied to every node and cleared.
+void incremental_parser_shift(IncrementalParser *self, int at, int delta)
+{
+    if(self->shifts_len == INCREMENTAL_PARSER_MAX_SHIFTS || self->offsets_len > 2 * INCREMENTAL_PARSER_MAX_SHIFTS - 2)
+    {
+        int node_count = ExprList_Length(&self->exprs);
+        for(int i = 0; i < node_count; ++i) incremental_parser_node(self, i)->epoch = 0;
+        self->shifts_len = 0;
+        self->offsets_len = 0;
+    }
+    IncrementalShift shift = {at, delta};
+    self->shifts[self->shifts_len++] = shift;
+
+    // Every range of old locations that has a single offset gets split where it reaches at after being moved. Ranges
+    // of removed tokens can overlap the ones after them once moved, so more than one of them can be split.
+    IncrementalShift offsets[2 * INCREMENTAL_PARSER_MAX_SHIFTS + 2];
+    int len = 0;
+    for(int i = -1; i < self->offsets_len; ++i)
+    {
+        int lo = i < 0 ? INT_MIN : self->offsets[i].at;
+        int hi = i + 1 < self->offsets_len ? self->offsets[i + 1].at : INT_MAX;
+        int offset = i < 0 ? 0 : self->offsets[i].delta;
+        int split = at - offset;
+        if(i >= 0) offsets[len++] = (IncrementalShift){lo, split <= lo ? offset + delta : offset};
+        if(split > lo && split < hi) offsets[len++] = (IncrementalShift){split, offset + delta};
+    }
+    memcpy(self->offsets, offsets, len * sizeof(IncrementalShift));
+    self->offsets_len = len;
+}
+
+bool incremental_parser_contains(IncrementalParser *self, int idx, int begin, int end)
+{
+    IncrementalNode *node = incremental_parser_node(self, idx);
+    return node->begin >= 0 && node->begin <= begin && end <= node->end;
+}
+
+// Returns the smallest node that can be re-parsed on its own and contains the tokens in [begin, end), or the root.
+int incremental_parser_find_node(IncrementalParser *self, int begin, int end)
+{
+    int idx = self->root;
+    if(!incremental_parser_contains(self, idx, begin, end)) return idx;
+    for(;;)
+    {
+        Expr *expr = ExprList_Get(&self->exprs, idx);
+        if(self->nodes[idx].is_opaque || expr->type == EXPR_CALL) break;
+        int next = -1;
+        if(expr_is_chain(expr->type))
+        {
+            // Operands are contiguous and in source order, so the one containing the tokens can be binary searched.
+            int lo = 0, hi = expr->value;
+            while(hi - lo > 1)
+            {
+                int mid = lo + (hi - lo) / 2;
+                if(incremental_parser_node(self, expr->lhs + mid)->begin <= begin) lo = mid;
+                else hi = mid;
+            }
+            if(incremental_parser_contains(self, expr->lhs + lo, begin, end)) next = expr->lhs + lo;
+        }
+        else
+        {
+            int children[3] = {expr->lhs, expr->type == EXPR_OPERAND ? -1 : expr->rhs, expr->cond};
+            for(int i = 0; i < 3 && next < 0; ++i)
+            {
+                if(children[i] >= 0 && incremental_parser_contains(self, children[i], begin, end)) next = children[i];
+            }
+        }
+        if(next < 0) break;
+        idx = next;
+    }
+    while(self->nodes[idx].level == PARSER_LEVEL_NONE) idx = self->nodes[idx].parent;
+    return idx;
+}
+
+// Updates the ancestors of a node that was just replaced: their cost and flags, the eager / short-circuit choices that
+// depend on them, and their cached values.
+void incremental_parser_update_path(IncrementalParser *self, Parser *parser, int idx, int old_node)
+{
+    Expr *old = ExprList_Get(&self->exprs, old_node);
+    int old_cost = old->cost, old_flags = old->flags;
+    IncrementalNode old_info = self->nodes[old_node]; // Value of the subtree the path goes through, before the edit.
+    int child = idx;
+    self->live_len += ExprList_Get(&self->exprs, idx)->cost - old_cost;
+    for(int parent = self->nodes[idx].parent; parent >= 0; child = parent, parent = self->nodes[parent].parent)
+    {
+        Expr *expr = ExprList_Get(&self->exprs, parent);
+        Expr *updated = ExprList_Get(&self->exprs, child);
+        IncrementalNode *info = &self->nodes[parent];
+        int cost = expr->cost, flags = expr->flags;
+        if(expr_is_chain(expr->type))
+        {
+            // Only the changed operand is looked at, unless it lost a flag that another operand may still have.
+            expr->cost += updated->cost - old_cost;
+            if(old_flags & ~updated->flags)
+            {
+                expr->flags = 0;
+                for(int i = 0; i < expr->value; ++i) expr->flags |= ExprList_Get(&self->exprs, expr->lhs + i)->flags;
+            }
+            else expr->flags |= updated->flags;
+            // Sums wrap around, so the old term can be taken out of the sum, and the new one added on the next evaluation
+            // without refolding the other operands. Products are always refolded.
+            if(expr->type == EXPR_SUM && info->is_valid && !info->has_failed && old_info.is_valid && !old_info.has_failed)
+            {
+                int term = updated->value == EXPR_SUB ? old_info.value : evaluator_wrap_sub(0, old_info.value);
+                info->value = evaluator_wrap_add(info->value, term);
+                info->pending = child;
+            }
+            else if(info->pending != child) info->pending = -1;
+        }
+        else
+        {
+            int children[3] = {expr->lhs, expr->type == EXPR_OPERAND ? -1 : expr->rhs, expr->cond};
+            expr->cost = 1;
+            expr->flags = 0;
+            for(int i = 0; i < 3; ++i)
+            {
+                if(children[i] < 0) continue;
+                expr->cost += ExprList_Get(&self->exprs, children[i])->cost;
+                expr->flags |= ExprList_Get(&self->exprs, children[i])->flags;
+            }
+            if(expr->type == EXPR_DIV || (expr->type == EXPR_OPERAND && expr->value == EXPR_DIV)) expr->flags |= EXPR_FLAG_MAY_TRAP;
+            // Same choices as parser_add_logical() and parser_add_ternary().
+            switch(expr->type)
+            {
+                case EXPR_AND: case EXPR_AND_EAGER: expr->type = parser_can_eval_eagerly(parser, expr->rhs) ? EXPR_AND_EAGER : EXPR_AND; break;
+                case EXPR_OR: case EXPR_OR_EAGER: expr->type = parser_can_eval_eagerly(parser, expr->rhs) ? EXPR_OR_EAGER : EXPR_OR; break;
+                case EXPR_TERNARY: case EXPR_SELECT:
+                    expr->type = parser_can_eval_eagerly(parser, expr->lhs) && parser_can_eval_eagerly(parser, expr->rhs) ? EXPR_SELECT : EXPR_TERNARY;
+                    break;
+                default: break;
+            }
+        }
+        // Operands are never evaluated on their own, the value that matters to the chain is the one of their expression.
+        if(expr->type != EXPR_OPERAND) old_info = *info;
+        info->is_valid = false;
+        old_cost = cost;
+        old_flags = flags;
+    }
+}
+
+// Replaces the bytes in [begin, end) of the text with the len bytes of text, and updates the tree. Returns whether the
+// new text parsed successfully.
+bool incremental_parser_edit(IncrementalParser *self, int begin, int end, char const *text, int len)
+{
+    if(begin < 0 || end < begin || end > self->text_len)
+    {
+        fprintf(stderr, "Invalid edit range [%d, %d)\n", begin, end);
+        return false;
+    }
+    int delta = len - (end - begin);
+    int token_count = incremental_parser_token_count(self);
+    if(!self->is_valid || token_count == 0)
+    {
+        incremental_parser_clear_tokens(self); // They may not match the text, and are scanned again anyway.
+        if(!incremental_parser_replace_text(self, begin, end, text, len)) return false;
+        self->edit_count += 1;
+        return incremental_parser_parse_all(self);
+    }
+
+    // Window of old tokens touched by the edit. Tokens right next to it are included too, since "12" followed by an
+    // inserted "3" is a single token.
+    int first = incremental_parser_find_token(self, begin, false);
+    int last = incremental_parser_find_token(self, end, true);
+    if(first == last)
+    {
+        // Only whitespace was touched. Re-scan a neighbour anyway, so that there's always a token to re-parse from.
+        if(first > 0) first -= 1;
+        else last += 1;
+    }
+    int scan_begin = incremental_parser_token_start(self, first) < begin ? incremental_parser_token_start(self, first) : begin; // In both the old and the new text.
+    int scan_end = incremental_parser_token_start(self, last - 1) + incremental_parser_token(self, last - 1)->length; // In the old text.
+    if(scan_end < end) scan_end = end;
+    // Tokens that overlap the edit. The old chars of identifiers among them are gone, so those always count as changed.
+    int changed_first = incremental_parser_find_token(self, begin + 1, false);
+    int changed_last = incremental_parser_find_token(self, end - 1, true);
+
+    if(!incremental_parser_replace_text(self, begin, end, text, len)) return false;
+    self->edit_count += 1;
+    scan_end += delta;
+    for(bool has_grown = true; has_grown; )
+    {
+        has_grown = false;
+        if(first > 0 && incremental_parser_token_start(self, first - 1) + incremental_parser_token(self, first - 1)->length == scan_begin
+            && scan_begin < self->text_len && incremental_parser_can_join(incremental_parser_char(self, scan_begin - 1), incremental_parser_char(self, scan_begin)))
+        {
+            first -= 1;
+            scan_begin = incremental_parser_token_start(self, first);
+            has_grown = true;
+        }
+        if(last < token_count && incremental_parser_token_start(self, last) == scan_end && scan_end > 0
+            && incremental_parser_can_join(incremental_parser_char(self, scan_end - 1), incremental_parser_char(self, scan_end)))
+        {
+            last += 1;
+            scan_end = incremental_parser_token_start(self, last - 1) + incremental_parser_token(self, last - 1)->length;
+            has_grown = true;
+        }
+    }
+
+    // The old tokens of the window are taken out before the text gap moves over their chars, which they may not point to
+    // anymore. They're still where they were, at the start of the token gap, for the comparison with the new ones.
+    incremental_parser_move_token_gap(self, last);
+    self->token_gap = first;
+    self->token_gap_len += last - first;
+    incremental_parser_move_text_gap(self, scan_end); // The window is then in one piece, in front of the gap.
+
+    TokenList_Clear(&self->window);
+    Scanner scanner;
+    Scanner_InitRange(&scanner, &self->window, self->text, scan_begin, scan_end);
+    scanner_scan(&scanner);
+    bool has_failed = scanner.has_failed;
+    Scanner_Free(&scanner);
+    self->last_scanned_tokens = TokenList_Length(&self->window);
+    self->last_parsed_tokens = 0;
+    if(has_failed)
+    {
+        self->is_valid = false;
+        return false;
+    }
+
+    // Formatting only edits don't change any token, so the tree is still the same.
+    int count = TokenList_Length(&self->window);
+    bool is_same = count == last - first;
+    for(int i = 0; is_same && i < count; ++i)
+    {
+        Token a = self->tokens.data[first + i], b = TokenList_Get(&self->window, i);
+        is_same = a.type == b.type && a.value == b.value && a.length == b.length
+            && (a.type != TOKEN_IDENTIFIER || first + i < changed_first || first + i >= changed_last);
+    }
+
+    int node = is_same ? -1 : incremental_parser_find_node(self, first, last);
+    if(node == self->root) return incremental_parser_parse_all(self);
+    int token_delta = count - (last - first);
+    if(!incremental_parser_insert_tokens(self))
+    {
+        self->is_valid = false;
+        return false;
+    }
+    if(token_delta != 0) incremental_parser_shift(self, last, token_delta);
+    if(is_same) return true;
+
+    Parser parser;
+    Parser_Init(&parser, &self->tokens, &self->exprs, self->functions, self->text);
+    parser.token_gap = self->token_gap;
+    parser.token_gap_len = self->token_gap_len;
+    parser.is_recording_spans = true;
+    for(; node != self->root; node = self->nodes[node].parent)
+    {
+        IncrementalNode *info = incremental_parser_node(self, node);
+        if(info->level == PARSER_LEVEL_NONE) continue;
+        int mark = ExprList_Length(&self->exprs);
+        parser.current = info->begin;
+        parser.spans_len = 0;
+        int idx = parser_parse_level(&parser, info->level);
+        if(parser.has_failed) break; // The full parse would fail at the same place.
+        if(parser.current != info->end)
+        {
+            self->exprs.len = mark;
+            continue;
+        }
+
+        self->last_parsed_tokens = info->end - info->begin;
+        int parent = info->parent;
+        incremental_parser_index_nodes(self, &parser, mark);
+        if(parser.has_failed) break;
+        self->nodes[idx].parent = parent;
+        Expr *expr = ExprList_Get(&self->exprs, parent);
+        if(expr->lhs == node) expr->lhs = idx;
+        else if(expr->rhs == node) expr->rhs = idx;
+        else expr->cond = idx;
+        incremental_parser_update_path(self, &parser, idx, node);
+        Parser_Free(&parser);
+        // Replaced subtrees are left behind in the ExprList, start over once they take more room than the tree.
+        if(ExprList_Length(&self->exprs) > 2 * self->live_len + INCREMENTAL_PARSER_MIN_GARBAGE) return incremental_parser_parse_all(self);
+        return true;
+    }
+    has_failed = parser.has_failed;
+    Parser_Free(&parser);
+    if(has_failed)
+    {
+        self->is_valid = false;
+        self->root = -1;
+        return false;
+    }
+    return incremental_parser_parse_all(self);
+}
+
+int incremental_parser_eval_node(IncrementalParser *self, int idx, bool *has_failed)
+{
+    IncrementalNode *node = &self->nodes[idx];
+    if(node->is_valid)
+    {
+        *has_failed |= node->has_failed;
+        return node->value;
+    }
+    Expr *expr = ExprList_Get(&self->exprs, idx);
+    bool failed = false;
+    int ans = 0;
+    switch(expr->type)
+    {
+        case EXPR_LITERAL: ans = expr->value; break;
+        case EXPR_NEG: ans = evaluator_wrap_sub(0, incremental_parser_eval_node(self, expr->lhs, &failed)); break;
+
+        case EXPR_ADD: ans = evaluator_wrap_add(incremental_parser_eval_node(self, expr->lhs, &failed), incremental_parser_eval_node(self, expr->rhs, &failed)); break;
+        case EXPR_SUB: ans = evaluator_wrap_sub(incremental_parser_eval_node(self, expr->lhs, &failed), incremental_parser_eval_node(self, expr->rhs, &failed)); break;
+        case EXPR_MUL: ans = evaluator_wrap_mul(incremental_parser_eval_node(self, expr->lhs, &failed), incremental_parser_eval_node(self, expr->rhs, &failed)); break;
+        case EXPR_DIV: {
+            int l = incremental_parser_eval_node(self, expr->lhs, &failed);
+            int r = incremental_parser_eval_node(self, expr->rhs, &failed);
+            if(r == 0 || (l == INT_MIN && r == -1)) failed = true;
+            else ans = l / r;
+        } break;
+
+        case EXPR_LT: ans = incremental_parser_eval_node(self, expr->lhs, &failed) < incremental_parser_eval_node(self, expr->rhs, &failed); break;
+        case EXPR_LE: ans = incremental_parser_eval_node(self, expr->lhs, &failed) <= incremental_parser_eval_node(self, expr->rhs, &failed); break;
+        case EXPR_GT: ans = incremental_parser_eval_node(self, expr->lhs, &failed) > incremental_parser_eval_node(self, expr->rhs, &failed); break;
+        case EXPR_GE: ans = incremental_parser_eval_node(self, expr->lhs, &failed) >= incremental_parser_eval_node(self, expr->rhs, &failed); break;
+        case EXPR_EQ: ans = incremental_parser_eval_node(self, expr->lhs, &failed) == incremental_parser_eval_node(self, expr->rhs, &failed); break;
+        case EXPR_NE: ans = incremental_parser_eval_node(self, expr->lhs, &failed) != incremental_parser_eval_node(self, expr->rhs, &failed); break;
+
+        case EXPR_AND: ans = incremental_parser_eval_node(self, expr->lhs, &failed) && incremental_parser_eval_node(self, expr->rhs, &failed); break;
+        case EXPR_OR: ans = incremental_parser_eval_node(self, expr->lhs, &failed) || incremental_parser_eval_node(self, expr->rhs, &failed); break;
+        case EXPR_TERNARY:
+            ans = incremental_parser_eval_node(self, expr->cond, &failed) ? incremental_parser_eval_node(self, expr->lhs, &failed) : incremental_parser_eval_node(self, expr->rhs, &failed);
+            break;
+        case EXPR_AND_EAGER: {
+            int l = incremental_parser_eval_node(self, expr->lhs, &failed) != 0;
+            ans = l & (incremental_parser_eval_node(self, expr->rhs, &failed) != 0);
+        } break;
+        case EXPR_OR_EAGER: {
+            int l = incremental_parser_eval_node(self, expr->lhs, &failed) != 0;
+            ans = l | (incremental_parser_eval_node(self, expr->rhs, &failed) != 0);
+        } break;
+        case EXPR_SELECT: {
+            int mask = -(incremental_parser_eval_node(self, expr->cond, &failed) != 0);
+            int l = incremental_parser_eval_node(self, expr->lhs, &failed);
+            ans = (l & mask) | (incremental_parser_eval_node(self, expr->rhs, &failed) & ~mask);
+        } break;
+
+        // Operand values are cached, so refolding a chain after one of its operands changed doesn't evaluate the others.
+        case EXPR_SUM: case EXPR_PRODUCT: {
+            if(node->pending >= 0)
+            {
+                Expr *operand = ExprList_Get(&self->exprs, node->pending);
+                int v = incremental_parser_eval_node(self, operand->lhs, &failed);
+                ans = operand->value == EXPR_SUB ? evaluator_wrap_sub(node->value, v) : evaluator_wrap_add(node->value, v);
+                break;
+            }
+            bool is_product = expr->type == EXPR_PRODUCT;
+            int operands = expr->lhs, count = expr->value;
+            ans = is_product ? 1 : 0;
+            for(int i = 0; i < count; ++i)
+            {
+                Expr *operand = ExprList_Get(&self->exprs, operands + i);
+                int v = incremental_parser_eval_node(self, operand->lhs, &failed);
+                switch(operand->value)
+                {
+                    case EXPR_SUB: ans = evaluator_wrap_sub(ans, v); break;
+                    case EXPR_MUL: ans = evaluator_wrap_mul(ans, v); break;
+                    case EXPR_DIV: {
+                        if(v == 0 || (ans == INT_MIN && v == -1)) failed = true;
+                        else ans /= v;
+                    } break;
+                    default: ans = evaluator_wrap_add(ans, v); break;
+                }
+            }
+        } break;
+        case EXPR_CHAIN: {
+            int operands = expr->lhs, count = expr->value;
+            ans = incremental_parser_eval_node(self, ExprList_Get(&self->exprs, operands)->lhs, &failed);
+            for(int i = 1; i < count; ++i)
+            {
+                Expr *operand = ExprList_Get(&self->exprs, operands + i);
+                switch(operand->value)
+                {
+                    case EXPR_AND: ans = ans && incremental_parser_eval_node(self, operand->lhs, &failed); break;
+                    case EXPR_OR: ans = ans || incremental_parser_eval_node(self, operand->lhs, &failed); break;
+                    default: ans = evaluator_compare(operand->value, ans, incremental_parser_eval_node(self, operand->lhs, &failed)); break;
+                }
+            }
+        } break;
+
+        default: {
+            // Calls that were not inlined, their arguments are evaluated on every call just like the function body.
+            Evaluator evaluator;
+            Evaluator_Init(&evaluator, &self->exprs, self->functions, NULL);
+            evaluator.is_checked = true;
+            ans = evaluator_eval(&evaluator, idx);
+            failed = evaluator.has_failed;
+            Evaluator_Free(&evaluator);
+        } break;
+    }
+    node = &self->nodes[idx];
+    node->pending = -1;
+    node->value = ans;
+    node->has_failed = failed;
+    node->is_valid = true;
+    *has_failed |= failed;
+    return ans;
+}
+
+// Evaluates the current text with checked arithmetic, reusing the values of the subtrees that didn't change. Returns
+// false if the text didn't parse or its evaluation failed.
+bool incremental_parser_eval(IncrementalParser *self, int *value)
+{
+    if(!self->is_valid) return false;
+    bool has_failed = false;
+    *value = incremental_parser_eval_node(self, self->root, &has_failed);
+    return !has_failed;
+}
+
+#endif
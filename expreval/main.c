@@ -1,8 +1,64 @@
+#include "platform.h"
+
+#include <string.h>
+
 #include "eval.h"
+#include "aot.h"
 
-// Simple usage showcase.
-int main()
+// Simple usage showcase. With "--batch", evaluates stdin line by line and prints the memo statistics at the end. With
+// "--batch-limited", every line is also held to the default governor limits. With "--batch-checked", overflows and
+// divisions by zero fail, and the number of checks the range analysis removed is printed for every line. With
+// "--batch-double", lines are evaluated in double mode. "--compile" reads a formula file from stdin and writes its C
+// source to stdout, and "--batch-native formulas.so" runs a batch with the formulas of the compiled library. With
+// "--batch-uring", stdin is streamed through an io_uring, with reads and writes overlapping the evaluation, and
+// "--batch-uring-limited" does the same with the default governor limits.
+int main(int argc, char **argv)
 {
+	if(argc > 1 && (strcmp(argv[1], "--batch-uring") == 0 || strcmp(argv[1], "--batch-uring-limited") == 0))
+	{
+		Governor governor;
+		Governor_Init(&governor, governor_default_limits());
+		eval_uring_loop(STDIN_FILENO, STDOUT_FILENO, strcmp(argv[1], "--batch-uring-limited") == 0 ? &governor : NULL);
+		Governor_Free(&governor);
+		return 0;
+	}
+	if(argc > 1 && strcmp(argv[1], "--compile") == 0)
+	{
+		return aot_generate(stdin, stdout) ? 0 : 1;
+	}
+	if(argc > 1 && strcmp(argv[1], "--batch-double") == 0)
+	{
+		eval_batch_double(stdin);
+		return 0;
+	}
+	if(argc > 2 && strcmp(argv[1], "--batch-native") == 0)
+	{
+		FunctionTable functions;
+		FunctionTable_Init(&functions);
+		AotLibrary library;
+		AotLibrary_Init(&library);
+		// Without the library every formula would be unknown, unless the input defines it, so keep going anyway.
+		if(aot_library_load(&library, argv[2], &functions)) fprintf(stderr, "%d formulas loaded\n", library.formula_count);
+		eval_batch(stdin, &functions, NULL, NULL, false);
+		FunctionTable_Free(&functions);
+		AotLibrary_Free(&library);
+		return 0;
+	}
+	if(argc > 1 && (strcmp(argv[1], "--batch") == 0 || strcmp(argv[1], "--batch-limited") == 0 || strcmp(argv[1], "--batch-checked") == 0))
+	{
+		FunctionTable functions;
+		FunctionTable_Init(&functions);
+		Governor governor;
+		Governor_Init(&governor, governor_default_limits());
+		SubexprMemo memo;
+		SubexprMemo_Init(&memo, EVAL_BATCH_MEMO_CAPACITY);
+		eval_batch(stdin, &functions, &memo, strcmp(argv[1], "--batch-limited") == 0 ? &governor : NULL, strcmp(argv[1], "--batch-checked") == 0);
+		subexpr_memo_print_stats(&memo, stderr);
+		SubexprMemo_Free(&memo);
+		Governor_Free(&governor);
+		FunctionTable_Free(&functions);
+		return 0;
+	}
 	eval_loop();
 	return 0;
 }
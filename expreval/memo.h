@@ -0,0 +1,193 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+// Includes from std
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Includes from project
+#include "token.h"
+#include "tokenlist.h"
+
+// Cache of the values of parenthesized subexpressions, meant to live for a whole batch run so that groups that show
+// up in many lines (constants, scaling factors, offsets...) are only evaluated once. Only groups without identifiers
+// are cached, since those are the only ones whose value can't change from one line to the next.
+//
+// Groups are keyed by their canonical form, which is the sequence of token types and literal values, so formatting
+// doesn't matter: "( 60*60 )" and "(60 * 60)" share an entry. Keys are two independent 64 bit hashes of that sequence
+// plus its length, which makes false hits practically impossible without having to store the tokens themselves.
+//
+// The table has a fixed number of slots. Each key can only live in one of SUBEXPR_MEMO_PROBES consecutive slots, and
+// when all of them are taken one is overwritten, so the memory used never grows.
+
+// Defines
+#ifndef SUBEXPR_MEMO_PROBES
+#define SUBEXPR_MEMO_PROBES 4
+#endif
+
+#ifndef SUBEXPR_MEMO_MAX_TOKENS
+#define SUBEXPR_MEMO_MAX_TOKENS 256 // Longer groups are not cached. They rarely repeat, and this bounds the hashing work.
+#endif
+
+#ifndef SUBEXPR_MEMO_MALLOC
+#define SUBEXPR_MEMO_MALLOC malloc
+#define SUBEXPR_MEMO_FREE free
+#include <stdlib.h>
+#endif
+
+typedef struct {
+    uint64_t h1, h2;
+    int length;
+} SubexprKey;
+
+typedef struct {
+    SubexprKey key;
+    int value;
+    bool is_used;
+} SubexprMemoEntry;
+
+typedef struct {
+    SubexprMemoEntry *entries;
+    int capacity; // Always a power of 2.
+    int len;
+    // Statistics
+    long long lookups;
+    long long hits;
+    long long inserts;
+    long long evictions;
+} SubexprMemo;
+
+// Forward declarations
+bool SubexprMemo_Init(SubexprMemo*, int);
+void SubexprMemo_Free(SubexprMemo*);
+
+SubexprKey subexpr_memo_key(TokenList*, int, int);
+bool subexpr_memo_is_cacheable(TokenList*, int, int);
+bool subexpr_memo_lookup(SubexprMemo*, SubexprKey, int*);
+void subexpr_memo_insert(SubexprMemo*, SubexprKey, int);
+double subexpr_memo_hit_rate(SubexprMemo*);
+void subexpr_memo_print_stats(SubexprMemo*, FILE*);
+
+// Implementation
+
+// The capacity is rounded up to a power of 2.
+bool SubexprMemo_Init(SubexprMemo *self, int capacity)
+{
+	int cap = SUBEXPR_MEMO_PROBES;
+	while(cap < capacity) cap *= 2;
+	self->entries = (SubexprMemoEntry*)SUBEXPR_MEMO_MALLOC(cap * sizeof(SubexprMemoEntry));
+	self->capacity = self->entries ? cap : 0;
+	self->len = 0;
+	self->lookups = 0;
+	self->hits = 0;
+	self->inserts = 0;
+	self->evictions = 0;
+	for(int i = 0; i < self->capacity; ++i) self->entries[i].is_used = false;
+	return self->entries != NULL;
+}
+
+void SubexprMemo_Free(SubexprMemo *self)
+{
+	if(self->entries) SUBEXPR_MEMO_FREE(self->entries);
+	self->entries = NULL;
+	self->capacity = 0;
+	self->len = 0;
+}
+
+static inline uint64_t subexpr_memo_mix(uint64_t h, uint64_t x)
+{
+    // splitmix64 finalizer over the running hash, which spreads every input bit over the whole result.
+    h ^= x + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+    h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27; h *= 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h;
+}
+
+// Key of the tokens in [begin, end).
+SubexprKey subexpr_memo_key(TokenList *tokens, int begin, int end)
+{
+    SubexprKey key = {0x243f6a8885a308d3ull, 0x13198a2e03707344ull, end - begin};
+    for(int i = begin; i < end; ++i)
+    {
+        Token token = TokenList_Get(tokens, i);
+        uint64_t x = ((uint64_t)(unsigned int)token.type << 32) | (unsigned int)(token.type == TOKEN_LITERAL_NUMBER ? token.value : 0);
+        key.h1 = subexpr_memo_mix(key.h1, x);
+        key.h2 = subexpr_memo_mix(key.h2 ^ 0xa4093822299f31d0ull, x);
+    }
+    return key;
+}
+
+// Only small groups without identifiers are cached, identifiers are either parameters or calls to user functions that
+// can be redefined.
+bool subexpr_memo_is_cacheable(TokenList *tokens, int begin, int end)
+{
+    if(end - begin > SUBEXPR_MEMO_MAX_TOKENS) return false;
+    for(int i = begin; i < end; ++i)
+    {
+        if(TokenList_Get(tokens, i).type == TOKEN_IDENTIFIER) return false;
+    }
+    return true;
+}
+
+static inline bool subexpr_memo_keys_equal(SubexprKey a, SubexprKey b)
+{
+    return a.h1 == b.h1 && a.h2 == b.h2 && a.length == b.length;
+}
+
+bool subexpr_memo_lookup(SubexprMemo *self, SubexprKey key, int *value)
+{
+    self->lookups += 1;
+    if(self->capacity == 0) return false;
+    int base = (int)(key.h1 & (uint64_t)(self->capacity - 1)) & ~(SUBEXPR_MEMO_PROBES - 1);
+    for(int i = 0; i < SUBEXPR_MEMO_PROBES; ++i)
+    {
+        SubexprMemoEntry *entry = &self->entries[base + i];
+        if(entry->is_used && subexpr_memo_keys_equal(entry->key, key))
+        {
+            self->hits += 1;
+            *value = entry->value;
+            return true;
+        }
+    }
+    return false;
+}
+
+void subexpr_memo_insert(SubexprMemo *self, SubexprKey key, int value)
+{
+    if(self->capacity == 0) return;
+    int base = (int)(key.h1 & (uint64_t)(self->capacity - 1)) & ~(SUBEXPR_MEMO_PROBES - 1);
+    SubexprMemoEntry *slot = NULL;
+    for(int i = 0; i < SUBEXPR_MEMO_PROBES && !slot; ++i)
+    {
+        if(!self->entries[base + i].is_used) slot = &self->entries[base + i];
+    }
+    if(!slot)
+    {
+        // Every slot of the bucket is taken, overwrite one picked by bits of the key the bucket index doesn't use.
+        slot = &self->entries[base + (int)((key.h2 >> 32) & (SUBEXPR_MEMO_PROBES - 1))];
+        self->evictions += 1;
+    }
+    else
+    {
+        self->len += 1;
+    }
+    slot->key = key;
+    slot->value = value;
+    slot->is_used = true;
+    self->inserts += 1;
+}
+
+double subexpr_memo_hit_rate(SubexprMemo *self)
+{
+    return self->lookups ? (double)self->hits / (double)self->lookups : 0.0;
+}
+
+void subexpr_memo_print_stats(SubexprMemo *self, FILE *out)
+{
+    fprintf(out, "memo: %lld lookups, %lld hits (%.1f%%), %lld inserts, %lld evictions, %d/%d entries\n",
+        self->lookups, self->hits, 100.0 * subexpr_memo_hit_rate(self), self->inserts, self->evictions, self->len, self->capacity);
+}
+
+#endif
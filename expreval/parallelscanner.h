@@ -0,0 +1,305 @@
+#ifndef PARALLEL_SCANNER_H
+#define PARALLEL_SCANNER_H
+
+// Feature test macros, for the clock_gettime() of governor.h
+#include "platform.h"
+
+// Includes from std
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+// Includes from project
+#include "token.h"
+#include "tokenlist.h"
+#include "scanner.h"
+#include "threadpool.h"
+
+// Scans huge inputs on a thread pool. The source is cut into chunks that are scanned on their own, and the per chunk
+// token lists are then concatenated into the output TokenList, which ends up identical to what the serial Scanner
+// produces. In the same pass every parenthesis is matched with its partner: each chunk matches its own parens with a
+// stack, and the ones it leaves open are then paired across the cuts in chunk order, so the end of any group is known
+// without scanning it again.
+//
+// Chunk boundaries are fixed up so that no token can straddle two chunks: every cut is moved forward until it lands
+// right after a char that always makes up a whole token on its own (whitespace, parenthesis, "+ - * /", "? : ,").
+// That way a multi digit literal, an identifier or a two char operator like "<=" is always scanned by a single chunk.
+
+// Defines
+#ifndef PARALLEL_SCANNER_MIN_CHUNK
+#define PARALLEL_SCANNER_MIN_CHUNK 65536 // Inputs are never cut into chunks smaller than this.
+#endif
+
+#ifndef PARALLEL_SCANNER_BYTES_PER_TOKEN
+#define PARALLEL_SCANNER_BYTES_PER_TOKEN 4 // Rough guess used to size the token list of each chunk up front.
+#endif
+
+#ifndef PARALLEL_SCANNER_CHUNKS_PER_THREAD
+#define PARALLEL_SCANNER_CHUNKS_PER_THREAD 4
+#endif
+
+typedef struct {
+	int begin, end; // Range of the source scanned by this chunk, after fixing up the cuts.
+	TokenList tokens;
+	int *matches; // Index within the chunk of the partner of every paren, -1 for other tokens and unmatched parens.
+	int *pending; // Parens left unmatched by the chunk, first the pending_close ")" and then the pending_open "(".
+	int pending_close, pending_open;
+	int offset; // Index of the first token of the chunk in the output TokenList.
+	bool has_failed;
+} ParallelScannerChunk;
+
+typedef struct {
+	char const *source;
+	int source_length;
+	TokenList *tokens;
+	ThreadPool *pool;
+	int *matches; // Index of the partner of every paren token, -1 for other tokens and parens that are never matched.
+	int matches_cap;
+	ParallelScannerChunk *chunks;
+	int chunk_count;
+	bool has_failed;
+} ParallelScanner;
+
+// Forward declarations
+void ParallelScanner_Init(ParallelScanner*, TokenList*, char const*, int, ThreadPool*);
+void ParallelScanner_Free(ParallelScanner*);
+
+void parallel_scanner_scan(ParallelScanner*);
+void parallel_scanner_scan_serial(ParallelScanner*);
+bool parallel_scanner_is_cut_char(char);
+int parallel_scanner_fix_cut(ParallelScanner*, int);
+void parallel_scanner_scan_chunk_task(void*, int);
+void parallel_scanner_copy_chunk_task(void*, int);
+bool parallel_scanner_reserve_matches(ParallelScanner*, int);
+void parallel_scanner_match_parens(Token const*, int, int*, int*, int*, int*);
+bool parallel_scanner_match_cuts(ParallelScanner*);
+int parallel_scanner_find_group_end(ParallelScanner*, int);
+
+// Implementation
+
+void ParallelScanner_Init(ParallelScanner *self, TokenList *token_list, char const *src, int src_length, ThreadPool *pool)
+{
+	self->source = src;
+	self->source_length = src_length;
+	self->tokens = token_list;
+	self->pool = pool;
+	self->matches = NULL;
+	self->matches_cap = 0;
+	self->chunks = NULL;
+	self->chunk_count = 0;
+	self->has_failed = false;
+}
+
+void ParallelScanner_Free(ParallelScanner *self)
+{
+	if(self->matches) TOKEN_LIST_FREE(self->matches);
+	self->source = NULL;
+	self->source_length = 0;
+	self->tokens = NULL;
+	self->pool = NULL;
+	self->matches = NULL;
+	self->matches_cap = 0;
+	self->has_failed = false;
+}
+
+bool parallel_scanner_reserve_matches(ParallelScanner *self, int count)
+{
+    if(count <= self->matches_cap) return true;
+    int *temp = (int*)TOKEN_LIST_REALLOC(self->matches, count * sizeof(int));
+    if(!temp) return false;
+    self->matches = temp;
+    self->matches_cap = count;
+    return true;
+}
+
+// Matches the parens of tokens[0, count) with each other, with indices relative to tokens. The ones left without a
+// partner are listed in pending, first the ")" and then the "(", both in order. A ")" is only left unmatched when no "("
+// is open, so the "(" still open always sit right after the ")" and both lists share the array.
+void parallel_scanner_match_parens(Token const *tokens, int count, int *matches, int *pending, int *pending_close, int *pending_open)
+{
+    int closes = 0, opens = 0;
+    for(int i = 0; i < count; ++i)
+    {
+        matches[i] = -1;
+        if(tokens[i].type == TOKEN_PAREN_L) pending[closes + opens++] = i;
+        else if(tokens[i].type == TOKEN_PAREN_R)
+        {
+            if(opens == 0)
+            {
+                pending[closes++] = i;
+                continue;
+            }
+            int open = pending[closes + --opens];
+            matches[open] = i;
+            matches[i] = open;
+        }
+    }
+    *pending_close = closes;
+    *pending_open = opens;
+}
+
+// Pairs the parens the chunks left unmatched. Every ")" a chunk couldn't match closes the last "(" still open in the
+// chunks before it, so a single pass in chunk order with a stack of those is enough.
+bool parallel_scanner_match_cuts(ParallelScanner *self)
+{
+    int open_count = 0;
+    for(int i = 0; i < self->chunk_count; ++i) open_count += self->chunks[i].pending_open;
+    int *stack = (int*)TOKEN_LIST_MALLOC((open_count + 1) * sizeof(int));
+    if(!stack) return false;
+    int len = 0;
+    for(int i = 0; i < self->chunk_count; ++i)
+    {
+        ParallelScannerChunk *chunk = &self->chunks[i];
+        for(int j = 0; j < chunk->pending_close && len > 0; ++j)
+        {
+            int open = stack[--len];
+            int close = chunk->offset + chunk->pending[j];
+            self->matches[open] = close;
+            self->matches[close] = open;
+        }
+        for(int j = 0; j < chunk->pending_open; ++j) stack[len++] = chunk->offset + chunk->pending[chunk->pending_close + j];
+    }
+    TOKEN_LIST_FREE(stack);
+    return true;
+}
+
+bool parallel_scanner_is_cut_char(char c)
+{
+    switch(c)
+    {
+        case '(': case ')': case '+': case '-': case '*': case '/': case '?': case ':': case ',':
+            return true;
+        default:
+            return scanner_is_whitespace(c);
+    }
+}
+
+// Moves a cut forward until the char before it always ends a token, which means the cut is at the start of a token.
+int parallel_scanner_fix_cut(ParallelScanner *self, int cut)
+{
+    if(cut <= 0) return 0;
+    while(cut < self->source_length && !parallel_scanner_is_cut_char(self->source[cut - 1])) ++cut;
+    return cut;
+}
+
+void parallel_scanner_scan_chunk_task(void *ctx, int task)
+{
+    ParallelScanner *self = (ParallelScanner*)ctx;
+    ParallelScannerChunk *chunk = &self->chunks[task];
+    // Both cuts are fixed up by the chunks on each side of them, which always agree, so no other synchronization is needed.
+    chunk->begin = parallel_scanner_fix_cut(self, (int)((long long)self->source_length * task / self->chunk_count));
+    chunk->end = parallel_scanner_fix_cut(self, (int)((long long)self->source_length * (task + 1) / self->chunk_count));
+
+    TokenList_Init(&chunk->tokens);
+    TokenList_Realloc(&chunk->tokens, (chunk->end - chunk->begin) / PARALLEL_SCANNER_BYTES_PER_TOKEN + TOKEN_LIST_INITIAL_CAPACITY);
+    Scanner scanner;
+    Scanner_InitRange(&scanner, &chunk->tokens, self->source, chunk->begin, chunk->end);
+    scanner.is_quiet = true;
+    if(chunk->begin < chunk->end) scanner_scan(&scanner);
+    chunk->has_failed = scanner.has_failed;
+    Scanner_Free(&scanner);
+
+    int count = TokenList_Length(&chunk->tokens);
+    chunk->matches = (int*)TOKEN_LIST_MALLOC((2 * count + 1) * sizeof(int));
+    chunk->pending = NULL;
+    chunk->pending_close = 0;
+    chunk->pending_open = 0;
+    if(!chunk->matches)
+    {
+        chunk->has_failed = true;
+        return;
+    }
+    chunk->pending = chunk->matches + count;
+    parallel_scanner_match_parens(chunk->tokens.data, count, chunk->matches, chunk->pending, &chunk->pending_close, &chunk->pending_open);
+}
+
+void parallel_scanner_copy_chunk_task(void *ctx, int task)
+{
+    ParallelScanner *self = (ParallelScanner*)ctx;
+    ParallelScannerChunk *chunk = &self->chunks[task];
+    int count = TokenList_Length(&chunk->tokens);
+    memcpy(self->tokens->data + chunk->offset, chunk->tokens.data, count * sizeof(Token));
+
+    int *matches = self->matches + chunk->offset;
+    for(int i = 0; i < count; ++i) matches[i] = chunk->matches[i] >= 0 ? chunk->offset + chunk->matches[i] : -1;
+}
+
+void parallel_scanner_scan_serial(ParallelScanner *self)
+{
+    Scanner scanner;
+    Scanner_InitRange(&scanner, self->tokens, self->source, 0, self->source_length);
+    scanner_scan(&scanner);
+    self->has_failed = scanner.has_failed;
+    Scanner_Free(&scanner);
+
+    int count = TokenList_Length(self->tokens);
+    int *pending = (int*)TOKEN_LIST_MALLOC((count + 1) * sizeof(int));
+    if(!pending || !parallel_scanner_reserve_matches(self, count))
+    {
+        if(pending) TOKEN_LIST_FREE(pending);
+        self->has_failed = true;
+        return;
+    }
+    int pending_close, pending_open;
+    parallel_scanner_match_parens(self->tokens->data, count, self->matches, pending, &pending_close, &pending_open);
+    TOKEN_LIST_FREE(pending);
+}
+
+// Appends the tokens of the whole source to the scanner's TokenList. The TokenList must be empty.
+void parallel_scanner_scan(ParallelScanner *self)
+{
+    int max_chunks = self->pool && self->pool->thread_count > 1 ? self->pool->thread_count * PARALLEL_SCANNER_CHUNKS_PER_THREAD : 1;
+    self->chunk_count = self->source_length / PARALLEL_SCANNER_MIN_CHUNK;
+    if(self->chunk_count > max_chunks) self->chunk_count = max_chunks;
+    if(self->chunk_count <= 1)
+    {
+        parallel_scanner_scan_serial(self);
+        return;
+    }
+
+    self->chunks = (ParallelScannerChunk*)TOKEN_LIST_MALLOC(self->chunk_count * sizeof(ParallelScannerChunk));
+    if(!self->chunks)
+    {
+        parallel_scanner_scan_serial(self);
+        return;
+    }
+    threadpool_run(self->pool, parallel_scanner_scan_chunk_task, self, self->chunk_count);
+
+    // Prefix sums of the token counts give every chunk its place in the output.
+    int total = 0;
+    bool has_failed = false;
+    for(int i = 0; i < self->chunk_count; ++i)
+    {
+        ParallelScannerChunk *chunk = &self->chunks[i];
+        chunk->offset = total;
+        total += TokenList_Length(&chunk->tokens);
+        has_failed |= chunk->has_failed;
+    }
+
+    if(!has_failed && total > TokenList_Capacity(self->tokens)) TokenList_Realloc(self->tokens, total);
+    if(!has_failed && total <= TokenList_Capacity(self->tokens) && parallel_scanner_reserve_matches(self, total))
+    {
+        threadpool_run(self->pool, parallel_scanner_copy_chunk_task, self, self->chunk_count);
+        has_failed = !parallel_scanner_match_cuts(self);
+    }
+    else has_failed = true;
+
+    for(int i = 0; i < self->chunk_count; ++i)
+    {
+        TokenList_Free(&self->chunks[i].tokens);
+        if(self->chunks[i].matches) TOKEN_LIST_FREE(self->chunks[i].matches);
+    }
+    TOKEN_LIST_FREE(self->chunks);
+    self->chunks = NULL;
+    // Errors are rare, so just scan again on a single thread to report them exactly like the serial Scanner would.
+    if(has_failed) parallel_scanner_scan_serial(self);
+    else self->tokens->len = total;
+}
+
+// Returns the index of the ")" that closes the "(" at the given token index, or -1 if it's never closed.
+int parallel_scanner_find_group_end(ParallelScanner *self, int open_idx)
+{
+    return self->matches[open_idx];
+}
+
+#endif
@@ -1,26 +1,119 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+// Feature test macros, for the clock_gettime() of governor.h
+#include "platform.h"
+
 // Includes from std
 #include <stdio.h>
+#include <string.h>
 #include <stdbool.h>
 
 // Includes from project
 #include "token.h"
 #include "tokenlist.h"
+#include "expr.h"
+#include "exprlist.h"
+#include "functions.h"
+#include "evaluator.h"
+#include "memo.h"
+#include "doubleparse.h"
+
+// Defines
+#ifndef PARSER_BRANCHLESS_MAX_COST
+#define PARSER_BRANCHLESS_MAX_COST 4 // Max number of nodes an operand can have for it to be evaluated eagerly instead of branching over it.
+#endif
+
+#ifndef PARSER_CHAIN_MIN_LENGTH
+#define PARSER_CHAIN_MIN_LENGTH 64 // Min number of operands a chain of any binary level needs to be stored as a single EXPR_SUM / EXPR_PRODUCT / EXPR_CHAIN node.
+#endif
+
+// Grammar levels, from the loosest to the tightest binding one. Every level has its own parse function.
+enum ParserLevel
+{
+    PARSER_LEVEL_NONE = 0,
+    PARSER_LEVEL_TERNARY,
+    PARSER_LEVEL_OR,
+    PARSER_LEVEL_AND,
+    PARSER_LEVEL_EQUALITY,
+    PARSER_LEVEL_COMPARISON,
+    PARSER_LEVEL_ADDSUB,
+    PARSER_LEVEL_MULDIV,
+    PARSER_LEVEL_UNARY,
+    PARSER_LEVEL_PRIMARY,
+    PARSER_LEVEL_COUNT,
+};
 
+// A node returned by the parse function of a level, along with the tokens it was parsed from ([begin, end)).
+typedef struct {
+	int node;
+	int level;
+	int begin, end;
+} ParserSpan;
+
+// The parser builds the expression tree into an ExprList. Every parse function returns the index of the node it produced.
 typedef struct {
 	TokenList *tokens;
+	// Tokens from token_gap on are stored token_gap_len further in the list (the gap buffer of incremental.h). Only the
+	// parse functions skip the gap, the memo and paren_matches can't be used along with it.
+	int token_gap, token_gap_len;
+	ExprList *exprs;
+	FunctionTable *functions; // Can be NULL, in which case function calls are not allowed.
+	char const *source; // Source string the tokens were scanned from, used to read identifier names.
+	Token params[FUNCTION_MAX_ARGS]; // Parameters of the function definition being parsed.
+	int param_count;
+	int *operands; // Stack of (node, op) pairs for the chains being parsed. Nested chains push on top of the outer ones.
+	int operands_len, operands_cap;
+	SubexprMemo *memo; // Can be NULL. When set, groups without identifiers are folded to their (cached) value.
+	int const *paren_matches; // Can be NULL. Index of the partner of every paren token (see ParallelScanner), which lets groups be looked up in the memo before they're parsed.
+	Governor *governor; // Can be NULL. When set, the nesting depth is limited.
+	ParserSpan *spans; // Spans of the nodes returned by every parse function, only recorded when is_recording_spans is set.
+	int spans_len, spans_cap;
+	bool is_recording_spans;
+	int spans_paused; // Spans are not recorded while this is not 0, like for the arguments of a call.
+	bool is_double; // Number literals are parsed from their text into EXPR_LITERAL_DOUBLE nodes. Groups are never folded.
 	int current;
 	bool has_failed;
 } Parser;
 
 // Forward declarations
 int parser_parse_expr(Parser*);
+int parser_parse_expr_ternary(Parser*);
+int parser_parse_expr_or(Parser*);
+int parser_parse_expr_and(Parser*);
+int parser_parse_expr_equality(Parser*);
+int parser_parse_expr_comparison(Parser*);
 int parser_parse_expr_addsub(Parser*);
 int parser_parse_expr_muldiv(Parser*);
 int parser_parse_expr_unary(Parser*);
 int parser_parse_expr_primary(Parser*);
+int parser_parse_expr_identifier(Parser*, Token);
+int parser_parse_expr_call(Parser*, Token);
+
+bool parser_is_at_definition(Parser*);
+int parser_parse_definition(Parser*);
+bool parser_parse_bound(Parser*, int*);
+
+int parser_add_expr(Parser*, int, int, int, int, int);
+int parser_add_literal(Parser*, int);
+int parser_add_double(Parser*, double);
+int parser_add_binary(Parser*, int, int, int);
+int parser_add_logical(Parser*, int, int, int);
+int parser_add_ternary(Parser*, int, int, int);
+int parser_add_call(Parser*, int, int const*, int);
+int parser_add_call_node(Parser*, int, int);
+void parser_push_operand(Parser*, int, int);
+int parser_add_chain(Parser*, int, int);
+int parser_inline_expr(Parser*, ExprList*, int, int const*);
+int parser_fold_group(Parser*, int, int, int, int);
+int parser_eval_group(Parser*, int, int, SubexprKey);
+bool parser_can_eval_eagerly(Parser*, int);
+bool parser_can_inline(Parser*, Function*, int const*);
+bool parser_token_names_equal(Parser*, Token, Token);
+bool parser_enter(Parser*);
+void parser_leave(Parser*, int);
+int parser_record(Parser*, int, int, int);
+int parser_parse_level(Parser*, int);
 
 Token parser_peek_at(Parser*, int);
 Token parser_peek(Parser*);
@@ -34,9 +127,27 @@ bool parser_is_at_end(Parser*);
 
 // Implementation
 
-void Parser_Init(Parser *self, TokenList *token_list)
+void Parser_Init(Parser *self, TokenList *token_list, ExprList *expr_list, FunctionTable *functions, char const *source)
 {
 	self->tokens = token_list;
+	self->token_gap = 0;
+	self->token_gap_len = 0;
+	self->exprs = expr_list;
+	self->functions = functions;
+	self->source = source;
+	self->param_count = 0;
+	self->operands = NULL;
+	self->operands_len = 0;
+	self->operands_cap = 0;
+	self->memo = NULL;
+	self->paren_matches = NULL;
+	self->governor = NULL;
+	self->spans = NULL;
+	self->spans_len = 0;
+	self->spans_cap = 0;
+	self->is_recording_spans = false;
+	self->spans_paused = 0;
+	self->is_double = false;
 	self->current = 0;
 	self->has_failed = false;
 }
@@ -44,18 +155,38 @@ void Parser_Init(Parser *self, TokenList *token_list)
 void Parser_Free(Parser *self)
 {
 	self->tokens = NULL;
+	self->token_gap = 0;
+	self->token_gap_len = 0;
+	self->exprs = NULL;
+	self->functions = NULL;
+	self->source = NULL;
+	self->param_count = 0;
+	if(self->operands) EXPR_LIST_FREE(self->operands);
+	self->operands = NULL;
+	self->operands_len = 0;
+	self->operands_cap = 0;
+	self->memo = NULL;
+	self->governor = NULL;
+	if(self->spans) EXPR_LIST_FREE(self->spans);
+	self->spans = NULL;
+	self->spans_len = 0;
+	self->spans_cap = 0;
+	self->is_recording_spans = false;
+	self->spans_paused = 0;
+	self->is_double = false;
 	self->current = 0;
 	self->has_failed = false;
 }
 
 Token parser_peek_at(Parser *self, int offset)
 {
-    return TokenList_Get(self->tokens, self->current + offset);
+    int idx = self->current + offset;
+    return TokenList_Get(self->tokens, idx < self->token_gap ? idx : idx + self->token_gap_len);
 }
 
 Token parser_peek(Parser *self)
 {
-	if(parser_is_at_end(self)) return (Token){TOKEN_EOF, 0};
+	if(parser_is_at_end(self)) return (Token){TOKEN_EOF, 0, 0, 0};
     return parser_peek_at(self, 0);
 }
 
@@ -92,74 +223,477 @@ bool parser_match(Parser *self, int type)
 bool parser_is_at_end(Parser *self)
 {
 	// return parser_peek_at(self, 0).type == TOKEN_EOF || self->has_failed;
-	return self->current >= TokenList_Length(self->tokens) || self->has_failed;
+	return self->current >= TokenList_Length(self->tokens) - self->token_gap_len || self->has_failed;
 	// if we fail, we act as if we were at the end so that we can quit early. That's because this is a simple expression evaluator and not a full language parser, so once we fail, there's nothing left for us to do.
 }
 
+int parser_add_expr(Parser *self, int type, int value, int lhs, int rhs, int cond)
+{
+    Expr expr = {type, value, lhs, rhs, cond, 1, 0};
+    int children[3] = {lhs, rhs, cond};
+    for(int i = 0; i < 3; ++i)
+    {
+        if(children[i] < 0) continue;
+        Expr *child = ExprList_Get(self->exprs, children[i]);
+        expr.cost += child->cost;
+        expr.flags |= child->flags;
+    }
+    if(type == EXPR_DIV) expr.flags |= EXPR_FLAG_MAY_TRAP;
+    return ExprList_Add(self->exprs, expr);
+}
+
+int parser_add_literal(Parser *self, int value)
+{
+    return parser_add_expr(self, EXPR_LITERAL, value, -1, -1, -1);
+}
+
+int parser_add_double(Parser *self, double value)
+{
+    return parser_add_expr(self, EXPR_LITERAL_DOUBLE, ExprList_AddDouble(self->exprs, value), -1, -1, -1);
+}
+
+int parser_add_binary(Parser *self, int type, int lhs, int rhs)
+{
+    return parser_add_expr(self, type, 0, lhs, rhs, -1);
+}
+
+int parser_add_logical(Parser *self, int type, int lhs, int rhs)
+{
+    // When the rhs is cheap and can't trap, it's cheaper to always evaluate it than to branch over it.
+    if(parser_can_eval_eagerly(self, rhs)) type = type == EXPR_AND ? EXPR_AND_EAGER : EXPR_OR_EAGER;
+    return parser_add_binary(self, type, lhs, rhs);
+}
+
+int parser_add_ternary(Parser *self, int cond, int lhs, int rhs)
+{
+    // If evaluating both branches is cheaper than a possible misprediction, select the result without branching.
+    int type = parser_can_eval_eagerly(self, lhs) && parser_can_eval_eagerly(self, rhs) ? EXPR_SELECT : EXPR_TERNARY;
+    return parser_add_expr(self, type, 0, lhs, rhs, cond);
+}
+
+int parser_add_call_node(Parser *self, int function_idx, int first_arg)
+{
+    int idx = parser_add_expr(self, EXPR_CALL, function_idx, first_arg, -1, -1);
+    Function *function = FunctionTable_Get(self->functions, function_idx);
+    if(!function->native)
+    {
+        // The body is not part of this tree, so account for it here to keep calls away from the branchless paths.
+        Expr *expr = ExprList_Get(self->exprs, idx);
+        if(function->body >= 0)
+        {
+            Expr *body = ExprList_Get(&self->functions->exprs, function->body);
+            expr->cost += body->cost;
+            expr->flags |= body->flags;
+        }
+        else
+        {
+            // Recursive call, we can't know anything about the body yet.
+            expr->cost += FUNCTION_INLINE_MAX_COST;
+            expr->flags |= EXPR_FLAG_MAY_TRAP;
+        }
+    }
+    return idx;
+}
+
+int parser_add_call(Parser *self, int function_idx, int const *args, int arg_count)
+{
+    Function *function = FunctionTable_Get(self->functions, function_idx);
+    if(parser_can_inline(self, function, args))
+    {
+        // A copy that ends up in another function's body outlives this parse, and it would keep the old version if
+        // the function was redefined. A definition that fails to parse may leave the flag set, which is only stricter.
+        if(self->exprs == &self->functions->exprs) function->is_inlined = true;
+        return parser_inline_expr(self, &self->functions->exprs, function->body, args);
+    }
+    int first_arg = -1;
+    for(int i = arg_count - 1; i >= 0; --i)
+    {
+        first_arg = parser_add_expr(self, EXPR_ARG, 0, args[i], first_arg, -1);
+    }
+    return parser_add_call_node(self, function_idx, first_arg);
+}
+
+void parser_push_operand(Parser *self, int expr, int op)
+{
+    if(self->operands_len + 2 > self->operands_cap)
+    {
+        int new_cap = self->operands_cap ? self->operands_cap * 2 : 2 * PARSER_CHAIN_MIN_LENGTH;
+        int *temp = (int*)EXPR_LIST_REALLOC(self->operands, new_cap * sizeof(int));
+        if(!temp)
+        {
+            self->has_failed = true;
+            fprintf(stderr, "Out of memory while parsing chain\n");
+            return;
+        }
+        self->operands = temp;
+        self->operands_cap = new_cap;
+    }
+    self->operands[self->operands_len++] = expr;
+    self->operands[self->operands_len++] = op;
+}
+
+// Pops the operands pushed since base and combines them into a single node. Short chains become the usual left deep
+// tree of binary nodes, long ones become a single node of the given type whose EXPR_OPERAND children are stored
+// contiguously, so that the evaluator can walk them without recursion and split them across threads.
+int parser_add_chain(Parser *self, int type, int base)
+{
+    int count = (self->operands_len - base) / 2;
+    int *operands = self->operands + base;
+    self->operands_len = base;
+    if(count <= 0) return parser_add_literal(self, 0);
+    
+    if(count < PARSER_CHAIN_MIN_LENGTH)
+    {
+        int l = operands[0];
+        for(int i = 1; i < count; ++i)
+        {
+            int op = operands[2 * i + 1];
+            l = op == EXPR_AND || op == EXPR_OR ? parser_add_logical(self, op, l, operands[2 * i]) : parser_add_binary(self, op, l, operands[2 * i]);
+        }
+        return l;
+    }
+    
+    Expr chain = {type, count, ExprList_Length(self->exprs), -1, -1, 1, 0};
+    for(int i = 0; i < count; ++i)
+    {
+        int op = operands[2 * i + 1];
+        int next = i < count - 1 ? chain.lhs + i + 1 : -1;
+        Expr *operand = ExprList_Get(self->exprs, operands[2 * i]);
+        Expr expr = {EXPR_OPERAND, op, operands[2 * i], next, -1, operand->cost + 1, operand->flags};
+        if(op == EXPR_DIV) expr.flags |= EXPR_FLAG_MAY_TRAP;
+        chain.cost += expr.cost;
+        chain.flags |= expr.flags;
+        ExprList_Add(self->exprs, expr);
+    }
+    return ExprList_Add(self->exprs, chain);
+}
+
+bool parser_can_inline(Parser *self, Function *function, int const *args)
+{
+    if(function->native || function->body < 0) return false;
+    // The declared ranges are checked when the function is called, which an inlined body would skip.
+    if(function->has_ranges) return false;
+    if(ExprList_Get(&self->functions->exprs, function->body)->cost > FUNCTION_INLINE_MAX_COST) return false;
+    for(int i = 0; i < function->arity; ++i)
+    {
+        Expr *arg = ExprList_Get(self->exprs, args[i]);
+        // A real call always evaluates its arguments, but the inlined body may skip some of them, so only inline when
+        // skipping an argument can't change the result.
+        if(arg->flags & EXPR_FLAG_MAY_TRAP) return false;
+        // Arguments are shared rather than copied when a parameter is used more than once, so they would be evaluated
+        // once per use. That's only free for leaves.
+        if(function->param_uses[i] > 1 && arg->cost > 1) return false;
+    }
+    return true;
+}
+
+// Copies the body of a function into the parser's ExprList, replacing its parameters with the argument nodes. The
+// eager / short-circuit choices are made again because the arguments can be more expensive than the parameters were.
+int parser_inline_expr(Parser *self, ExprList *body, int idx, int const *args)
+{
+    if(idx < 0) return -1;
+    Expr expr = *ExprList_Get(body, idx); // Copy, both lists can be the same one when inlining into a function body.
+    if(expr.type == EXPR_PARAM) return args[expr.value];
+    if(expr.type == EXPR_LITERAL_DOUBLE) return parser_add_double(self, ExprList_GetDouble(body, expr.value));
+    if(expr_is_chain(expr.type))
+    {
+        // The cloned operands would not be contiguous, so rebuild the chain from them.
+        int base = self->operands_len;
+        for(int operand = expr.lhs; operand >= 0; operand = ExprList_Get(body, operand)->rhs)
+        {
+            int op = expr_checked_type(ExprList_Get(body, operand)->value); // The body's ranges don't hold for the arguments.
+            parser_push_operand(self, parser_inline_expr(self, body, ExprList_Get(body, operand)->lhs, args), op);
+        }
+        return parser_add_chain(self, expr.type, base);
+    }
+    int lhs = parser_inline_expr(self, body, expr.lhs, args);
+    int rhs = parser_inline_expr(self, body, expr.rhs, args);
+    int cond = parser_inline_expr(self, body, expr.cond, args);
+    switch(expr.type)
+    {
+        case EXPR_AND: case EXPR_AND_EAGER: return parser_add_logical(self, EXPR_AND, lhs, rhs);
+        case EXPR_OR: case EXPR_OR_EAGER: return parser_add_logical(self, EXPR_OR, lhs, rhs);
+        case EXPR_TERNARY: case EXPR_SELECT: return parser_add_ternary(self, cond, lhs, rhs);
+        case EXPR_CALL: return parser_add_call_node(self, expr.value, lhs);
+        default: return parser_add_expr(self, expr_checked_type(expr.type), expr.value, lhs, rhs, cond);
+    }
+}
+
+// Replaces the group whose tokens are in [begin, end) with a literal holding its value. The value is looked up in the
+// memo first, and only evaluated and added to it when it's not there yet. The nodes of the group must be the last ones
+// added to the ExprList, starting at mark.
+int parser_fold_group(Parser *self, int group, int mark, int begin, int end)
+{
+    if(self->has_failed || end - begin < 2 || !subexpr_memo_is_cacheable(self->tokens, begin, end)) return group;
+    SubexprKey key = subexpr_memo_key(self->tokens, begin, end);
+    int value = 0;
+    if(!subexpr_memo_lookup(self->memo, key, &value)) return parser_eval_group(self, group, mark, key);
+    self->exprs->len = mark;
+    return parser_add_literal(self, value);
+}
+
+// Evaluates a group that is not in the memo yet, adds its value under the given key and replaces it with a literal,
+// just like parser_fold_group().
+int parser_eval_group(Parser *self, int group, int mark, SubexprKey key)
+{
+    Evaluator evaluator;
+    Evaluator_Init(&evaluator, self->exprs, self->functions, NULL);
+    evaluator.is_checked = true;
+    evaluator.is_overflow_checked = true; // Also keep groups that overflow, so they fail when evaluated checked.
+    evaluator.governor = self->governor;
+    int value = evaluator_eval(&evaluator, group);
+    bool has_failed = evaluator.has_failed;
+    Evaluator_Free(&evaluator);
+    // A group that divides by zero is kept as is, so that it still only traps if it's evaluated (it may be in a
+    // branch that is never taken).
+    if(has_failed) return group;
+    subexpr_memo_insert(self->memo, key, value);
+    self->exprs->len = mark;
+    return parser_add_literal(self, value);
+}
+
+bool parser_token_names_equal(Parser *self, Token a, Token b)
+{
+    return a.length == b.length && strncmp(self->source + a.start, self->source + b.start, a.length) == 0;
+}
+
+bool parser_can_eval_eagerly(Parser *self, int idx)
+{
+    Expr *expr = ExprList_Get(self->exprs, idx);
+    return expr->cost <= PARSER_BRANCHLESS_MAX_COST && !(expr->flags & EXPR_FLAG_MAY_TRAP);
+}
+
+// Every nested parse_expr() and every operator of a comparison or logical chain counts as one level of depth, whether
+// the chain ends up as a left deep tree or as a single EXPR_CHAIN. Depth is always given back with parser_leave(), even when entering failed.
+bool parser_enter(Parser *self)
+{
+    if(!self->governor || governor_enter(self->governor)) return true;
+    self->has_failed = true;
+    return false;
+}
+
+void parser_leave(Parser *self, int count)
+{
+    if(self->governor) governor_leave(self->governor, count);
+}
+
+// Records the span of a node returned by the parse function of the given level, and returns the node.
+int parser_record(Parser *self, int level, int begin, int node)
+{
+    if(!self->is_recording_spans || self->spans_paused > 0 || node < 0) return node;
+    if(self->spans_len >= self->spans_cap)
+    {
+        int new_cap = self->spans_cap ? self->spans_cap * 2 : 64;
+        ParserSpan *temp = (ParserSpan*)EXPR_LIST_REALLOC(self->spans, new_cap * sizeof(ParserSpan));
+        if(!temp)
+        {
+            self->has_failed = true;
+            fprintf(stderr, "Out of memory while recording spans\n");
+            return node;
+        }
+        self->spans = temp;
+        self->spans_cap = new_cap;
+    }
+    ParserSpan span = {node, level, begin, self->current};
+    self->spans[self->spans_len++] = span;
+    return node;
+}
+
+// Parses a single production of the given level starting at the current token.
+int parser_parse_level(Parser *self, int level)
+{
+    switch(level)
+    {
+        case PARSER_LEVEL_TERNARY: return parser_parse_expr(self);
+        case PARSER_LEVEL_OR: return parser_parse_expr_or(self);
+        case PARSER_LEVEL_AND: return parser_parse_expr_and(self);
+        case PARSER_LEVEL_EQUALITY: return parser_parse_expr_equality(self);
+        case PARSER_LEVEL_COMPARISON: return parser_parse_expr_comparison(self);
+        case PARSER_LEVEL_ADDSUB: return parser_parse_expr_addsub(self);
+        case PARSER_LEVEL_MULDIV: return parser_parse_expr_muldiv(self);
+        case PARSER_LEVEL_UNARY: return parser_parse_expr_unary(self);
+        case PARSER_LEVEL_PRIMARY: return parser_parse_expr_primary(self);
+        default: break;
+    }
+    self->has_failed = true;
+    return parser_add_literal(self, 0);
+}
+
 int parser_parse_expr(Parser *self)
 {
-    return parser_parse_expr_addsub(self);
+    int ans = parser_enter(self) ? parser_parse_expr_ternary(self) : parser_add_literal(self, 0);
+    parser_leave(self, 1);
+    return ans;
+}
+
+int parser_parse_expr_ternary(Parser *self)
+{
+    int begin = self->current;
+    int cond = parser_parse_expr_or(self);
+    if(!parser_is_at_end(self) && parser_match(self, TOKEN_QUESTION))
+    {
+        int l = parser_parse_expr(self);
+        if(!parser_match(self, TOKEN_COLON))
+        {
+            self->has_failed = true;
+            fprintf(stderr, "Expected ':' in ternary expression\n");
+            return parser_add_literal(self, 0);
+        }
+        int r = parser_parse_expr(self); // Right associative, so "a ? b : c ? d : e" is "a ? b : (c ? d : e)".
+        return parser_record(self, PARSER_LEVEL_TERNARY, begin, parser_add_ternary(self, cond, l, r));
+    }
+    return parser_record(self, PARSER_LEVEL_TERNARY, begin, cond);
+}
+
+int parser_parse_expr_or(Parser *self)
+{
+    int begin = self->current;
+    int base = self->operands_len;
+    int links = 0;
+    parser_push_operand(self, parser_parse_expr_and(self), EXPR_OR);
+    while(!parser_is_at_end(self) && parser_match(self, TOKEN_OP_OR))
+    {
+        links += 1;
+        parser_enter(self);
+        parser_push_operand(self, parser_parse_expr_and(self), EXPR_OR);
+    }
+    parser_leave(self, links);
+    return parser_record(self, PARSER_LEVEL_OR, begin, parser_add_chain(self, EXPR_CHAIN, base));
+}
+
+int parser_parse_expr_and(Parser *self)
+{
+    int begin = self->current;
+    int base = self->operands_len;
+    int links = 0;
+    parser_push_operand(self, parser_parse_expr_equality(self), EXPR_AND);
+    while(!parser_is_at_end(self) && parser_match(self, TOKEN_OP_AND))
+    {
+        links += 1;
+        parser_enter(self);
+        parser_push_operand(self, parser_parse_expr_equality(self), EXPR_AND);
+    }
+    parser_leave(self, links);
+    return parser_record(self, PARSER_LEVEL_AND, begin, parser_add_chain(self, EXPR_CHAIN, base));
+}
+
+int parser_parse_expr_equality(Parser *self)
+{
+    int begin = self->current;
+    int base = self->operands_len;
+    int r = 0;
+    int links = 0;
+    parser_push_operand(self, parser_parse_expr_comparison(self), EXPR_EQ);
+    while(!parser_is_at_end(self) && (parser_match(self, TOKEN_OP_EQ) || parser_match(self, TOKEN_OP_NE)))
+    {
+        links += 1;
+        parser_enter(self);
+        Token tok = parser_peek_previous(self);
+        r = parser_parse_expr_comparison(self);
+        switch(tok.type)
+        {
+            case TOKEN_OP_EQ: parser_push_operand(self, r, EXPR_EQ); break;
+            case TOKEN_OP_NE: parser_push_operand(self, r, EXPR_NE); break;
+            default: self->has_failed = true; fprintf(stderr, "WRONG OP, EXPECTED == OR != (%d, %d)\n", tok.type, tok.value); break;
+        }
+    }
+    parser_leave(self, links);
+    return parser_record(self, PARSER_LEVEL_EQUALITY, begin, parser_add_chain(self, EXPR_CHAIN, base));
+}
+
+int parser_parse_expr_comparison(Parser *self)
+{
+    int begin = self->current;
+    int base = self->operands_len;
+    int r = 0;
+    int links = 0;
+    parser_push_operand(self, parser_parse_expr_addsub(self), EXPR_LT);
+    while(!parser_is_at_end(self) && (parser_match(self, TOKEN_OP_LT) || parser_match(self, TOKEN_OP_LE) || parser_match(self, TOKEN_OP_GT) || parser_match(self, TOKEN_OP_GE)))
+    {
+        links += 1;
+        parser_enter(self);
+        Token tok = parser_peek_previous(self);
+        r = parser_parse_expr_addsub(self);
+        switch(tok.type)
+        {
+            case TOKEN_OP_LT: parser_push_operand(self, r, EXPR_LT); break;
+            case TOKEN_OP_LE: parser_push_operand(self, r, EXPR_LE); break;
+            case TOKEN_OP_GT: parser_push_operand(self, r, EXPR_GT); break;
+            case TOKEN_OP_GE: parser_push_operand(self, r, EXPR_GE); break;
+            default: self->has_failed = true; fprintf(stderr, "WRONG OP, EXPECTED <, <=, > OR >= (%d, %d)\n", tok.type, tok.value); break;
+        }
+    }
+    parser_leave(self, links);
+    return parser_record(self, PARSER_LEVEL_COMPARISON, begin, parser_add_chain(self, EXPR_CHAIN, base));
 }
 
 int parser_parse_expr_addsub(Parser *self)
 {
+    int begin = self->current;
+    int base = self->operands_len;
     int l = 0, r = 0;
     l = parser_parse_expr_muldiv(self);
+    parser_push_operand(self, l, EXPR_ADD);
     while(!parser_is_at_end(self) && (parser_match(self, TOKEN_OP_PLUS) || parser_match(self, TOKEN_OP_MINUS)))
     {
         Token tok = parser_peek_previous(self);
         r = parser_parse_expr_muldiv(self);
         switch(tok.type)
         {
-            case TOKEN_OP_PLUS: l = l + r; break;
-            case TOKEN_OP_MINUS: l = l - r; break;
-            default: self->has_failed = true; l = 0; fprintf(stderr, "WRONG OP, EXPECTED + OR - (%d, %d)\n", tok.type, tok.value); break;
+            case TOKEN_OP_PLUS: parser_push_operand(self, r, EXPR_ADD); break;
+            case TOKEN_OP_MINUS: parser_push_operand(self, r, EXPR_SUB); break;
+            default: self->has_failed = true; fprintf(stderr, "WRONG OP, EXPECTED + OR - (%d, %d)\n", tok.type, tok.value); break;
         }
     }
     // printf("l = %d, r = %d\n", l, r);
-    return l;
+    return parser_record(self, PARSER_LEVEL_ADDSUB, begin, parser_add_chain(self, EXPR_SUM, base));
 }
 
 int parser_parse_expr_muldiv(Parser *self)
 {
+    int begin = self->current;
+    int base = self->operands_len;
     int l = 0, r = 0;
     l = parser_parse_expr_unary(self);
+    parser_push_operand(self, l, EXPR_MUL);
     while(!parser_is_at_end(self) && (parser_match(self, TOKEN_OP_STAR) || parser_match(self, TOKEN_OP_SLASH)))
     {
         Token tok = parser_peek_previous(self);
         r = parser_parse_expr_unary(self);
         switch(tok.type)
         {
-            case TOKEN_OP_STAR: l = l * r; break;
-            case TOKEN_OP_SLASH: l = l / r; break;
-            default: self->has_failed = true; l = 0; fprintf(stderr, "WRONG OP, EXPECTED * OR / (%d, %d)\n", tok.type, tok.value); break;
+            case TOKEN_OP_STAR: parser_push_operand(self, r, EXPR_MUL); break;
+            case TOKEN_OP_SLASH: parser_push_operand(self, r, EXPR_DIV); break;
+            default: self->has_failed = true; fprintf(stderr, "WRONG OP, EXPECTED * OR / (%d, %d)\n", tok.type, tok.value); break;
         }
     }
     // printf("l = %d, r = %d\n", l, r);
-    return l;
+    return parser_record(self, PARSER_LEVEL_MULDIV, begin, parser_add_chain(self, EXPR_PRODUCT, base));
 }
 
 int parser_parse_expr_unary(Parser *self)
 {
+    int begin = self->current;
     if(parser_match(self, TOKEN_OP_PLUS))
     {
         int v = parser_parse_expr_primary(self);
-        return v;
+        return parser_record(self, PARSER_LEVEL_UNARY, begin, v);
     }
     
     if(parser_match(self, TOKEN_OP_MINUS))
     {
         int v = parser_parse_expr_primary(self);
-        return -v;
+        return parser_record(self, PARSER_LEVEL_UNARY, begin, parser_add_expr(self, EXPR_NEG, 0, v, -1, -1));
     }
     
-    return parser_parse_expr_primary(self);
+    return parser_record(self, PARSER_LEVEL_UNARY, begin, parser_parse_expr_primary(self));
 }
 
 int parser_parse_expr_primary(Parser *self)
 {
+    int begin = self->current;
     Token token = parser_advance(self);
-	int ans = 0;
+	int ans = -1;
 	// printf("primary expr : %s\n", TokenTypeName[token.type]);
     switch(token.type)
     {
@@ -171,21 +705,47 @@ int parser_parse_expr_primary(Parser *self)
         case TOKEN_LITERAL_NUMBER:
 			{
 				// printf("%d\n", token.value);
-				ans = token.value;
+				ans = self->is_double
+					? parser_add_double(self, double_parse(self->source + token.start, token.length))
+					: parser_add_literal(self, token.value);
+			}
+			break;
+        case TOKEN_IDENTIFIER:
+			{
+				ans = parser_parse_expr_identifier(self, token);
 			}
 			break;
         case TOKEN_PAREN_L:
             {
+                int inner = self->current;
+                int mark = ExprList_Length(self->exprs);
+                // When the end of the group is already known, a group that is in the memo is not even parsed.
+                int end = self->memo && !self->is_double && self->paren_matches ? self->paren_matches[begin] : -1;
+                bool is_keyed = end - inner >= 2 && subexpr_memo_is_cacheable(self->tokens, inner, end);
+                SubexprKey key;
+                if(is_keyed)
+                {
+                    int value;
+                    key = subexpr_memo_key(self->tokens, inner, end);
+                    if(subexpr_memo_lookup(self->memo, key, &value))
+                    {
+                        self->current = end + 1;
+                        return parser_record(self, PARSER_LEVEL_PRIMARY, begin, parser_add_literal(self, value));
+                    }
+                }
                 int v = parser_parse_expr(self);
 				// this part right here where we do the if-else is what is usually implemented as a "consume(TOKEN_TYPE, 'error message')" type of function, but we do it inline because we're cool af.
                 if(parser_match(self, TOKEN_PAREN_R))
                 {
-                    return v;
+                    if(is_keyed && !self->has_failed && self->current - 1 == end) v = parser_eval_group(self, v, mark, key);
+                    else if(self->memo && !self->is_double) v = parser_fold_group(self, v, mark, inner, self->current - 1);
+                    return parser_record(self, PARSER_LEVEL_PRIMARY, begin, v);
                 }
                 else
                 {
+					// Only report it if it's the first error, otherwise every enclosing group would report it too.
+					if(!self->has_failed) fprintf(stderr, "Expected ')' at end of grouping expression\n");
 					self->has_failed = true;
-                    fprintf(stderr, "Expected ')' at end of grouping expression\n");
                 }
             }
             break;
@@ -197,7 +757,230 @@ int parser_parse_expr_primary(Parser *self)
 			}
 			break;
     }
-    return ans;
+    // Every parse function must return a valid node, so anything that didn't produce one evaluates to 0 just like before.
+    if(ans < 0) ans = parser_add_literal(self, 0);
+    return parser_record(self, PARSER_LEVEL_PRIMARY, begin, ans);
+}
+
+int parser_parse_expr_identifier(Parser *self, Token token)
+{
+    for(int i = 0; i < self->param_count; ++i)
+    {
+        if(parser_token_names_equal(self, token, self->params[i]))
+        {
+            return parser_add_expr(self, EXPR_PARAM, i, -1, -1, -1);
+        }
+    }
+    if(parser_peek(self).type == TOKEN_PAREN_L)
+    {
+        return parser_parse_expr_call(self, token);
+    }
+    self->has_failed = true;
+    fprintf(stderr, "Unknown identifier '%.*s'\n", token.length, self->source + token.start);
+    return -1;
+}
+
+int parser_parse_expr_call(Parser *self, Token name)
+{
+    int function_idx = self->functions ? FunctionTable_Find(self->functions, self->source + name.start, name.length) : -1;
+    if(function_idx < 0)
+    {
+        self->has_failed = true;
+        fprintf(stderr, "Unknown function '%.*s'\n", name.length, self->source + name.start);
+        return -1;
+    }
+    
+    int args[FUNCTION_MAX_ARGS];
+    int arg_count = 0;
+    parser_match(self, TOKEN_PAREN_L);
+    // Arguments can end up shared or copied when the call is inlined, so the call is only ever re-parsed as a whole.
+    self->spans_paused += 1;
+    if(!parser_match(self, TOKEN_PAREN_R))
+    {
+        do
+        {
+            int arg = parser_parse_expr(self);
+            if(arg_count < FUNCTION_MAX_ARGS) args[arg_count] = arg;
+            arg_count += 1;
+        }
+        while(!parser_is_at_end(self) && parser_match(self, TOKEN_COMMA));
+        
+        if(!parser_match(self, TOKEN_PAREN_R))
+        {
+            self->spans_paused -= 1;
+            self->has_failed = true;
+            fprintf(stderr, "Expected ')' at end of function call\n");
+            return -1;
+        }
+    }
+    self->spans_paused -= 1;
+    
+    Function *function = FunctionTable_Get(self->functions, function_idx);
+    if(arg_count != function->arity)
+    {
+        self->has_failed = true;
+        fprintf(stderr, "Function '%s' expects %d arguments but got %d\n", function->name, function->arity, arg_count);
+        return -1;
+    }
+    return parser_add_call(self, function_idx, args, arg_count);
+}
+
+// Definitions look like "name(a, b) = expr".
+bool parser_is_at_definition(Parser *self)
+{
+    if(TokenList_Length(self->tokens) < 2) return false;
+    if(parser_peek_at(self, 0).type != TOKEN_IDENTIFIER || parser_peek_at(self, 1).type != TOKEN_PAREN_L) return false;
+    for(int i = 2; i < TokenList_Length(self->tokens); ++i)
+    {
+        if(TokenList_Get(self->tokens, i).type == TOKEN_ASSIGN) return true;
+    }
+    return false;
+}
+
+// Parses a function definition and stores it in the parser's function table. The parser's ExprList must be the one
+// owned by the function table. Returns the index of the defined function, or -1 on failure. A parameter can be given a
+// range as in "f(0 <= x <= 100) = ...", which the range analysis can then rely on.
+int parser_parse_definition(Parser *self)
+{
+    Token name = parser_advance(self);
+    parser_match(self, TOKEN_PAREN_L);
+    self->param_count = 0;
+    int param_min[FUNCTION_MAX_ARGS], param_max[FUNCTION_MAX_ARGS];
+    bool has_range[FUNCTION_MAX_ARGS] = {false};
+    if(!parser_match(self, TOKEN_PAREN_R))
+    {
+        do
+        {
+            int lo = INT_MIN, hi = INT_MAX;
+            bool is_ranged = parser_peek(self).type == TOKEN_LITERAL_NUMBER || parser_peek(self).type == TOKEN_OP_MINUS;
+            if(is_ranged && (!parser_parse_bound(self, &lo) || !parser_match(self, TOKEN_OP_LE)))
+            {
+                self->has_failed = true;
+                fprintf(stderr, "Expected '<=' after the lower bound of a parameter\n");
+                return -1;
+            }
+            Token param = parser_advance(self);
+            if(param.type != TOKEN_IDENTIFIER || self->param_count >= FUNCTION_MAX_ARGS)
+            {
+                self->has_failed = true;
+                fprintf(stderr, "Expected at most %d parameter names in function definition\n", FUNCTION_MAX_ARGS);
+                return -1;
+            }
+            if(is_ranged && (!parser_match(self, TOKEN_OP_LE) || !parser_parse_bound(self, &hi) || lo > hi))
+            {
+                self->has_failed = true;
+                fprintf(stderr, "Expected a non empty range as in '0 <= %.*s <= 100'\n", param.length, self->source + param.start);
+                return -1;
+            }
+            param_min[self->param_count] = lo;
+            param_max[self->param_count] = hi;
+            has_range[self->param_count] = is_ranged;
+            self->params[self->param_count++] = param;
+        }
+        while(!parser_is_at_end(self) && parser_match(self, TOKEN_COMMA));
+        
+        if(!parser_match(self, TOKEN_PAREN_R))
+        {
+            self->has_failed = true;
+            fprintf(stderr, "Expected ')' at end of parameter list\n");
+            return -1;
+        }
+    }
+    if(!parser_match(self, TOKEN_ASSIGN))
+    {
+        self->has_failed = true;
+        fprintf(stderr, "Expected '=' after parameter list\n");
+        return -1;
+    }
+    
+    char const *name_str = self->source + name.start;
+    int function_idx = FunctionTable_Find(self->functions, name_str, name.length);
+    int old_body = -1;
+    if(function_idx >= 0)
+    {
+        // Calls that were not inlined refer to the function by index, so a redefinition must keep the same signature.
+        Function *function = FunctionTable_Get(self->functions, function_idx);
+        if(function->native)
+        {
+            self->has_failed = true;
+            fprintf(stderr, "Function '%s' is native and can't be redefined\n", function->name);
+            return -1;
+        }
+        if(function->arity != self->param_count)
+        {
+            self->has_failed = true;
+            fprintf(stderr, "Function '%s' can't be redefined with a different signature\n", function->name);
+            return -1;
+        }
+        if(function->is_inlined)
+        {
+            self->has_failed = true;
+            fprintf(stderr, "Function '%s' can't be redefined, it was inlined into other functions\n", function->name);
+            return -1;
+        }
+        old_body = function->body;
+    }
+    else
+    {
+        function_idx = FunctionTable_Add(self->functions, name_str, name.length, self->param_count, NULL);
+        if(function_idx < 0)
+        {
+            self->has_failed = true;
+            fprintf(stderr, "Could not add function '%.*s'\n", name.length, name_str);
+            return -1;
+        }
+    }
+    
+    // The body is parsed into the function table's ExprList, right after everything that's already in there.
+    int begin = ExprList_Length(self->exprs), doubles_begin = self->exprs->doubles_len;
+    FunctionTable_Get(self->functions, function_idx)->body = -1; // Recursive calls within the body can't be inlined.
+    int body = parser_parse_expr(self);
+    if(!self->has_failed && !parser_is_at_end(self))
+    {
+        self->has_failed = true;
+        fprintf(stderr, "Unexpected token after function body (%s)\n", TokenTypeName[parser_peek(self).type]);
+    }
+    
+    Function *function = FunctionTable_Get(self->functions, function_idx);
+    if(self->has_failed)
+    {
+        if(old_body < 0 && function_idx == FunctionTable_Length(self->functions) - 1) self->functions->len -= 1;
+        else function->body = old_body;
+        self->exprs->len = begin;
+        self->exprs->doubles_len = doubles_begin;
+        return -1;
+    }
+    
+    // Calls to the old body were either inlined into expressions, which copied it, or refer to the function by index, so
+    // nothing points into it anymore and it can be removed. That keeps the table from growing when formulas are
+    // redefined over and over.
+    Function old = *function;
+    function->body = body;
+    function->body_begin = begin;
+    function->body_end = ExprList_Length(self->exprs);
+    function->doubles_begin = doubles_begin;
+    function->doubles_end = self->exprs->doubles_len;
+    if(old_body >= 0) function_table_remove_body(self->functions, old.body_begin, old.body_end, old.doubles_begin, old.doubles_end);
+    body = function->body;
+    memset(function->param_uses, 0, sizeof(function->param_uses));
+    function_count_param_uses(self->exprs, body, function->param_uses);
+    function_clear_ranges(function);
+    for(int i = 0; i < self->param_count; ++i)
+    {
+        if(has_range[i]) function_declare_range(function, i, param_min[i], param_max[i]);
+    }
+    return function_idx;
+}
+
+// Parses an integer literal, optionally negated, as used in the parameter ranges of a function definition. Errors are
+// reported by the caller.
+bool parser_parse_bound(Parser *self, int *value)
+{
+    bool is_negative = parser_match(self, TOKEN_OP_MINUS);
+    Token token = parser_advance(self);
+    if(token.type != TOKEN_LITERAL_NUMBER) return false;
+    *value = is_negative ? evaluator_wrap_sub(0, token.value) : token.value;
+    return true;
 }
 
 #endif
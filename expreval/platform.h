@@ -0,0 +1,16 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+// Feature test macros for the POSIX and Linux functions used outside of the core parser, like getline(),
+// clock_gettime() or the mmap() flags. They only have an effect when they're defined before the first std include of a
+// program, so headers that need them include this one before anything else, and so must programs that include std
+// headers of their own before the project ones.
+//
+// _DEFAULT_SOURCE is what the compiler defines when no -std flag is given, so building with -std=c11 gets the same
+// declarations as the default gnu mode.
+
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#endif
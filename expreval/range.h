@@ -0,0 +1,244 @@
+#ifndef RANGE_H
+#define RANGE_H
+
+// Includes from std
+#include <limits.h>
+#include <stdbool.h>
+
+// Includes from project
+#include "expr.h"
+#include "exprlist.h"
+#include "functions.h"
+
+// Interval analysis of compiled expressions. Every node gets the range of values it can evaluate to, computed bottom
+// up from the literals and the declared ranges of the function parameters. A negation, "+", "-", "*" or "/" (binary or
+// a step of a chain) whose result is proven to fit in an int, and that can't divide by zero, is replaced with its
+// unchecked version, which a checked Evaluator then runs without any overflow or division guard.
+//
+// Ranges are kept in long long so that the sum, difference and product of two int ranges never overflow. An operation
+// that can't be proven safe makes its result range unknown (the full int range), which keeps the analysis sound for
+// evaluators that wrap around as well as for those that fail.
+//
+// The analysis never adds nodes, so it can be run again on the same tree. Every operation is decided anew each time.
+
+typedef struct {
+	long long lo, hi; // Inclusive.
+} ValueRange;
+
+typedef struct {
+	ExprList *exprs;
+	FunctionTable *functions; // Can be NULL if there are no calls.
+	ValueRange params[FUNCTION_MAX_ARGS]; // Ranges of the parameters of the function body being analyzed.
+	int check_count; // Checked operations found by the last run.
+	int removed_count; // How many of them were proven safe and made unchecked.
+} RangeAnalysis;
+
+// Forward declarations
+void RangeAnalysis_Init(RangeAnalysis*, ExprList*, FunctionTable*);
+void RangeAnalysis_Free(RangeAnalysis*);
+
+ValueRange value_range(long long, long long);
+ValueRange value_range_full(void);
+ValueRange value_range_union(ValueRange, ValueRange);
+bool value_range_fits(ValueRange);
+
+ValueRange range_analysis_run(RangeAnalysis*, int);
+ValueRange range_analysis_function(RangeAnalysis*, int);
+ValueRange range_analysis_node(RangeAnalysis*, int);
+ValueRange range_analysis_call(RangeAnalysis*, Expr*);
+ValueRange range_analysis_chain(RangeAnalysis*, Expr*);
+ValueRange range_analysis_apply(int, ValueRange, ValueRange, bool*);
+
+// Implementation
+
+void RangeAnalysis_Init(RangeAnalysis *self, ExprList *exprs, FunctionTable *functions)
+{
+	self->exprs = exprs;
+	self->functions = functions;
+	for(int i = 0; i < FUNCTION_MAX_ARGS; ++i) self->params[i] = value_range_full();
+	self->check_count = 0;
+	self->removed_count = 0;
+}
+
+void RangeAnalysis_Free(RangeAnalysis *self)
+{
+	self->exprs = NULL;
+	self->functions = NULL;
+	self->check_count = 0;
+	self->removed_count = 0;
+}
+
+ValueRange value_range(long long lo, long long hi)
+{
+    ValueRange ans = {lo, hi};
+    return ans;
+}
+
+ValueRange value_range_full(void)
+{
+    return value_range(INT_MIN, INT_MAX);
+}
+
+ValueRange value_range_union(ValueRange a, ValueRange b)
+{
+    return value_range(a.lo < b.lo ? a.lo : b.lo, a.hi > b.hi ? a.hi : b.hi);
+}
+
+bool value_range_fits(ValueRange a)
+{
+    return a.lo >= INT_MIN && a.hi <= INT_MAX;
+}
+
+// Analyzes the tree rooted at root, which must not be a function body (see range_analysis_function()), and returns the
+// range of its value. The counts are those of this tree alone.
+ValueRange range_analysis_run(RangeAnalysis *self, int root)
+{
+    self->check_count = 0;
+    self->removed_count = 0;
+    return range_analysis_node(self, root);
+}
+
+// Analyzes the body of a user function, assuming its parameters are in their declared ranges. Calls to the function
+// check the ranges of their arguments, so the body can rely on them.
+ValueRange range_analysis_function(RangeAnalysis *self, int function_idx)
+{
+    self->check_count = 0;
+    self->removed_count = 0;
+    Function *function = FunctionTable_Get(self->functions, function_idx);
+    if(function->native || function->body < 0) return value_range_full();
+
+    for(int i = 0; i < FUNCTION_MAX_ARGS; ++i) self->params[i] = value_range(function->param_min[i], function->param_max[i]);
+    ExprList *exprs = self->exprs;
+    self->exprs = &self->functions->exprs;
+    ValueRange ans = range_analysis_node(self, function->body);
+    self->exprs = exprs;
+    for(int i = 0; i < FUNCTION_MAX_ARGS; ++i) self->params[i] = value_range_full();
+    return ans;
+}
+
+// Returns the range of op applied to values in a and b, and whether the operation can neither overflow nor divide by
+// zero. op must be a checked operation.
+ValueRange range_analysis_apply(int op, ValueRange a, ValueRange b, bool *is_safe)
+{
+    ValueRange ans;
+    switch(op)
+    {
+        case EXPR_ADD: ans = value_range(a.lo + b.lo, a.hi + b.hi); break;
+        case EXPR_SUB: ans = value_range(a.lo - b.hi, a.hi - b.lo); break;
+        case EXPR_MUL: case EXPR_DIV: {
+            if(op == EXPR_DIV && b.lo <= 0 && b.hi >= 0)
+            {
+                // Whatever doesn't trap is truncated towards 0, so it's at most as far from 0 as the dividend.
+                long long m = -a.lo > a.hi ? -a.lo : a.hi;
+                *is_safe = false;
+                return m <= INT_MAX ? value_range(-m, m) : value_range_full();
+            }
+            // Both are monotonic in each operand as long as the divisor doesn't change sign, so the extremes are at
+            // the corners.
+            long long corners[4] = {a.lo, a.lo, a.hi, a.hi};
+            long long divisors[4] = {b.lo, b.hi, b.lo, b.hi};
+            for(int i = 0; i < 4; ++i) corners[i] = op == EXPR_MUL ? corners[i] * divisors[i] : corners[i] / divisors[i];
+            ans = value_range(corners[0], corners[0]);
+            for(int i = 1; i < 4; ++i) ans = value_range_union(ans, value_range(corners[i], corners[i]));
+        } break;
+        default: {
+            *is_safe = false;
+            return value_range_full();
+        }
+    }
+    *is_safe = value_range_fits(ans); // INT_MIN / -1 is the only division that doesn't fit.
+    return *is_safe ? ans : value_range_full();
+}
+
+ValueRange range_analysis_node(RangeAnalysis *self, int idx)
+{
+    Expr *expr = ExprList_Get(self->exprs, idx);
+    int type = expr_checked_type(expr->type);
+    switch(type)
+    {
+        case EXPR_LITERAL: return value_range(expr->value, expr->value);
+        case EXPR_PARAM: return self->params[expr->value];
+
+        case EXPR_NEG: case EXPR_ADD: case EXPR_SUB: case EXPR_MUL: case EXPR_DIV: {
+            ValueRange l = range_analysis_node(self, expr->lhs);
+            bool is_safe;
+            ValueRange ans = type == EXPR_NEG
+                ? range_analysis_apply(EXPR_SUB, value_range(0, 0), l, &is_safe)
+                : range_analysis_apply(type, l, range_analysis_node(self, expr->rhs), &is_safe);
+            expr->type = is_safe ? expr_unchecked_type(type) : type;
+            self->check_count += 1;
+            self->removed_count += is_safe;
+            return ans;
+        }
+
+        case EXPR_LT: case EXPR_LE: case EXPR_GT: case EXPR_GE: case EXPR_EQ: case EXPR_NE:
+        case EXPR_AND: case EXPR_OR: case EXPR_AND_EAGER: case EXPR_OR_EAGER: {
+            range_analysis_node(self, expr->lhs);
+            range_analysis_node(self, expr->rhs);
+            return value_range(0, 1);
+        }
+        case EXPR_TERNARY: case EXPR_SELECT: {
+            range_analysis_node(self, expr->cond);
+            ValueRange l = range_analysis_node(self, expr->lhs);
+            return value_range_union(l, range_analysis_node(self, expr->rhs));
+        }
+
+        case EXPR_CALL: return range_analysis_call(self, expr);
+        case EXPR_SUM: case EXPR_PRODUCT: return range_analysis_chain(self, expr);
+        case EXPR_CHAIN: {
+            for(int operand = expr->lhs; operand >= 0; operand = ExprList_Get(self->exprs, operand)->rhs)
+            {
+                range_analysis_node(self, ExprList_Get(self->exprs, operand)->lhs);
+            }
+            return value_range(0, 1);
+        }
+        default: return value_range_full();
+    }
+}
+
+// The builtins get the range of their result, any other function is unknown. User function bodies are analyzed on
+// their own, by range_analysis_function().
+ValueRange range_analysis_call(RangeAnalysis *self, Expr *expr)
+{
+    ValueRange args[FUNCTION_MAX_ARGS];
+    int arg_count = 0;
+    int function_idx = expr->value;
+    for(int idx = expr->lhs; idx >= 0; idx = ExprList_Get(self->exprs, idx)->rhs)
+    {
+        args[arg_count++] = range_analysis_node(self, ExprList_Get(self->exprs, idx)->lhs);
+    }
+    NativeFunction native = FunctionTable_Get(self->functions, function_idx)->native;
+    if(native == builtin_min) return value_range(args[0].lo < args[1].lo ? args[0].lo : args[1].lo, args[0].hi < args[1].hi ? args[0].hi : args[1].hi);
+    if(native == builtin_max) return value_range(args[0].lo > args[1].lo ? args[0].lo : args[1].lo, args[0].hi > args[1].hi ? args[0].hi : args[1].hi);
+    if(native == builtin_clamp) return value_range_union(args[0], value_range_union(args[1], args[2]));
+    if(native == builtin_abs && args[0].lo > INT_MIN)
+    {
+        long long hi = -args[0].lo > args[0].hi ? -args[0].lo : args[0].hi;
+        long long lo = args[0].lo >= 0 ? args[0].lo : args[0].hi <= 0 ? -args[0].hi : 0;
+        return value_range(lo, hi);
+    }
+    return value_range_full();
+}
+
+// Chains are folded left to right by a checked evaluator, so every step is decided on the range of the partial result
+// before it. The first operand has no operation of its own.
+ValueRange range_analysis_chain(RangeAnalysis *self, Expr *expr)
+{
+    int first = expr->lhs;
+    int count = expr->value;
+    ValueRange ans = range_analysis_node(self, ExprList_Get(self->exprs, first)->lhs);
+    for(int i = 1; i < count; ++i)
+    {
+        ValueRange v = range_analysis_node(self, ExprList_Get(self->exprs, first + i)->lhs);
+        Expr *operand = ExprList_Get(self->exprs, first + i);
+        int op = expr_checked_type(operand->value);
+        bool is_safe;
+        ans = range_analysis_apply(op, ans, v, &is_safe);
+        operand->value = is_safe ? expr_unchecked_type(op) : op;
+        self->check_count += 1;
+        self->removed_count += is_safe;
+    }
+    return ans;
+}
+
+#endif
@@ -1,6 +1,9 @@
 #ifndef SCANNER_H
 #define SCANNER_H
 
+// Feature test macros, for the clock_gettime() of governor.h
+#include "platform.h"
+
 // Includes from std
 #include <stdio.h>
 #include <string.h>
@@ -9,6 +12,8 @@
 // Includes from project
 #include "token.h"
 #include "tokenlist.h"
+#include "governor.h"
+#include "doubleparse.h"
 
 // Defines
 #define SCANNER_CHARS_WHITESPACE_BUF " \t\r\n\v"
@@ -22,17 +27,26 @@ typedef struct {
 	int start;
 	TokenList *tokens;
 	bool has_failed;
+	bool is_quiet; // Don't print errors, only set has_failed.
+	Governor *governor; // Can be NULL. When set, input size and token count are limited.
+	bool is_double; // Number literals can have a fraction and an exponent ("1.5e-3", ".5"). Their token value is 0.
 } Scanner;
 
 // Forward Declarations
 void Scanner_Init(Scanner*, TokenList*, char const*);
+void Scanner_InitRange(Scanner*, TokenList*, char const*, int, int);
 void Scanner_Free(Scanner*);
 
 void scanner_scan(Scanner*);
 void scanner_scan_token(Scanner*);
+void scanner_scan_pair(Scanner*, char, int, char);
+void scanner_report_unknown_char(Scanner*, char);
 
 bool scanner_is_whitespace(char);
 bool scanner_is_number(char);
+bool scanner_is_identifier_start(char);
+bool scanner_is_identifier(char);
+void scanner_scan_identifier(Scanner*);
 int scanner_get_number_from_source(char const*, int, int);
 void scanner_scan_number(Scanner*);
 
@@ -42,6 +56,7 @@ char scanner_peek_at(Scanner*, int);
 char scanner_peek(Scanner*);
 char scanner_peek_previous(Scanner*);
 char scanner_peek_next(Scanner*);
+bool scanner_match(Scanner*, char);
 
 void scanner_add_token(Scanner*, int, int);
 
@@ -54,6 +69,23 @@ void Scanner_Init(Scanner *self, TokenList *token_list, char const *src)
 	self->start = 0;
 	self->tokens = token_list;
 	self->has_failed = false;
+	self->is_quiet = false;
+	self->governor = NULL;
+	self->is_double = false;
+}
+
+// Scans only the chars in [begin, end) of src. Token locations are still relative to the start of src.
+void Scanner_InitRange(Scanner *self, TokenList *token_list, char const *src, int begin, int end)
+{
+	self->source = src;
+	self->source_length = end;
+	self->current = begin;
+	self->start = begin;
+	self->tokens = token_list;
+	self->has_failed = false;
+	self->is_quiet = false;
+	self->governor = NULL;
+	self->is_double = false;
 }
 
 void Scanner_Free(Scanner *self)
@@ -64,12 +96,21 @@ void Scanner_Free(Scanner *self)
 	self->start = 0;
 	self->tokens = NULL;
 	self->has_failed = false;
+	self->is_quiet = false;
+	self->governor = NULL;
+	self->is_double = false;
 }
 
 void scanner_add_token(Scanner *self, int type, int value)
 {
     // printf("%s, %d\n", TokenTypeName[type], value);
-	TokenList_Add(self->tokens, (Token){type, value});
+	if(self->governor && !governor_check_tokens(self->governor, TokenList_Length(self->tokens) + 1))
+	{
+		self->has_failed = true;
+		self->current = self->source_length; // Stop scanning.
+		return;
+	}
+	TokenList_Add(self->tokens, (Token){type, value, self->start, self->current - self->start});
 }
 
 bool scanner_is_at_end(Scanner *self)
@@ -80,6 +121,11 @@ bool scanner_is_at_end(Scanner *self)
 
 void scanner_scan(Scanner *self)
 {
+    if(self->governor && !governor_check_input(self->governor, self->source_length - self->current))
+    {
+        self->has_failed = true;
+        return;
+    }
     while(!scanner_is_at_end(self))
     {
         self->start = self->current;
@@ -116,11 +162,31 @@ char scanner_peek_next(Scanner *self)
 	return scanner_peek_at(self, 1);
 }
 
+bool scanner_match(Scanner *self, char c)
+{
+    if(!scanner_is_at_end(self) && scanner_peek(self) == c)
+    {
+        self->current++;
+        return true;
+    }
+    return false;
+}
+
 bool scanner_is_number(char c)
 {
     return c >= '0' && c <= '9';
 }
 
+bool scanner_is_identifier_start(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+bool scanner_is_identifier(char c)
+{
+    return scanner_is_identifier_start(c) || scanner_is_number(c);
+}
+
 bool scanner_is_whitespace(char c)
 {
     for(int i = 0; i < SCANNER_CHARS_WHITESPACE_LEN; ++i)
@@ -133,6 +199,24 @@ bool scanner_is_whitespace(char c)
     return false;
 }
 
+void scanner_report_unknown_char(Scanner *self, char c)
+{
+    if(!self->is_quiet) fprintf(stderr, "Unknown char '%c' found in sequence!\n", c);
+	self->has_failed = true;
+}
+
+void scanner_scan_pair(Scanner *self, char second, int type, char first)
+{
+    if(scanner_match(self, second))
+    {
+        scanner_add_token(self, type, 0);
+    }
+    else
+    {
+        scanner_report_unknown_char(self, first);
+    }
+}
+
 void scanner_scan_token(Scanner *self)
 {
     char c = scanner_advance(self);
@@ -144,6 +228,20 @@ void scanner_scan_token(Scanner *self)
         case '-': scanner_add_token(self, TOKEN_OP_MINUS, 0); break;
         case '*': scanner_add_token(self, TOKEN_OP_STAR, 0); break;
         case '/': scanner_add_token(self, TOKEN_OP_SLASH, 0); break;
+        case '?': scanner_add_token(self, TOKEN_QUESTION, 0); break;
+        case ':': scanner_add_token(self, TOKEN_COLON, 0); break;
+        case ',': scanner_add_token(self, TOKEN_COMMA, 0); break;
+        case '=': scanner_add_token(self, scanner_match(self, '=') ? TOKEN_OP_EQ : TOKEN_ASSIGN, 0); break;
+        case '<': scanner_add_token(self, scanner_match(self, '=') ? TOKEN_OP_LE : TOKEN_OP_LT, 0); break;
+        case '>': scanner_add_token(self, scanner_match(self, '=') ? TOKEN_OP_GE : TOKEN_OP_GT, 0); break;
+        // These are only valid as the first char of a two char operator, so a lone '!', '&' or '|' is an unknown char.
+        case '!': scanner_scan_pair(self, '=', TOKEN_OP_NE, c); break;
+        case '&': scanner_scan_pair(self, '&', TOKEN_OP_AND, c); break;
+        case '|': scanner_scan_pair(self, '|', TOKEN_OP_OR, c); break;
+        case '.':
+            if(self->is_double && !scanner_is_at_end(self) && scanner_is_number(scanner_peek(self))) scanner_scan_number(self);
+            else scanner_report_unknown_char(self, c);
+            break;
         default:
             if(scanner_is_whitespace(c))
             {
@@ -156,9 +254,13 @@ void scanner_scan_token(Scanner *self)
                 scanner_scan_number(self);
             }
             else
+            if(scanner_is_identifier_start(c))
+            {
+                scanner_scan_identifier(self);
+            }
+            else
             {
-                fprintf(stderr, "Unknown char '%c' found in sequence!\n", c);
-				self->has_failed = true;
+                scanner_report_unknown_char(self, c);
             }
             break;
     }
@@ -167,19 +269,32 @@ void scanner_scan_token(Scanner *self)
 int scanner_get_number_from_source(char const *source, int idx_start, int idx_end)
 {
     // printf("scanning integer from %d to %d\n", idx_start, idx_end);
-    int ans = 0;
+    unsigned int ans = 0; // Literals that don't fit wrap around, same as the arithmetic does.
     for(int i = idx_start; i <= idx_end; ++i)
     {
         ans *= 10;
         ans += source[i] - '0';
     }
-    return ans;
+    return (int)ans;
 }
 
 void scanner_scan_number(Scanner *self)
 {
+    if(self->is_double)
+    {
+        // The parser reads the value back from the source, see double_parse().
+        self->current = self->start + double_parse_length(self->source + self->start, self->source_length - self->start);
+        scanner_add_token(self, TOKEN_LITERAL_NUMBER, 0);
+        return;
+    }
     while(!scanner_is_at_end(self) && scanner_is_number(scanner_peek(self))){scanner_advance(self);}
     scanner_add_token(self, TOKEN_LITERAL_NUMBER, scanner_get_number_from_source(self->source, self->start, self->current - 1));
 }
 
+void scanner_scan_identifier(Scanner *self)
+{
+    while(!scanner_is_at_end(self) && scanner_is_identifier(scanner_peek(self))){scanner_advance(self);}
+    scanner_add_token(self, TOKEN_IDENTIFIER, 0); // The name is read back from the source through the token's start and length.
+}
+
 #endif
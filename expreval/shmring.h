@@ -0,0 +1,649 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+// Feature test macros, for shm_open(), ftruncate() and MAP_ANONYMOUS
+#include "platform.h"
+
+// Includes from std
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// Includes from system (Linux only, futexes)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// Includes from project
+#include "token.h"
+#include "tokenlist.h"
+#include "scanner.h"
+#include "parser.h"
+#include "exprlist.h"
+#include "functions.h"
+#include "evaluator.h"
+#include "governor.h"
+
+// IPC for producers running on the same host as the evaluator. A shared memory segment holds two lock-free bounded
+// queues: a submission queue of fixed size expression slots, and a result queue going back the other way. Both are
+// multi-producer / multi-consumer (every cell has a sequence number, like in Dmitry Vyukov's bounded MPMC queue),
+// which covers the SPSC and MPSC setups: any number of producer processes, one evaluator.
+//
+// Producers write expressions straight into the slots, and the evaluator scans and parses them right there, so the
+// text is never copied once it's in the segment. Results carry the id the producer gave to the expression, since they
+// come back in completion order.
+//
+// Nobody blocks in the kernel while there's work: waiting first spins on the queue for a while, and only then sleeps
+// on a futex in the segment. The spin budget adapts to how long waits usually are, it doubles every time spinning was
+// enough and halves every time we had to sleep. Signalling only does a syscall when somebody is actually sleeping.
+//
+// The segment only contains offsets, never pointers, since every process maps it at a different address. Any process
+// that maps it can write anything anywhere in it, so the layout of the queues is never read back from it: every
+// process computes it from the slot count and size at Init / Attach, checks that it matches the size of the mapping,
+// and keeps it in its own ShmRing.
+
+// Defines
+#define SHM_RING_MAGIC 0x45585052u // "EXPR"
+#define SHM_RING_CACHE_LINE 64
+
+#ifndef SHM_RING_MIN_SPIN
+#define SHM_RING_MIN_SPIN 16
+#endif
+
+#ifndef SHM_RING_MAX_SPIN
+#define SHM_RING_MAX_SPIN 16384
+#endif
+
+#ifndef SHM_RING_NAME_MAX
+#define SHM_RING_NAME_MAX 64
+#endif
+
+#define SHM_RING_MAX_SLOT_COUNT (1u << 30)
+#define SHM_RING_MAX_SLOT_SIZE (INT_MAX / 2) // Slot lengths are ints, and cells must fit in a uint32_t.
+
+enum ShmRingStatus
+{
+    SHM_RING_OK = 0,
+    SHM_RING_ERROR_SCAN,
+    SHM_RING_ERROR_PARSE,
+    SHM_RING_ERROR_EVAL,
+    SHM_RING_ERROR_LIMIT, // The evaluator's Governor rejected it, see ShmRingResult.limit.
+    SHM_RING_ERROR_LENGTH, // The slot's length was negative or over the ring's slot_size.
+    SHM_RING_STATUS_COUNT,
+};
+
+static char const * const ShmRingStatusName[] = {
+    "SHM_RING_OK",
+    "SHM_RING_ERROR_SCAN",
+    "SHM_RING_ERROR_PARSE",
+    "SHM_RING_ERROR_EVAL",
+    "SHM_RING_ERROR_LIMIT",
+    "SHM_RING_ERROR_LENGTH",
+    "SHM_RING_STATUS_COUNT",
+};
+
+typedef struct {
+	_Atomic uint32_t seq; // Bumped on every signal. This is the futex word.
+	_Atomic uint32_t waiters;
+} ShmRingEvent;
+
+typedef struct {
+	_Alignas(SHM_RING_CACHE_LINE) _Atomic uint64_t push_pos;
+	_Alignas(SHM_RING_CACHE_LINE) _Atomic uint64_t pop_pos;
+	_Alignas(SHM_RING_CACHE_LINE) ShmRingEvent pushed; // Signalled when a cell is filled.
+	_Alignas(SHM_RING_CACHE_LINE) ShmRingEvent popped; // Signalled when a cell is freed.
+	uint32_t mask; // The layout is stored for debugging only, see ShmRingQueueView.
+	uint32_t cell_size;
+	uint64_t cells_offset; // From the start of the segment.
+} ShmRingQueue;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t slot_count;
+	uint32_t slot_size; // Max length of an expression.
+	_Atomic uint32_t is_closed;
+	uint64_t size;
+	ShmRingQueue submissions;
+	ShmRingQueue results;
+} ShmRingHeader;
+
+// Every cell starts with its sequence number. A cell at position pos is free when seq == pos, and filled when
+// seq == pos + 1. Freeing it sets seq to the position it will have on the next lap.
+typedef struct {
+	_Atomic uint64_t seq;
+	uint64_t id;
+	int length;
+	char text[]; // slot_size bytes, not null terminated.
+} ShmRingSlot;
+
+typedef struct {
+	_Atomic uint64_t seq;
+	uint64_t id;
+	int value;
+	int status; // ShmRingStatus
+	int limit; // GovernorError, when status is SHM_RING_ERROR_LIMIT.
+} ShmRingResult;
+
+// Process local layout of a queue, the cells are only ever found through it.
+typedef struct {
+	ShmRingQueue *shared;
+	uint32_t mask;
+	uint32_t cell_size;
+	uint64_t cells_offset; // From the start of the segment.
+} ShmRingQueueView;
+
+typedef void *(*ShmRingTryClaim)(void*, ShmRingQueueView*, uint64_t*);
+
+// Process local handle to a segment.
+typedef struct {
+	ShmRingHeader *header;
+	size_t size;
+	uint32_t slot_size;
+	ShmRingQueueView submissions;
+	ShmRingQueueView results;
+	char name[SHM_RING_NAME_MAX]; // Empty for anonymous segments.
+	bool is_owner; // The owner unlinks the segment when it's done.
+	int spin_limit; // Current spin budget of the adaptive waits.
+} ShmRing;
+
+// Forward declarations
+bool ShmRing_Init(ShmRing*, char const*, int, int);
+bool ShmRing_Attach(ShmRing*, char const*);
+void ShmRing_Free(ShmRing*);
+
+size_t shm_ring_layout(ShmRing*, uint32_t, uint32_t);
+void shm_ring_queue_init(ShmRing*, ShmRingQueueView*);
+void *shm_ring_queue_cell(ShmRing*, ShmRingQueueView*, uint64_t);
+void *shm_ring_queue_try_claim_push(void*, ShmRingQueueView*, uint64_t*);
+void *shm_ring_queue_try_claim_pop(void*, ShmRingQueueView*, uint64_t*);
+void shm_ring_queue_commit_push(ShmRingQueueView*, void*, uint64_t);
+void shm_ring_queue_commit_pop(ShmRingQueueView*, void*, uint64_t);
+void *shm_ring_queue_claim(ShmRing*, ShmRingQueueView*, ShmRingTryClaim, ShmRingEvent*, uint64_t*);
+
+void shm_ring_event_signal(ShmRingEvent*);
+void shm_ring_event_wait(ShmRingEvent*, uint32_t);
+
+ShmRingSlot *shm_ring_begin_submit(ShmRing*, uint64_t*);
+void shm_ring_end_submit(ShmRing*, ShmRingSlot*, uint64_t);
+bool shm_ring_submit(ShmRing*, char const*, int, uint64_t);
+bool shm_ring_wait_result(ShmRing*, ShmRingResult*);
+void shm_ring_close(ShmRing*);
+bool shm_ring_is_closed(ShmRing*);
+
+void shm_ring_eval_slot(ShmRingSlot*, uint32_t, ShmRingResult*, TokenList*, ExprList*, FunctionTable*, Governor*);
+long long shm_ring_serve(ShmRing*, FunctionTable*, Governor*);
+
+// Implementation
+
+static inline void shm_ring_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static inline size_t shm_ring_align(size_t size)
+{
+    return (size + SHM_RING_CACHE_LINE - 1) & ~(size_t)(SHM_RING_CACHE_LINE - 1);
+}
+
+// Lays out the queues of a segment of slot_count slots of slot_size bytes in the views of self, and returns the size of
+// the segment. Returns 0 if slot_count is not a power of 2, or if either of them is over its max.
+size_t shm_ring_layout(ShmRing *self, uint32_t slot_count, uint32_t slot_size)
+{
+    if(slot_count == 0 || (slot_count & (slot_count - 1)) != 0 || slot_count > SHM_RING_MAX_SLOT_COUNT) return 0;
+    if(slot_size > SHM_RING_MAX_SLOT_SIZE) return 0;
+    uint64_t header_size = shm_ring_align(sizeof(ShmRingHeader));
+    uint64_t slot_cell = shm_ring_align(sizeof(ShmRingSlot) + (size_t)slot_size);
+    uint64_t result_cell = shm_ring_align(sizeof(ShmRingResult));
+    uint64_t size = header_size + slot_count * (slot_cell + result_cell); // Can't overflow with the max above.
+    if((size_t)size != size) return 0;
+
+    self->slot_size = slot_size;
+    self->submissions.mask = slot_count - 1;
+    self->submissions.cell_size = (uint32_t)slot_cell;
+    self->submissions.cells_offset = header_size;
+    self->results.mask = slot_count - 1;
+    self->results.cell_size = (uint32_t)result_cell;
+    self->results.cells_offset = header_size + slot_count * slot_cell;
+    return (size_t)size;
+}
+
+void shm_ring_queue_init(ShmRing *self, ShmRingQueueView *view)
+{
+    ShmRingQueue *queue = view->shared;
+    atomic_init(&queue->push_pos, 0);
+    atomic_init(&queue->pop_pos, 0);
+    atomic_init(&queue->pushed.seq, 0);
+    atomic_init(&queue->pushed.waiters, 0);
+    atomic_init(&queue->popped.seq, 0);
+    atomic_init(&queue->popped.waiters, 0);
+    queue->mask = view->mask;
+    queue->cell_size = view->cell_size;
+    queue->cells_offset = view->cells_offset;
+    for(uint64_t i = 0; i <= view->mask; ++i)
+    {
+        atomic_init((_Atomic uint64_t*)shm_ring_queue_cell(self, view, i), i);
+    }
+}
+
+// Creates a segment with room for slot_count expressions of up to slot_size bytes each. slot_count is rounded up to a
+// power of 2. With a NULL name the segment is anonymous, which is only useful to share it with forked children.
+bool ShmRing_Init(ShmRing *self, char const *name, int slot_count, int slot_size)
+{
+	self->header = NULL;
+	self->size = 0;
+	self->name[0] = '\0';
+	self->is_owner = true;
+	self->spin_limit = SHM_RING_MIN_SPIN;
+
+	if(slot_count > (int)SHM_RING_MAX_SLOT_COUNT || slot_size < 0) return false;
+	uint32_t count = 1;
+	while(count < (uint32_t)slot_count) count *= 2;
+	size_t size = shm_ring_layout(self, count, (uint32_t)slot_size);
+	if(size == 0) return false;
+
+	int fd = -1;
+	if(name)
+	{
+		if(strlen(name) >= SHM_RING_NAME_MAX) return false;
+		fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+		if(fd < 0) return false;
+		if(ftruncate(fd, (off_t)size) != 0)
+		{
+			close(fd);
+			shm_unlink(name);
+			return false;
+		}
+		strcpy(self->name, name);
+	}
+	void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | (name ? 0 : MAP_ANONYMOUS), fd, 0);
+	if(fd >= 0) close(fd);
+	if(mem == MAP_FAILED)
+	{
+		if(name) shm_unlink(name);
+		self->name[0] = '\0';
+		return false;
+	}
+
+	// The memory is zeroed by the kernel, so only the non zero fields need to be set.
+	ShmRingHeader *header = (ShmRingHeader*)mem;
+	self->header = header;
+	self->size = size;
+	self->submissions.shared = &header->submissions;
+	self->results.shared = &header->results;
+	header->slot_count = count;
+	header->slot_size = (uint32_t)slot_size;
+	header->size = size;
+	atomic_init(&header->is_closed, 0);
+	shm_ring_queue_init(self, &self->submissions);
+	shm_ring_queue_init(self, &self->results);
+	atomic_thread_fence(memory_order_release);
+	header->magic = SHM_RING_MAGIC; // Last, so that processes attaching early can tell the segment isn't ready.
+	return true;
+}
+
+// Maps a segment created by another process with ShmRing_Init. Fails if its header doesn't describe a segment of exactly
+// the size that was mapped.
+bool ShmRing_Attach(ShmRing *self, char const *name)
+{
+	self->header = NULL;
+	self->size = 0;
+	self->name[0] = '\0';
+	self->is_owner = false;
+	self->spin_limit = SHM_RING_MIN_SPIN;
+
+	if(strlen(name) >= SHM_RING_NAME_MAX) return false;
+	int fd = shm_open(name, O_RDWR, 0);
+	if(fd < 0) return false;
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ShmRingHeader))
+	{
+		close(fd);
+		return false;
+	}
+	void *mem = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(mem == MAP_FAILED) return false;
+
+	ShmRingHeader *header = (ShmRingHeader*)mem;
+	size_t size = (size_t)st.st_size;
+	atomic_thread_fence(memory_order_acquire);
+	// Every field is read once, the layout only depends on these copies from now on.
+	uint32_t magic = *(uint32_t volatile*)&header->magic;
+	uint32_t slot_count = *(uint32_t volatile*)&header->slot_count;
+	uint32_t slot_size = *(uint32_t volatile*)&header->slot_size;
+	if(magic != SHM_RING_MAGIC || shm_ring_layout(self, slot_count, slot_size) != size)
+	{
+		munmap(mem, size);
+		return false;
+	}
+	self->header = header;
+	self->size = size;
+	self->submissions.shared = &header->submissions;
+	self->results.shared = &header->results;
+	strcpy(self->name, name);
+	return true;
+}
+
+void ShmRing_Free(ShmRing *self)
+{
+	if(self->header) munmap(self->header, self->size);
+	if(self->is_owner && self->name[0]) shm_unlink(self->name);
+	self->header = NULL;
+	self->size = 0;
+	self->slot_size = 0;
+	self->submissions.shared = NULL;
+	self->results.shared = NULL;
+	self->name[0] = '\0';
+	self->is_owner = false;
+	self->spin_limit = SHM_RING_MIN_SPIN;
+}
+
+void *shm_ring_queue_cell(ShmRing *self, ShmRingQueueView *view, uint64_t pos)
+{
+    return (char*)self->header + view->cells_offset + (size_t)(pos & view->mask) * view->cell_size;
+}
+
+// Claims the next free cell for writing. Returns NULL if the queue is full.
+void *shm_ring_queue_try_claim_push(void *ring, ShmRingQueueView *view, uint64_t *out_pos)
+{
+    ShmRing *self = (ShmRing*)ring;
+    ShmRingQueue *queue = view->shared;
+    uint64_t pos = atomic_load_explicit(&queue->push_pos, memory_order_relaxed);
+    while(true)
+    {
+        void *cell = shm_ring_queue_cell(self, view, pos);
+        uint64_t seq = atomic_load_explicit((_Atomic uint64_t*)cell, memory_order_acquire);
+        int64_t diff = (int64_t)(seq - pos);
+        if(diff == 0)
+        {
+            if(atomic_compare_exchange_weak_explicit(&queue->push_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                *out_pos = pos;
+                return cell;
+            }
+        }
+        else if(diff < 0)
+        {
+            return NULL; // The cell still holds the value from the previous lap.
+        }
+        else
+        {
+            pos = atomic_load_explicit(&queue->push_pos, memory_order_relaxed);
+        }
+    }
+}
+
+// Claims the oldest filled cell for reading. Returns NULL if the queue is empty.
+void *shm_ring_queue_try_claim_pop(void *ring, ShmRingQueueView *view, uint64_t *out_pos)
+{
+    ShmRing *self = (ShmRing*)ring;
+    ShmRingQueue *queue = view->shared;
+    uint64_t pos = atomic_load_explicit(&queue->pop_pos, memory_order_relaxed);
+    while(true)
+    {
+        void *cell = shm_ring_queue_cell(self, view, pos);
+        uint64_t seq = atomic_load_explicit((_Atomic uint64_t*)cell, memory_order_acquire);
+        int64_t diff = (int64_t)(seq - (pos + 1));
+        if(diff == 0)
+        {
+            if(atomic_compare_exchange_weak_explicit(&queue->pop_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                *out_pos = pos;
+                return cell;
+            }
+        }
+        else if(diff < 0)
+        {
+            return NULL;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&queue->pop_pos, memory_order_relaxed);
+        }
+    }
+}
+
+void shm_ring_queue_commit_push(ShmRingQueueView *view, void *cell, uint64_t pos)
+{
+    atomic_store_explicit((_Atomic uint64_t*)cell, pos + 1, memory_order_release);
+    shm_ring_event_signal(&view->shared->pushed);
+}
+
+void shm_ring_queue_commit_pop(ShmRingQueueView *view, void *cell, uint64_t pos)
+{
+    atomic_store_explicit((_Atomic uint64_t*)cell, pos + view->mask + 1, memory_order_release);
+    shm_ring_event_signal(&view->shared->popped);
+}
+
+void shm_ring_event_signal(ShmRingEvent *event)
+{
+    atomic_fetch_add(&event->seq, 1);
+    if(atomic_load(&event->waiters) > 0)
+    {
+        syscall(SYS_futex, &event->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+// Sleeps until the event is signalled, unless it already was since its seq was seen.
+void shm_ring_event_wait(ShmRingEvent *event, uint32_t seen)
+{
+    syscall(SYS_futex, &event->seq, FUTEX_WAIT, seen, NULL, NULL, 0);
+}
+
+// Claims a cell with try_claim, spinning and then sleeping on event until it succeeds. Returns NULL only once the ring
+// is closed and the claim still fails.
+void *shm_ring_queue_claim(ShmRing *self, ShmRingQueueView *queue, ShmRingTryClaim try_claim, ShmRingEvent *event, uint64_t *pos)
+{
+    void *cell = try_claim(self, queue, pos);
+    if(cell) return cell;
+
+    for(int spins = 0; spins < self->spin_limit; ++spins)
+    {
+        shm_ring_cpu_relax();
+        cell = try_claim(self, queue, pos);
+        if(cell)
+        {
+            // Spinning was enough, allow a bit more of it next time.
+            if(self->spin_limit < SHM_RING_MAX_SPIN) self->spin_limit *= 2;
+            return cell;
+        }
+    }
+    if(self->spin_limit > SHM_RING_MIN_SPIN) self->spin_limit /= 2;
+
+    while(true)
+    {
+        // Announce that we're about to sleep before checking one last time. Whoever fills the queue after our check
+        // will see the waiter and wake us up, and if it did so before we sleep, seq has changed and we don't sleep.
+        uint32_t seen = atomic_load(&event->seq);
+        atomic_fetch_add(&event->waiters, 1);
+        cell = try_claim(self, queue, pos);
+        bool is_closed = shm_ring_is_closed(self);
+        if(!cell && !is_closed) shm_ring_event_wait(event, seen);
+        atomic_fetch_sub(&event->waiters, 1);
+        if(cell) return cell;
+        if(is_closed) return try_claim(self, queue, pos);
+    }
+}
+
+// Zero copy submission. Returns a free slot, whose text can be written up to the ring's slot_size, or NULL if the ring
+// was closed. The slot's id and length must be set before handing it to shm_ring_end_submit(). Nothing is checked on
+// this side, the evaluator rejects slots whose length is out of bounds with SHM_RING_ERROR_LENGTH.
+ShmRingSlot *shm_ring_begin_submit(ShmRing *self, uint64_t *pos)
+{
+    ShmRingQueueView *queue = &self->submissions;
+    return (ShmRingSlot*)shm_ring_queue_claim(self, queue, shm_ring_queue_try_claim_push, &queue->shared->popped, pos);
+}
+
+void shm_ring_end_submit(ShmRing *self, ShmRingSlot *slot, uint64_t pos)
+{
+    shm_ring_queue_commit_push(&self->submissions, slot, pos);
+}
+
+bool shm_ring_submit(ShmRing *self, char const *text, int length, uint64_t id)
+{
+    if(length < 0 || (uint32_t)length > self->slot_size) return false;
+    uint64_t pos;
+    ShmRingSlot *slot = shm_ring_begin_submit(self, &pos);
+    if(!slot) return false;
+    memcpy(slot->text, text, length);
+    slot->id = id;
+    slot->length = length;
+    shm_ring_end_submit(self, slot, pos);
+    return true;
+}
+
+// Waits for the next result. Returns false once the ring is closed and there are no results left.
+bool shm_ring_wait_result(ShmRing *self, ShmRingResult *result)
+{
+    ShmRingQueueView *queue = &self->results;
+    uint64_t pos;
+    ShmRingResult *cell = (ShmRingResult*)shm_ring_queue_claim(self, queue, shm_ring_queue_try_claim_pop, &queue->shared->pushed, &pos);
+    if(!cell) return false;
+    result->id = cell->id;
+    result->value = cell->value;
+    result->status = cell->status;
+    result->limit = cell->limit;
+    shm_ring_queue_commit_pop(queue, cell, pos);
+    return true;
+}
+
+// Tells everyone waiting on the ring to stop. The evaluator still drains the submissions that are already there.
+void shm_ring_close(ShmRing *self)
+{
+    atomic_store(&self->header->is_closed, 1);
+    shm_ring_event_signal(&self->header->submissions.pushed);
+    shm_ring_event_signal(&self->header->submissions.popped);
+    shm_ring_event_signal(&self->header->results.pushed);
+    shm_ring_event_signal(&self->header->results.popped);
+}
+
+bool shm_ring_is_closed(ShmRing *self)
+{
+    return atomic_load(&self->header->is_closed) != 0;
+}
+
+// Scans, parses and evaluates the expression right where it is in the slot. Definitions are not allowed, every
+// producer shares the same FunctionTable. The slot was written by another process, so its length is checked against
+// slot_size before anything reads its text.
+void shm_ring_eval_slot(ShmRingSlot *slot, uint32_t slot_size, ShmRingResult *result, TokenList *tokens, ExprList *exprs, FunctionTable *functions, Governor *governor)
+{
+    result->id = slot->id;
+    result->value = 0;
+    result->status = SHM_RING_OK;
+    result->limit = GOVERNOR_OK;
+    int length = *(int volatile*)&slot->length; // Read once, the producer could still change it after the check.
+    if(length < 0 || (uint32_t)length > slot_size)
+    {
+        result->status = SHM_RING_ERROR_LENGTH;
+        return;
+    }
+    TokenList_Clear(tokens);
+    ExprList_Clear(exprs);
+    if(governor) governor_start(governor);
+
+    Scanner scanner;
+    Scanner_InitRange(&scanner, tokens, slot->text, 0, length);
+    scanner.governor = governor;
+    scanner_scan(&scanner);
+    bool has_failed = scanner.has_failed;
+    Scanner_Free(&scanner);
+    if(has_failed) result->status = SHM_RING_ERROR_SCAN;
+
+    int root = -1;
+    if(result->status == SHM_RING_OK)
+    {
+        Parser parser;
+        Parser_Init(&parser, tokens, exprs, functions, slot->text);
+        parser.governor = governor;
+        if(parser_is_at_definition(&parser))
+        {
+            fprintf(stderr, "Function definitions can't be submitted through a shared memory ring\n");
+            parser.has_failed = true;
+        }
+        else
+        {
+            root = parser_parse_expr(&parser);
+            if(!parser.has_failed && !parser_is_at_end(&parser))
+            {
+                fprintf(stderr, "Unexpected token after expression (%s)\n", TokenTypeName[parser_peek(&parser).type]);
+                parser.has_failed = true;
+            }
+        }
+        if(parser.has_failed) result->status = SHM_RING_ERROR_PARSE;
+        Parser_Free(&parser);
+    }
+
+    if(result->status == SHM_RING_OK)
+    {
+        Evaluator evaluator;
+        Evaluator_Init(&evaluator, exprs, functions, NULL);
+        evaluator.governor = governor;
+        evaluator.is_checked = true; // A bad submission must not take the evaluator down.
+        result->value = evaluator_eval(&evaluator, root);
+        if(evaluator.has_failed) result->status = SHM_RING_ERROR_EVAL;
+        Evaluator_Free(&evaluator);
+    }
+
+    if(result->status != SHM_RING_OK && governor && governor->error != GOVERNOR_OK)
+    {
+        result->status = SHM_RING_ERROR_LIMIT;
+        result->limit = governor->error;
+    }
+}
+
+// Evaluator side. Evaluates submissions until the ring is closed and drained, and returns how many it evaluated.
+// governor can be NULL, the nesting of submissions is still limited to GOVERNOR_DEFAULT_MAX_DEPTH then, since the
+// parser and the evaluator recurse on it.
+long long shm_ring_serve(ShmRing *self, FunctionTable *functions, Governor *governor)
+{
+    GovernorLimits depth_limits = {0, 0, GOVERNOR_DEFAULT_MAX_DEPTH, 0, 0};
+    Governor depth_governor;
+    Governor_Init(&depth_governor, depth_limits);
+    if(!governor) governor = &depth_governor;
+
+    long long count = 0;
+    TokenList tokens;
+    TokenList_Init(&tokens);
+    ExprList exprs;
+    ExprList_Init(&exprs);
+
+    ShmRingQueueView *submissions = &self->submissions;
+    ShmRingQueueView *results = &self->results;
+    while(true)
+    {
+        uint64_t slot_pos;
+        ShmRingSlot *slot = (ShmRingSlot*)shm_ring_queue_claim(self, submissions, shm_ring_queue_try_claim_pop, &submissions->shared->pushed, &slot_pos);
+        if(!slot) break;
+
+        ShmRingResult result;
+        shm_ring_eval_slot(slot, self->slot_size, &result, &tokens, &exprs, functions, governor);
+        shm_ring_queue_commit_pop(submissions, slot, slot_pos);
+
+        uint64_t result_pos;
+        ShmRingResult *cell = (ShmRingResult*)shm_ring_queue_claim(self, results, shm_ring_queue_try_claim_push, &results->shared->popped, &result_pos);
+        if(!cell) break; // Closed while the result queue was full, nobody is going to read it anyway.
+        cell->id = result.id;
+        cell->value = result.value;
+        cell->status = result.status;
+        cell->limit = result.limit;
+        shm_ring_queue_commit_push(results, cell, result_pos);
+        count += 1;
+    }
+
+    TokenList_Free(&tokens);
+    ExprList_Free(&exprs);
+    Governor_Free(&depth_governor);
+    return count;
+}
+
+#endif
@@ -0,0 +1,628 @@
+#ifndef STATICEVAL_HPP
+#define STATICEVAL_HPP
+
+// Compile time evaluation of expressions, for C++20. The scanner, parser and evaluator below follow the C ones token for
+// token and operator for operator, so an expression gives the same value here as it does at runtime:
+//
+//     constexpr int a = expreval::eval("(1 + 2) * 3 > 8 ? 10 : 20");   // 10, computed by the compiler.
+//     int b = expreval::constant<"pow(2, 10) - 1">;                      // 1023, also computed by the compiler.
+//     constexpr auto area = expreval::function<"area(w, h) = w * h">;
+//     int c = area(width, height);                                    // Compiles down to width * height.
+//
+// eval() parses and evaluates the whole expression as a constant expression when its result is used as one, and at
+// runtime otherwise. constant always evaluates at compile time. A function is written like a C user function
+// definition, and its tree is turned into nested inline code at compile time, one instantiation per node, with nothing
+// left to scan or parse at runtime.
+//
+// Malformed input throws an expreval::Error, which is a compile error when it happens during constant evaluation (the
+// compiler points at the throw with the message next to it). This parser is stricter than the C one: trailing tokens
+// and missing operands are errors, where the C parser ignores the former and reads the latter as 0.
+//
+// Arithmetic wraps around just like the C evaluator's. Divisions by zero (and INT_MIN / -1) are errors when evaluated by
+// eval() or during constant evaluation, like a checked C Evaluator. A function called at runtime divides unchecked,
+// like the default C Evaluator. Parameter ranges ("0 <= w <= 100") are accepted but not checked, same as there.
+
+// Includes from std
+#include <climits>
+#include <cstddef>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace expreval
+{
+
+// Defines
+inline constexpr int FUNCTION_MAX_ARGS = 8;
+
+struct Error
+{
+    char const *message;
+    int position; // Offset in the source where the error was found, or -1 for errors found while evaluating.
+};
+
+enum TokenType
+{
+    TOKEN_NONE = 0,
+    TOKEN_PAREN_L, TOKEN_PAREN_R,
+    TOKEN_OP_PLUS, TOKEN_OP_MINUS, TOKEN_OP_STAR, TOKEN_OP_SLASH,
+    TOKEN_OP_LT, TOKEN_OP_LE, TOKEN_OP_GT, TOKEN_OP_GE, TOKEN_OP_EQ, TOKEN_OP_NE,
+    TOKEN_OP_AND, TOKEN_OP_OR,
+    TOKEN_QUESTION, TOKEN_COLON,
+    TOKEN_COMMA, TOKEN_ASSIGN,
+    TOKEN_IDENTIFIER,
+    TOKEN_LITERAL_NUMBER,
+    TOKEN_EOF,
+    TOKEN_COUNT,
+};
+
+// Only the expression types the C parser produces before any of its optimizations.
+enum ExprType
+{
+    EXPR_NONE = 0,
+    EXPR_LITERAL,
+    EXPR_NEG,
+    EXPR_LT, EXPR_LE, EXPR_GT, EXPR_GE, EXPR_EQ, EXPR_NE,
+    EXPR_AND, EXPR_OR, EXPR_TERNARY,
+    EXPR_PARAM, EXPR_CALL, EXPR_ARG,
+    EXPR_SUM, EXPR_PRODUCT, // "+ -" / "* /" chains, value is the operand count and lhs the first EXPR_OPERAND.
+    EXPR_OPERAND, // value is EXPR_ADD / EXPR_SUB or EXPR_MUL / EXPR_DIV and lhs the operand. Operands are contiguous.
+    EXPR_ADD, EXPR_SUB, EXPR_MUL, EXPR_DIV,
+    EXPR_COUNT,
+};
+
+enum Builtin
+{
+    BUILTIN_MIN = 0, BUILTIN_MAX, BUILTIN_ABS, BUILTIN_CLAMP, BUILTIN_POW,
+    BUILTIN_COUNT,
+};
+
+inline constexpr std::string_view BuiltinName[] = {"min", "max", "abs", "clamp", "pow"};
+inline constexpr int BuiltinArity[] = {2, 2, 1, 3, 2};
+
+struct Token
+{
+    int type;
+    int value;
+    int start;
+    int length;
+};
+
+struct Expr
+{
+    int type;
+    int value;
+    int lhs, rhs, cond;
+};
+
+// A parsed expression or function. Nodes are in post order, so the root is the last one.
+struct Tree
+{
+    std::vector<Expr> exprs;
+    int param_count;
+};
+
+// Same as a Tree, but with a size known at compile time so that it can be a template argument.
+template<std::size_t N>
+struct Program
+{
+    Expr exprs[N];
+    int root;
+    int param_count;
+};
+
+template<std::size_t N>
+struct FixedString
+{
+    char data[N] = {};
+
+    constexpr FixedString(char const (&str)[N])
+    {
+        for(std::size_t i = 0; i < N; ++i) data[i] = str[i];
+    }
+
+    constexpr std::string_view view() const { return std::string_view(data, N - 1); }
+};
+
+// Arithmetic, same as evaluator.h and functions.h
+
+constexpr int wrap_add(int a, int b) { return (int)((unsigned int)a + (unsigned int)b); }
+constexpr int wrap_sub(int a, int b) { return (int)((unsigned int)a - (unsigned int)b); }
+constexpr int wrap_mul(int a, int b) { return (int)((unsigned int)a * (unsigned int)b); }
+
+constexpr int checked_div(int a, int b)
+{
+    if(b == 0 || (a == INT_MIN && b == -1)) throw Error{"Division by zero (or INT_MIN / -1)", -1};
+    return a / b;
+}
+
+constexpr int powi(int a, int b)
+{
+    if(b < 0) return a == 1 ? 1 : a == -1 ? (b & 1 ? -1 : 1) : 0;
+    unsigned int base = (unsigned int)a, ans = 1;
+    while(b > 0)
+    {
+        if(b & 1) ans *= base;
+        base *= base;
+        b >>= 1;
+    }
+    return (int)ans;
+}
+
+constexpr int call_builtin(int builtin, int const *args)
+{
+    switch(builtin)
+    {
+        case BUILTIN_MIN: return args[0] < args[1] ? args[0] : args[1];
+        case BUILTIN_MAX: return args[0] > args[1] ? args[0] : args[1];
+        case BUILTIN_ABS: return args[0] < 0 ? (int)(0u - (unsigned int)args[0]) : args[0];
+        case BUILTIN_CLAMP: return args[0] < args[1] ? args[1] : args[0] > args[2] ? args[2] : args[0];
+        default: return powi(args[0], args[1]);
+    }
+}
+
+constexpr int apply(int op, int a, int b)
+{
+    switch(op)
+    {
+        case EXPR_ADD: return wrap_add(a, b);
+        case EXPR_SUB: return wrap_sub(a, b);
+        case EXPR_MUL: return wrap_mul(a, b);
+        default: return checked_div(a, b);
+    }
+}
+
+// Scanner, same as scanner.h
+
+constexpr bool scanner_is_whitespace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v'; }
+constexpr bool scanner_is_number(char c) { return c >= '0' && c <= '9'; }
+constexpr bool scanner_is_identifier_start(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+constexpr bool scanner_is_identifier(char c) { return scanner_is_identifier_start(c) || scanner_is_number(c); }
+
+constexpr std::vector<Token> scan(std::string_view source)
+{
+    std::vector<Token> tokens;
+    int len = (int)source.size();
+    int current = 0;
+    while(current < len)
+    {
+        int start = current;
+        char c = source[current++];
+        char next = current < len ? source[current] : '\0';
+        int type = TOKEN_NONE;
+        int value = 0;
+        switch(c)
+        {
+            case '(': type = TOKEN_PAREN_L; break;
+            case ')': type = TOKEN_PAREN_R; break;
+            case '+': type = TOKEN_OP_PLUS; break;
+            case '-': type = TOKEN_OP_MINUS; break;
+            case '*': type = TOKEN_OP_STAR; break;
+            case '/': type = TOKEN_OP_SLASH; break;
+            case '?': type = TOKEN_QUESTION; break;
+            case ':': type = TOKEN_COLON; break;
+            case ',': type = TOKEN_COMMA; break;
+            case '=': type = next == '=' ? TOKEN_OP_EQ : TOKEN_ASSIGN; break;
+            case '<': type = next == '=' ? TOKEN_OP_LE : TOKEN_OP_LT; break;
+            case '>': type = next == '=' ? TOKEN_OP_GE : TOKEN_OP_GT; break;
+            case '!': type = next == '=' ? TOKEN_OP_NE : TOKEN_NONE; break;
+            case '&': type = next == '&' ? TOKEN_OP_AND : TOKEN_NONE; break;
+            case '|': type = next == '|' ? TOKEN_OP_OR : TOKEN_NONE; break;
+            default:
+                if(scanner_is_whitespace(c)) continue;
+                if(scanner_is_number(c))
+                {
+                    unsigned int ans = c - '0'; // Literals that don't fit wrap around, same as the arithmetic does.
+                    while(current < len && scanner_is_number(source[current])) ans = ans * 10 + (source[current++] - '0');
+                    type = TOKEN_LITERAL_NUMBER;
+                    value = (int)ans;
+                }
+                else if(scanner_is_identifier_start(c))
+                {
+                    while(current < len && scanner_is_identifier(source[current])) current++;
+                    type = TOKEN_IDENTIFIER;
+                }
+                break;
+        }
+        if(type == TOKEN_NONE) throw Error{"Unknown char found in sequence", start};
+        // Two char operators
+        if(type == TOKEN_OP_EQ || type == TOKEN_OP_LE || type == TOKEN_OP_GE || type == TOKEN_OP_NE || type == TOKEN_OP_AND || type == TOKEN_OP_OR) current++;
+        tokens.push_back(Token{type, value, start, current - start});
+    }
+    return tokens;
+}
+
+// Parser, same grammar as parser.h
+
+class Parser
+{
+public:
+    constexpr Parser(std::string_view source) : source(source), tokens(scan(source)) {}
+
+    // Parses either an expression or a function definition, which must span the whole source.
+    constexpr Tree parse()
+    {
+        Tree tree{{}, 0};
+        if(is_at_definition()) parse_definition();
+        else parse_expr();
+        expect(current >= (int)tokens.size(), "Unexpected token after the end of the expression");
+        tree.exprs = std::move(exprs);
+        tree.param_count = param_count;
+        return tree;
+    }
+
+private:
+    std::string_view source;
+    std::vector<Token> tokens;
+    std::vector<Expr> exprs;
+    std::vector<int> operands; // Pairs of operand node and operation, of the chains being parsed.
+    Token params[FUNCTION_MAX_ARGS] = {};
+    int param_count = 0;
+    int current = 0;
+
+    // Throws when is_ok is false. A throw that is always reached is rejected in constexpr functions, so there's no fail().
+    constexpr void expect(bool is_ok, char const *message)
+    {
+        if(!is_ok) throw Error{message, current < (int)tokens.size() ? tokens[current].start : (int)source.size()};
+    }
+
+    constexpr Token peek() { return current < (int)tokens.size() ? tokens[current] : Token{TOKEN_EOF, 0, (int)source.size(), 0}; }
+    constexpr Token advance() { Token ans = peek(); current += 1; return ans; }
+
+    constexpr bool match(int type)
+    {
+        if(peek().type != type) return false;
+        current += 1;
+        return true;
+    }
+
+    constexpr std::string_view name(Token token) { return source.substr(token.start, token.length); }
+
+    constexpr int add(int type, int value, int lhs, int rhs, int cond)
+    {
+        exprs.push_back(Expr{type, value, lhs, rhs, cond});
+        return (int)exprs.size() - 1;
+    }
+
+    // Unlike parser_add_chain(), chains of any length are kept as a single node, the template evaluator folds them
+    // without recursing into every operand.
+    constexpr int add_chain(int type, int base)
+    {
+        int count = (int)(operands.size() - base) / 2;
+        if(count == 1)
+        {
+            int ans = operands[base];
+            operands.resize(base);
+            return ans;
+        }
+        int first = (int)exprs.size();
+        for(int i = 0; i < count; ++i)
+        {
+            int next = i < count - 1 ? first + i + 1 : -1;
+            add(EXPR_OPERAND, operands[base + 2 * i + 1], operands[base + 2 * i], next, -1);
+        }
+        operands.resize(base);
+        return add(type, count, first, -1, -1);
+    }
+
+    constexpr bool is_at_definition()
+    {
+        if(tokens.size() < 2 || tokens[0].type != TOKEN_IDENTIFIER || tokens[1].type != TOKEN_PAREN_L) return false;
+        for(std::size_t i = 2; i < tokens.size(); ++i)
+        {
+            if(tokens[i].type == TOKEN_ASSIGN) return true;
+        }
+        return false;
+    }
+
+    // "name(a, 0 <= b <= 100) = expr", the name and the ranges are ignored.
+    constexpr void parse_definition()
+    {
+        advance();
+        match(TOKEN_PAREN_L);
+        if(!match(TOKEN_PAREN_R))
+        {
+            do
+            {
+                bool is_ranged = peek().type == TOKEN_LITERAL_NUMBER || peek().type == TOKEN_OP_MINUS;
+                expect(!is_ranged || (parse_bound() && match(TOKEN_OP_LE)), "Expected '<=' after the lower bound of a parameter");
+                Token param = advance();
+                expect(param.type == TOKEN_IDENTIFIER && param_count < FUNCTION_MAX_ARGS, "Expected at most 8 parameter names in function definition");
+                expect(!is_ranged || (match(TOKEN_OP_LE) && parse_bound()), "Expected a range as in '0 <= x <= 100'");
+                params[param_count++] = param;
+            }
+            while(match(TOKEN_COMMA));
+
+            expect(match(TOKEN_PAREN_R), "Expected ')' at end of parameter list");
+        }
+        expect(match(TOKEN_ASSIGN), "Expected '=' after parameter list");
+        parse_expr();
+    }
+
+    constexpr bool parse_bound()
+    {
+        match(TOKEN_OP_MINUS);
+        return advance().type == TOKEN_LITERAL_NUMBER;
+    }
+
+    constexpr int parse_expr()
+    {
+        int cond = parse_expr_or();
+        if(match(TOKEN_QUESTION))
+        {
+            int l = parse_expr();
+            expect(match(TOKEN_COLON), "Expected ':' in ternary expression");
+            int r = parse_expr(); // Right associative, so "a ? b : c ? d : e" is "a ? b : (c ? d : e)".
+            return add(EXPR_TERNARY, 0, l, r, cond);
+        }
+        return cond;
+    }
+
+    constexpr int parse_expr_or()
+    {
+        int l = parse_expr_and();
+        while(match(TOKEN_OP_OR)) l = add(EXPR_OR, 0, l, parse_expr_and(), -1);
+        return l;
+    }
+
+    constexpr int parse_expr_and()
+    {
+        int l = parse_expr_equality();
+        while(match(TOKEN_OP_AND)) l = add(EXPR_AND, 0, l, parse_expr_equality(), -1);
+        return l;
+    }
+
+    constexpr int parse_expr_equality()
+    {
+        int l = parse_expr_comparison();
+        while(peek().type == TOKEN_OP_EQ || peek().type == TOKEN_OP_NE)
+        {
+            int type = advance().type == TOKEN_OP_EQ ? EXPR_EQ : EXPR_NE;
+            l = add(type, 0, l, parse_expr_comparison(), -1);
+        }
+        return l;
+    }
+
+    constexpr int parse_expr_comparison()
+    {
+        int l = parse_expr_addsub();
+        while(peek().type >= TOKEN_OP_LT && peek().type <= TOKEN_OP_GE)
+        {
+            int type = EXPR_LT + (advance().type - TOKEN_OP_LT);
+            l = add(type, 0, l, parse_expr_addsub(), -1);
+        }
+        return l;
+    }
+
+    constexpr int parse_expr_addsub()
+    {
+        int base = (int)operands.size();
+        operands.push_back(parse_expr_muldiv());
+        operands.push_back(EXPR_ADD);
+        while(peek().type == TOKEN_OP_PLUS || peek().type == TOKEN_OP_MINUS)
+        {
+            int op = advance().type == TOKEN_OP_PLUS ? EXPR_ADD : EXPR_SUB;
+            operands.push_back(parse_expr_muldiv());
+            operands.push_back(op);
+        }
+        return add_chain(EXPR_SUM, base);
+    }
+
+    constexpr int parse_expr_muldiv()
+    {
+        int base = (int)operands.size();
+        operands.push_back(parse_expr_unary());
+        operands.push_back(EXPR_MUL);
+        while(peek().type == TOKEN_OP_STAR || peek().type == TOKEN_OP_SLASH)
+        {
+            int op = advance().type == TOKEN_OP_STAR ? EXPR_MUL : EXPR_DIV;
+            operands.push_back(parse_expr_unary());
+            operands.push_back(op);
+        }
+        return add_chain(EXPR_PRODUCT, base);
+    }
+
+    constexpr int parse_expr_unary()
+    {
+        if(match(TOKEN_OP_PLUS)) return parse_expr_primary();
+        if(match(TOKEN_OP_MINUS)) return add(EXPR_NEG, 0, parse_expr_primary(), -1, -1);
+        return parse_expr_primary();
+    }
+
+    constexpr int parse_expr_primary()
+    {
+        Token token = peek();
+        switch(token.type)
+        {
+            case TOKEN_LITERAL_NUMBER: advance(); return add(EXPR_LITERAL, token.value, -1, -1, -1);
+            case TOKEN_IDENTIFIER: advance(); return parse_expr_identifier(token);
+            case TOKEN_PAREN_L: {
+                advance();
+                int v = parse_expr();
+                expect(match(TOKEN_PAREN_R), "Expected ')' at end of grouping expression");
+                return v;
+            }
+            default: break;
+        }
+        expect(token.type != TOKEN_EOF, "Unexpected end of expression");
+        expect(false, "Unknown primary expression found");
+        return -1;
+    }
+
+    constexpr int parse_expr_identifier(Token token)
+    {
+        for(int i = 0; i < param_count; ++i)
+        {
+            if(name(params[i]) == name(token)) return add(EXPR_PARAM, i, -1, -1, -1);
+        }
+        expect(peek().type == TOKEN_PAREN_L, "Unknown identifier");
+        return parse_expr_call(token);
+    }
+
+    constexpr int parse_expr_call(Token token)
+    {
+        int builtin = 0;
+        while(builtin < BUILTIN_COUNT && BuiltinName[builtin] != name(token)) builtin += 1;
+        if(builtin == BUILTIN_COUNT) current -= 1;
+        expect(builtin < BUILTIN_COUNT, "Unknown function");
+
+        int args[FUNCTION_MAX_ARGS] = {};
+        int arg_count = 0;
+        match(TOKEN_PAREN_L);
+        if(!match(TOKEN_PAREN_R))
+        {
+            do
+            {
+                int arg = parse_expr();
+                if(arg_count < FUNCTION_MAX_ARGS) args[arg_count] = arg;
+                arg_count += 1;
+            }
+            while(match(TOKEN_COMMA));
+
+            expect(match(TOKEN_PAREN_R), "Expected ')' at end of function call");
+        }
+        expect(arg_count == BuiltinArity[builtin], "Wrong number of arguments in function call");
+
+        int first = (int)exprs.size();
+        for(int i = 0; i < arg_count; ++i) add(EXPR_ARG, 0, args[i], i < arg_count - 1 ? first + i + 1 : -1, -1);
+        return add(EXPR_CALL, builtin, first, -1, -1);
+    }
+};
+
+constexpr Tree parse(std::string_view source)
+{
+    return Parser(source).parse();
+}
+
+// Evaluator, same as evaluator.h with is_checked set. Used by eval() and for functions called at compile time.
+
+constexpr int eval_tree(Expr const *exprs, int idx, int const *args)
+{
+    Expr const &expr = exprs[idx];
+    switch(expr.type)
+    {
+        case EXPR_LITERAL: return expr.value;
+        case EXPR_PARAM: return args[expr.value];
+        case EXPR_NEG: return wrap_sub(0, eval_tree(exprs, expr.lhs, args));
+
+        case EXPR_LT: return eval_tree(exprs, expr.lhs, args) < eval_tree(exprs, expr.rhs, args);
+        case EXPR_LE: return eval_tree(exprs, expr.lhs, args) <= eval_tree(exprs, expr.rhs, args);
+        case EXPR_GT: return eval_tree(exprs, expr.lhs, args) > eval_tree(exprs, expr.rhs, args);
+        case EXPR_GE: return eval_tree(exprs, expr.lhs, args) >= eval_tree(exprs, expr.rhs, args);
+        case EXPR_EQ: return eval_tree(exprs, expr.lhs, args) == eval_tree(exprs, expr.rhs, args);
+        case EXPR_NE: return eval_tree(exprs, expr.lhs, args) != eval_tree(exprs, expr.rhs, args);
+
+        case EXPR_AND: return eval_tree(exprs, expr.lhs, args) && eval_tree(exprs, expr.rhs, args);
+        case EXPR_OR: return eval_tree(exprs, expr.lhs, args) || eval_tree(exprs, expr.rhs, args);
+        case EXPR_TERNARY: return eval_tree(exprs, expr.cond, args) ? eval_tree(exprs, expr.lhs, args) : eval_tree(exprs, expr.rhs, args);
+
+        case EXPR_CALL: {
+            int values[FUNCTION_MAX_ARGS] = {};
+            int count = 0;
+            for(int arg = expr.lhs; arg >= 0; arg = exprs[arg].rhs) values[count++] = eval_tree(exprs, exprs[arg].lhs, args);
+            return call_builtin(expr.value, values);
+        }
+        case EXPR_SUM: case EXPR_PRODUCT: {
+            int ans = eval_tree(exprs, exprs[expr.lhs].lhs, args);
+            for(int i = 1; i < expr.value; ++i)
+            {
+                Expr const &operand = exprs[expr.lhs + i];
+                ans = apply(operand.value, ans, eval_tree(exprs, operand.lhs, args));
+            }
+            return ans;
+        }
+        default: return 0;
+    }
+}
+
+// Parses and evaluates an expression without parameters. It's a constant expression, and so are its errors.
+constexpr int eval(std::string_view source)
+{
+    Tree tree = parse(source);
+    if(tree.param_count > 0) throw Error{"Functions must be called through expreval::function", -1};
+    return eval_tree(tree.exprs.data(), (int)tree.exprs.size() - 1, nullptr);
+}
+
+// Template evaluator. Every node of the program becomes its own instantiation, so a call compiles down to the same
+// code as the expression written in C++ would.
+
+template<auto const &P, int Idx>
+constexpr int eval_node(int const *args);
+
+template<auto const &P, int Idx, std::size_t... I>
+constexpr int eval_chain(int const *args, std::index_sequence<I...>)
+{
+    constexpr int first = P.exprs[Idx].lhs;
+    int ans = eval_node<P, P.exprs[first].lhs>(args);
+    ((ans = P.exprs[first + 1 + I].value == EXPR_DIV && !std::is_constant_evaluated()
+        ? ans / eval_node<P, P.exprs[first + 1 + I].lhs>(args)
+        : apply(P.exprs[first + 1 + I].value, ans, eval_node<P, P.exprs[first + 1 + I].lhs>(args))), ...);
+    return ans;
+}
+
+template<auto const &P, int Idx, std::size_t... I>
+constexpr int eval_call(int const *args, std::index_sequence<I...>)
+{
+    // Arguments are evaluated left to right, in braced initializers the order is guaranteed.
+    int values[FUNCTION_MAX_ARGS] = {eval_node<P, P.exprs[P.exprs[Idx].lhs + I].lhs>(args)...};
+    return call_builtin(P.exprs[Idx].value, values);
+}
+
+template<auto const &P, int Idx>
+constexpr int eval_node(int const *args)
+{
+    constexpr Expr expr = P.exprs[Idx];
+    if constexpr(expr.type == EXPR_LITERAL) return expr.value;
+    else if constexpr(expr.type == EXPR_PARAM) return args[expr.value];
+    else if constexpr(expr.type == EXPR_NEG) return wrap_sub(0, eval_node<P, expr.lhs>(args));
+    else if constexpr(expr.type == EXPR_LT) return eval_node<P, expr.lhs>(args) < eval_node<P, expr.rhs>(args);
+    else if constexpr(expr.type == EXPR_LE) return eval_node<P, expr.lhs>(args) <= eval_node<P, expr.rhs>(args);
+    else if constexpr(expr.type == EXPR_GT) return eval_node<P, expr.lhs>(args) > eval_node<P, expr.rhs>(args);
+    else if constexpr(expr.type == EXPR_GE) return eval_node<P, expr.lhs>(args) >= eval_node<P, expr.rhs>(args);
+    else if constexpr(expr.type == EXPR_EQ) return eval_node<P, expr.lhs>(args) == eval_node<P, expr.rhs>(args);
+    else if constexpr(expr.type == EXPR_NE) return eval_node<P, expr.lhs>(args) != eval_node<P, expr.rhs>(args);
+    else if constexpr(expr.type == EXPR_AND) return eval_node<P, expr.lhs>(args) && eval_node<P, expr.rhs>(args);
+    else if constexpr(expr.type == EXPR_OR) return eval_node<P, expr.lhs>(args) || eval_node<P, expr.rhs>(args);
+    else if constexpr(expr.type == EXPR_TERNARY) return eval_node<P, expr.cond>(args) ? eval_node<P, expr.lhs>(args) : eval_node<P, expr.rhs>(args);
+    else if constexpr(expr.type == EXPR_CALL) return eval_call<P, Idx>(args, std::make_index_sequence<BuiltinArity[expr.value]>());
+    else if constexpr(expr.type == EXPR_SUM || expr.type == EXPR_PRODUCT) return eval_chain<P, Idx>(args, std::make_index_sequence<expr.value - 1>());
+    else return 0;
+}
+
+template<FixedString Source>
+struct Function
+{
+    static constexpr std::size_t length = parse(Source.view()).exprs.size();
+
+    static constexpr Program<length> build()
+    {
+        Tree tree = parse(Source.view());
+        Program<length> ans = {};
+        for(std::size_t i = 0; i < length; ++i) ans.exprs[i] = tree.exprs[i];
+        ans.root = (int)length - 1;
+        ans.param_count = tree.param_count;
+        return ans;
+    }
+
+    static constexpr Program<length> program = build();
+
+    template<typename... Args>
+    constexpr int operator()(Args... args) const
+    {
+        static_assert(sizeof...(Args) == program.param_count, "Wrong number of arguments for the function");
+        int const values[sizeof...(Args) + 1] = {(int)args...};
+        return eval_node<program, program.root>(values);
+    }
+};
+
+template<FixedString Source>
+inline constexpr Function<Source> function = {};
+
+// Same as eval(), but always evaluated at compile time even where the result isn't needed as a constant.
+template<FixedString Source>
+inline constexpr int constant = eval(Source.view());
+
+}
+
+#endif
@@ -0,0 +1,663 @@
+#ifndef STREAM_EVAL_H
+#define STREAM_EVAL_H
+
+// Feature test macros, for the clock_gettime() of governor.h
+#include "platform.h"
+
+// Includes from std
+#include <stdio.h>
+#include <stdbool.h>
+
+// Includes from project
+#include "token.h"
+#include "scanner.h"
+#include "functions.h"
+#include "evaluator.h"
+#include "governor.h"
+
+// Push style evaluator for expressions that arrive in pieces (sockets, pipes...). Bytes are fed in chunks of any size
+// and every expression is evaluated as soon as its terminating '\n' arrives, without ever buffering its source.
+//
+// Both halves are resumable state machines. The scanner keeps the token it's in the middle of (a partial number, an
+// identifier, or the first char of a two char operator) across chunks, so a token split between two chunks is scanned
+// just like if it had arrived in one piece. The parser is an operator precedence parser that evaluates as it goes:
+// left associative operators are applied as soon as an operator of lower or equal precedence arrives, so the stacks
+// only grow with nesting, never with the length of the expression. Both stacks have a fixed size, which bounds the
+// memory used by an expression being evaluated no matter how long it is.
+//
+// "&&", "||" and "?:" keep short-circuit semantics: when an operand is not needed, it's still parsed but the parser
+// enters a skipping mode in which no operator is applied and no function is called, so "0 && 1/0" doesn't trap.
+//
+// The grammar is the same as the one in parser.h, with the exception of function definitions, which are not allowed.
+// Functions can be defined through the Parser beforehand and then called from the stream.
+//
+// With a Governor, every expression gets its own budget, started by its first byte: bytes and tokens are counted as
+// they arrive, groups and calls count towards the depth, and every applied operator (and every node of the functions
+// it calls) towards the operations and time budgets. An expression over a limit fails like a malformed one, the rest
+// of it is ignored until its '\n' arrives.
+
+// Defines
+#ifndef STREAM_EVALUATOR_MAX_DEPTH
+#define STREAM_EVALUATOR_MAX_DEPTH 256 // Size of the value and operator stacks.
+#endif
+
+typedef void (*StreamResultCallback)(void *ctx, int value, bool has_failed);
+
+enum StreamScannerState
+{
+    STREAM_SCANNER_NONE = 0,
+    STREAM_SCANNER_NUMBER,
+    STREAM_SCANNER_IDENTIFIER,
+    STREAM_SCANNER_PAIR, // Seen the first char of a (possibly) two char operator.
+};
+
+typedef struct {
+    int type; // Operator token type. TOKEN_PAREN_L for groups and TOKEN_IDENTIFIER for calls.
+    bool is_unary;
+    bool skip; // Whether this operator made the parser skip its operand.
+    int cond; // Condition of ternaries.
+    int function; // Function index of calls.
+    int value_base; // Height of the value stack when a call started, the arguments are pushed above it.
+} StreamOp;
+
+typedef struct {
+    FunctionTable *functions;
+    StreamResultCallback on_result;
+    void *ctx;
+    Governor *governor; // Can be NULL.
+
+    // Scanner state
+    int scanner_state;
+    unsigned int number;
+    char name[FUNCTION_NAME_MAX];
+    int name_length;
+    char pair_first;
+
+    // Parser state
+    int values[STREAM_EVALUATOR_MAX_DEPTH];
+    int value_count;
+    StreamOp ops[STREAM_EVALUATOR_MAX_DEPTH];
+    int op_count;
+    int skip_level; // Number of operators currently skipping their operand. Nothing is computed while it's above 0.
+    int pending_function; // Function index of an identifier that must be followed by '(', or -1.
+    long long input_bytes; // Bytes of the expression so far, only counted with a governor.
+    int token_count; // Same for tokens.
+    bool expect_operand;
+    bool last_was_unary;
+    bool has_tokens;
+    bool has_failed;
+    bool is_stopped; // The rest of the input is ignored, see stream_evaluator_stop().
+} StreamEvaluator;
+
+// Forward declarations
+void StreamEvaluator_Init(StreamEvaluator*, FunctionTable*, StreamResultCallback, void*);
+void StreamEvaluator_Free(StreamEvaluator*);
+
+void stream_evaluator_feed(StreamEvaluator*, char const*, int);
+void stream_evaluator_finish(StreamEvaluator*);
+void stream_evaluator_stop(StreamEvaluator*);
+
+void stream_evaluator_scan_char(StreamEvaluator*, char);
+void stream_evaluator_flush_token(StreamEvaluator*);
+void stream_evaluator_push_token(StreamEvaluator*, int, int);
+
+void stream_evaluator_fail(StreamEvaluator*, char const*);
+void stream_evaluator_fail_limit(StreamEvaluator*);
+void stream_evaluator_end_expr(StreamEvaluator*);
+void stream_evaluator_reset_expr(StreamEvaluator*);
+int stream_evaluator_precedence(StreamOp*);
+bool stream_evaluator_push_value(StreamEvaluator*, int);
+int stream_evaluator_pop_value(StreamEvaluator*);
+bool stream_evaluator_push_op(StreamEvaluator*, StreamOp);
+void stream_evaluator_reduce(StreamEvaluator*);
+void stream_evaluator_reduce_while(StreamEvaluator*, int, bool);
+void stream_evaluator_push_binary(StreamEvaluator*, int);
+void stream_evaluator_close_group(StreamEvaluator*);
+int stream_evaluator_apply(StreamEvaluator*, int, int, int);
+
+// Implementation
+
+void StreamEvaluator_Init(StreamEvaluator *self, FunctionTable *functions, StreamResultCallback on_result, void *ctx)
+{
+	self->functions = functions;
+	self->on_result = on_result;
+	self->ctx = ctx;
+	self->governor = NULL;
+	self->scanner_state = STREAM_SCANNER_NONE;
+	self->is_stopped = false;
+	stream_evaluator_reset_expr(self);
+}
+
+void StreamEvaluator_Free(StreamEvaluator *self)
+{
+	self->functions = NULL;
+	self->on_result = NULL;
+	self->ctx = NULL;
+	self->governor = NULL;
+	self->scanner_state = STREAM_SCANNER_NONE;
+	self->is_stopped = false;
+	stream_evaluator_reset_expr(self);
+}
+
+void stream_evaluator_reset_expr(StreamEvaluator *self)
+{
+    self->value_count = 0;
+    self->op_count = 0;
+    self->skip_level = 0;
+    self->pending_function = -1;
+    self->input_bytes = 0;
+    self->token_count = 0;
+    self->expect_operand = true;
+    self->last_was_unary = false;
+    self->has_tokens = false;
+    self->has_failed = false;
+}
+
+void stream_evaluator_feed(StreamEvaluator *self, char const *buf, int len)
+{
+    for(int i = 0; i < len && !self->is_stopped; ++i)
+    {
+        stream_evaluator_scan_char(self, buf[i]);
+    }
+}
+
+// Call at the end of the input, ends the last expression even if it has no trailing '\n'.
+void stream_evaluator_finish(StreamEvaluator *self)
+{
+    if(!self->is_stopped) stream_evaluator_scan_char(self, '\n');
+}
+
+// Makes feed() and finish() ignore the rest of their input, without evaluating anything more. Meant to be called from
+// on_result when the results can't go anywhere anymore.
+void stream_evaluator_stop(StreamEvaluator *self)
+{
+    self->is_stopped = true;
+}
+
+// Scanner
+
+// Ends the token the scanner is in the middle of, if any. Called when a char that can't continue it arrives.
+void stream_evaluator_flush_token(StreamEvaluator *self)
+{
+    int state = self->scanner_state;
+    self->scanner_state = STREAM_SCANNER_NONE;
+    switch(state)
+    {
+        case STREAM_SCANNER_NUMBER: stream_evaluator_push_token(self, TOKEN_LITERAL_NUMBER, (int)self->number); break;
+        case STREAM_SCANNER_IDENTIFIER: stream_evaluator_push_token(self, TOKEN_IDENTIFIER, 0); break;
+        case STREAM_SCANNER_PAIR: {
+            switch(self->pair_first)
+            {
+                case '<': stream_evaluator_push_token(self, TOKEN_OP_LT, 0); break;
+                case '>': stream_evaluator_push_token(self, TOKEN_OP_GT, 0); break;
+                case '=': stream_evaluator_push_token(self, TOKEN_ASSIGN, 0); break;
+                default: {
+                    if(!self->has_failed) fprintf(stderr, "Unknown char '%c' found in sequence!\n", self->pair_first);
+                    self->has_failed = true;
+                } break;
+            }
+        } break;
+        default: break;
+    }
+}
+
+void stream_evaluator_scan_char(StreamEvaluator *self, char c)
+{
+    if(self->governor && !self->has_failed && c != '\n')
+    {
+        if(self->input_bytes++ == 0) governor_start(self->governor);
+        if(!governor_check_input(self->governor, self->input_bytes)) stream_evaluator_fail_limit(self);
+    }
+    switch(self->scanner_state)
+    {
+        case STREAM_SCANNER_NUMBER:
+            if(scanner_is_number(c))
+            {
+                self->number = self->number * 10 + (c - '0'); // Wraps around just like scanner_get_number_from_source.
+                return;
+            }
+            break;
+        case STREAM_SCANNER_IDENTIFIER:
+            if(scanner_is_identifier(c))
+            {
+                if(self->name_length < FUNCTION_NAME_MAX - 1) self->name[self->name_length] = c;
+                self->name_length += 1;
+                return;
+            }
+            break;
+        case STREAM_SCANNER_PAIR: {
+            char first = self->pair_first;
+            int type = TOKEN_NONE;
+            if(c == '=' && first == '<') type = TOKEN_OP_LE;
+            if(c == '=' && first == '>') type = TOKEN_OP_GE;
+            if(c == '=' && first == '=') type = TOKEN_OP_EQ;
+            if(c == '=' && first == '!') type = TOKEN_OP_NE;
+            if(c == '&' && first == '&') type = TOKEN_OP_AND;
+            if(c == '|' && first == '|') type = TOKEN_OP_OR;
+            if(type != TOKEN_NONE)
+            {
+                self->scanner_state = STREAM_SCANNER_NONE;
+                stream_evaluator_push_token(self, type, 0);
+                return;
+            }
+        } break;
+        default: break;
+    }
+    stream_evaluator_flush_token(self);
+
+    switch(c)
+    {
+        case '\n': stream_evaluator_end_expr(self); break;
+        case '(': stream_evaluator_push_token(self, TOKEN_PAREN_L, 0); break;
+        case ')': stream_evaluator_push_token(self, TOKEN_PAREN_R, 0); break;
+        case '+': stream_evaluator_push_token(self, TOKEN_OP_PLUS, 0); break;
+        case '-': stream_evaluator_push_token(self, TOKEN_OP_MINUS, 0); break;
+        case '*': stream_evaluator_push_token(self, TOKEN_OP_STAR, 0); break;
+        case '/': stream_evaluator_push_token(self, TOKEN_OP_SLASH, 0); break;
+        case '?': stream_evaluator_push_token(self, TOKEN_QUESTION, 0); break;
+        case ':': stream_evaluator_push_token(self, TOKEN_COLON, 0); break;
+        case ',': stream_evaluator_push_token(self, TOKEN_COMMA, 0); break;
+        case '<': case '>': case '=': case '!': case '&': case '|':
+            self->scanner_state = STREAM_SCANNER_PAIR;
+            self->pair_first = c;
+            break;
+        default:
+            if(scanner_is_whitespace(c))
+            {
+                // Ignore it, '\n' was already handled above.
+            }
+            else
+            if(scanner_is_number(c))
+            {
+                self->scanner_state = STREAM_SCANNER_NUMBER;
+                self->number = c - '0';
+            }
+            else
+            if(scanner_is_identifier_start(c))
+            {
+                self->scanner_state = STREAM_SCANNER_IDENTIFIER;
+                self->name[0] = c;
+                self->name_length = 1;
+            }
+            else
+            {
+                if(!self->has_failed) fprintf(stderr, "Unknown char '%c' found in sequence!\n", c);
+                self->has_failed = true;
+            }
+            break;
+    }
+}
+
+// Parser
+
+void stream_evaluator_fail(StreamEvaluator *self, char const *message)
+{
+    // Only the first error of an expression is reported, the rest of it is ignored until its '\n' arrives.
+    if(!self->has_failed) fprintf(stderr, "%s\n", message);
+    self->has_failed = true;
+}
+
+// Fails the expression on a limit of the governor, which has already reported it.
+void stream_evaluator_fail_limit(StreamEvaluator *self)
+{
+    self->has_tokens = true; // So that a failed result is reported even if no token was complete yet.
+    self->has_failed = true;
+}
+
+int stream_evaluator_precedence(StreamOp *op)
+{
+    if(op->is_unary) return 8;
+    switch(op->type)
+    {
+        case TOKEN_OP_STAR: case TOKEN_OP_SLASH: return 7;
+        case TOKEN_OP_PLUS: case TOKEN_OP_MINUS: return 6;
+        case TOKEN_OP_LT: case TOKEN_OP_LE: case TOKEN_OP_GT: case TOKEN_OP_GE: return 5;
+        case TOKEN_OP_EQ: case TOKEN_OP_NE: return 4;
+        case TOKEN_OP_AND: return 3;
+        case TOKEN_OP_OR: return 2;
+        case TOKEN_QUESTION: case TOKEN_COLON: return 1;
+        default: return 0; // Groups and calls are never reduced by precedence.
+    }
+}
+
+bool stream_evaluator_push_value(StreamEvaluator *self, int value)
+{
+    if(self->value_count >= STREAM_EVALUATOR_MAX_DEPTH)
+    {
+        stream_evaluator_fail(self, "Expression nested too deeply");
+        return false;
+    }
+    self->values[self->value_count++] = value;
+    return true;
+}
+
+int stream_evaluator_pop_value(StreamEvaluator *self)
+{
+    if(self->value_count <= 0)
+    {
+        stream_evaluator_fail(self, "Missing operand");
+        return 0;
+    }
+    return self->values[--self->value_count];
+}
+
+bool stream_evaluator_push_op(StreamEvaluator *self, StreamOp op)
+{
+    if(self->op_count >= STREAM_EVALUATOR_MAX_DEPTH)
+    {
+        stream_evaluator_fail(self, "Expression nested too deeply");
+        return false;
+    }
+    self->ops[self->op_count++] = op;
+    self->skip_level += op.skip;
+    return true;
+}
+
+int stream_evaluator_apply(StreamEvaluator *self, int type, int l, int r)
+{
+    if(self->skip_level > 0) return 0; // Skipped operands are never computed, so they can't trap.
+    switch(type)
+    {
+        case TOKEN_OP_PLUS: return evaluator_wrap_add(l, r);
+        case TOKEN_OP_MINUS: return evaluator_wrap_sub(l, r);
+        case TOKEN_OP_STAR: return evaluator_wrap_mul(l, r);
+        case TOKEN_OP_SLASH: return l / r;
+        case TOKEN_OP_LT: return l < r;
+        case TOKEN_OP_LE: return l <= r;
+        case TOKEN_OP_GT: return l > r;
+        case TOKEN_OP_GE: return l >= r;
+        case TOKEN_OP_EQ: return l == r;
+        case TOKEN_OP_NE: return l != r;
+        case TOKEN_OP_AND: return l && r;
+        case TOKEN_OP_OR: return l || r;
+        default: return 0;
+    }
+}
+
+// Applies the operator on top of the stack to its operands.
+void stream_evaluator_reduce(StreamEvaluator *self)
+{
+    if(self->governor && !governor_step(self->governor))
+    {
+        stream_evaluator_fail_limit(self);
+        return;
+    }
+    StreamOp op = self->ops[--self->op_count];
+    self->skip_level -= op.skip;
+    if(op.is_unary)
+    {
+        int v = stream_evaluator_pop_value(self);
+        stream_evaluator_push_value(self, self->skip_level > 0 ? 0 : evaluator_wrap_sub(0, v));
+        return;
+    }
+    switch(op.type)
+    {
+        case TOKEN_QUESTION: stream_evaluator_fail(self, "Expected ':' in ternary expression"); break;
+        case TOKEN_COLON: {
+            int r = stream_evaluator_pop_value(self);
+            int l = stream_evaluator_pop_value(self);
+            stream_evaluator_push_value(self, op.cond ? l : r);
+        } break;
+        case TOKEN_PAREN_L: stream_evaluator_fail(self, "Expected ')' at end of grouping expression"); break;
+        case TOKEN_IDENTIFIER: stream_evaluator_fail(self, "Expected ')' at end of function call"); break;
+        default: {
+            int r = stream_evaluator_pop_value(self);
+            int l = stream_evaluator_pop_value(self);
+            stream_evaluator_push_value(self, stream_evaluator_apply(self, op.type, l, r));
+        } break;
+    }
+}
+
+// Reduces every operator that binds at least as tight as the given precedence (or tighter, for right associative
+// operators). Stops at groups and calls.
+void stream_evaluator_reduce_while(StreamEvaluator *self, int precedence, bool is_right_assoc)
+{
+    while(!self->has_failed && self->op_count > 0)
+    {
+        int top = stream_evaluator_precedence(&self->ops[self->op_count - 1]);
+        if(top == 0 || top < precedence || (is_right_assoc && top == precedence)) break;
+        stream_evaluator_reduce(self);
+    }
+}
+
+void stream_evaluator_push_binary(StreamEvaluator *self, int type)
+{
+    StreamOp op = {type, false, false, 0, -1, 0};
+    stream_evaluator_reduce_while(self, stream_evaluator_precedence(&op), false);
+    if(self->has_failed) return;
+    int l = self->values[self->value_count - 1];
+    if(type == TOKEN_OP_AND) op.skip = l == 0;
+    if(type == TOKEN_OP_OR) op.skip = l != 0;
+    stream_evaluator_push_op(self, op);
+    self->expect_operand = true;
+}
+
+// Handles a ')', which ends either a group or a call.
+void stream_evaluator_close_group(StreamEvaluator *self)
+{
+    StreamOp *top = self->op_count > 0 ? &self->ops[self->op_count - 1] : NULL;
+    bool is_empty_call = self->expect_operand && top && top->type == TOKEN_IDENTIFIER && self->value_count == top->value_base;
+    if(self->expect_operand && !is_empty_call)
+    {
+        stream_evaluator_fail(self, "Unknown primary expression found (TOKEN_PAREN_R)");
+        return;
+    }
+    while(!self->has_failed && self->op_count > 0 && stream_evaluator_precedence(&self->ops[self->op_count - 1]) != 0)
+    {
+        stream_evaluator_reduce(self);
+    }
+    if(self->has_failed) return;
+    if(self->op_count == 0)
+    {
+        stream_evaluator_fail(self, "Unexpected ')'");
+        return;
+    }
+
+    StreamOp op = self->ops[--self->op_count];
+    self->skip_level -= op.skip;
+    self->expect_operand = false;
+    if(self->governor) governor_leave(self->governor, 1);
+    if(op.type == TOKEN_PAREN_L) return;
+
+    Function *function = FunctionTable_Get(self->functions, op.function);
+    int arg_count = self->value_count - op.value_base;
+    if(arg_count != function->arity)
+    {
+        char message[FUNCTION_NAME_MAX + 64];
+        snprintf(message, sizeof(message), "Function '%s' expects %d arguments but got %d", function->name, function->arity, arg_count);
+        stream_evaluator_fail(self, message);
+        return;
+    }
+    int const *args = self->values + op.value_base;
+    int ans = 0;
+    if(self->skip_level == 0)
+    {
+        Evaluator evaluator;
+        Evaluator_Init(&evaluator, &self->functions->exprs, self->functions, NULL);
+        evaluator.governor = self->governor;
+        ans = evaluator_call_function(&evaluator, op.function, args);
+        if(evaluator.has_failed) stream_evaluator_fail(self, "Failed to evaluate function call");
+        Evaluator_Free(&evaluator);
+    }
+    self->value_count = op.value_base;
+    stream_evaluator_push_value(self, ans);
+}
+
+void stream_evaluator_push_token(StreamEvaluator *self, int type, int value)
+{
+    self->has_tokens = true;
+    if(self->has_failed) return;
+    if(self->governor && !governor_check_tokens(self->governor, ++self->token_count))
+    {
+        stream_evaluator_fail_limit(self);
+        return;
+    }
+
+    if(self->pending_function >= 0 && type != TOKEN_PAREN_L)
+    {
+        stream_evaluator_fail(self, "Expected '(' after function name");
+        return;
+    }
+
+    bool was_unary = self->last_was_unary;
+    self->last_was_unary = false;
+    switch(type)
+    {
+        case TOKEN_LITERAL_NUMBER:
+            if(!self->expect_operand)
+            {
+                stream_evaluator_fail(self, "Unexpected number literal");
+                return;
+            }
+            stream_evaluator_push_value(self, value);
+            self->expect_operand = false;
+            break;
+        case TOKEN_IDENTIFIER: {
+            int function_idx = -1;
+            if(self->name_length < FUNCTION_NAME_MAX && self->functions)
+            {
+                function_idx = FunctionTable_Find(self->functions, self->name, self->name_length);
+            }
+            if(!self->expect_operand || function_idx < 0)
+            {
+                char message[FUNCTION_NAME_MAX + 32];
+                snprintf(message, sizeof(message), "Unknown identifier '%.*s'", self->name_length < FUNCTION_NAME_MAX ? self->name_length : FUNCTION_NAME_MAX - 1, self->name);
+                stream_evaluator_fail(self, message);
+                return;
+            }
+            self->pending_function = function_idx;
+        } break;
+        case TOKEN_PAREN_L: {
+            if(!self->expect_operand)
+            {
+                stream_evaluator_fail(self, "Unexpected '('");
+                return;
+            }
+            if(self->governor && !governor_enter(self->governor))
+            {
+                stream_evaluator_fail_limit(self);
+                return;
+            }
+            StreamOp op = {self->pending_function >= 0 ? TOKEN_IDENTIFIER : TOKEN_PAREN_L, false, false, 0, self->pending_function, self->value_count};
+            self->pending_function = -1;
+            stream_evaluator_push_op(self, op);
+        } break;
+        case TOKEN_PAREN_R:
+            stream_evaluator_close_group(self);
+            break;
+        case TOKEN_COMMA: {
+            if(self->expect_operand)
+            {
+                stream_evaluator_fail(self, "Unexpected ','");
+                return;
+            }
+            while(!self->has_failed && self->op_count > 0 && stream_evaluator_precedence(&self->ops[self->op_count - 1]) != 0)
+            {
+                stream_evaluator_reduce(self);
+            }
+            if(!self->has_failed && (self->op_count == 0 || self->ops[self->op_count - 1].type != TOKEN_IDENTIFIER))
+            {
+                stream_evaluator_fail(self, "Unexpected ',' outside of a function call");
+                return;
+            }
+            self->expect_operand = true;
+        } break;
+        case TOKEN_QUESTION: {
+            if(self->expect_operand)
+            {
+                stream_evaluator_fail(self, "Unexpected '?'");
+                return;
+            }
+            stream_evaluator_reduce_while(self, 1, true);
+            int cond = stream_evaluator_pop_value(self);
+            StreamOp op = {TOKEN_QUESTION, false, cond == 0, cond, -1, 0}; // Skip the "then" branch when the condition is false.
+            stream_evaluator_push_op(self, op);
+            self->expect_operand = true;
+        } break;
+        case TOKEN_COLON: {
+            if(self->expect_operand)
+            {
+                stream_evaluator_fail(self, "Unexpected ':'");
+                return;
+            }
+            while(!self->has_failed && self->op_count > 0 && self->ops[self->op_count - 1].type != TOKEN_QUESTION && stream_evaluator_precedence(&self->ops[self->op_count - 1]) != 0)
+            {
+                stream_evaluator_reduce(self);
+            }
+            if(self->has_failed) return;
+            if(self->op_count == 0 || self->ops[self->op_count - 1].type != TOKEN_QUESTION)
+            {
+                stream_evaluator_fail(self, "Unexpected ':' outside of a ternary expression");
+                return;
+            }
+            StreamOp *op = &self->ops[self->op_count - 1];
+            self->skip_level -= op->skip;
+            op->type = TOKEN_COLON;
+            op->skip = op->cond != 0; // Skip the "else" branch when the condition is true.
+            self->skip_level += op->skip;
+            self->expect_operand = true;
+        } break;
+        case TOKEN_OP_PLUS:
+        case TOKEN_OP_MINUS:
+            if(self->expect_operand)
+            {
+                // Same as in the Parser, a unary operator applies to a primary expression, so they can't be chained.
+                if(was_unary)
+                {
+                    stream_evaluator_fail(self, "Unknown primary expression found (unary operator)");
+                    return;
+                }
+                if(type == TOKEN_OP_MINUS)
+                {
+                    StreamOp op = {type, true, false, 0, -1, 0};
+                    stream_evaluator_push_op(self, op);
+                }
+                self->last_was_unary = true;
+                return;
+            }
+            stream_evaluator_push_binary(self, type);
+            break;
+        case TOKEN_OP_STAR: case TOKEN_OP_SLASH:
+        case TOKEN_OP_LT: case TOKEN_OP_LE: case TOKEN_OP_GT: case TOKEN_OP_GE:
+        case TOKEN_OP_EQ: case TOKEN_OP_NE:
+        case TOKEN_OP_AND: case TOKEN_OP_OR:
+            if(self->expect_operand)
+            {
+                stream_evaluator_fail(self, "Expected an operand before binary operator");
+                return;
+            }
+            stream_evaluator_push_binary(self, type);
+            break;
+        default: {
+            char message[64];
+            snprintf(message, sizeof(message), "Unexpected token (%s)", TokenTypeName[type]);
+            stream_evaluator_fail(self, message);
+        } break;
+    }
+}
+
+// Called on '\n'. Reduces whatever is left, reports the result and gets ready for the next expression.
+void stream_evaluator_end_expr(StreamEvaluator *self)
+{
+    if(!self->has_tokens)
+    {
+        return; // Empty lines don't produce results.
+    }
+    if(!self->has_failed && (self->expect_operand || self->pending_function >= 0))
+    {
+        stream_evaluator_fail(self, "Unexpected end of expression");
+    }
+    while(!self->has_failed && self->op_count > 0)
+    {
+        stream_evaluator_reduce(self);
+    }
+    if(!self->has_failed && self->value_count != 1)
+    {
+        stream_evaluator_fail(self, "Malformed expression");
+    }
+    int ans = self->has_failed ? 0 : self->values[0];
+    if(self->on_result) self->on_result(self->ctx, ans, self->has_failed);
+    stream_evaluator_reset_expr(self);
+}
+
+#endif
@@ -0,0 +1,289 @@
+// Differential test for the IncrementalParser. Generates random formulas and applies random edits to them, and after
+// every edit checks the incremental parser against a full parse of the same text: whether it parses, the tree it keeps
+// (node by node, costs and flags included) and the value it evaluates to. The text is only compared every few edits,
+// since getting it in one piece moves the gap of the text to its end.
+//
+// Formulas take turns between three kinds of edits: random snippets inserted over random ranges, which mostly break
+// the formula, and digits replacing or inserted before a digit, which mostly keep it valid and so take the incremental
+// path.
+//
+// Build: cc -O2 -pthread test_incremental.c -o test_incremental
+// Usage: ./test_incremental [formulas] [seed]
+
+#include "platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "eval.h"
+#include "incremental.h"
+
+#define TEST_EDITS_PER_FORMULA 60
+#define TEST_TEXT_MAX (1 << 20)
+
+enum TestEditKind
+{
+    TEST_EDIT_SNIPPET = 0,
+    TEST_EDIT_REPLACE_DIGIT,
+    TEST_EDIT_INSERT_DIGIT,
+    TEST_EDIT_KIND_COUNT,
+};
+
+static char const *snippets[] = {
+    "1", "2", "0", "7", "42", "+", "-", "*", "/", "(", ")", " ", "<", "<=", ">", ">=", "==", "!=", "&&", "||", "?", ":",
+    "=", "f(", ",", "x", "3", "9", "  ", "sq(", "1+2", "*(3-", "0?1:2",
+};
+
+static char const *definitions[] = {
+    "sq(x) = x*x",
+    "f(a,b) = a>b ? a-b : b/(a+1)",
+    "g(a) = g(a) + 1",
+};
+
+static unsigned int seed = 1;
+
+static unsigned int next_random(void)
+{
+    seed = seed * 1103515245u + 12345u;
+    return seed >> 16;
+}
+
+// Appends a random expression to out, with chains long enough to be parsed as EXPR_SUM / EXPR_PRODUCT / EXPR_CHAIN
+// from time to time.
+static void generate_expression(char *out, int *len, int depth, int max_len)
+{
+    if(*len > max_len || depth > 6 || next_random() % 3 == 0)
+    {
+        *len += sprintf(out + *len, "%u", next_random() % 20);
+        return;
+    }
+    switch(next_random() % 9)
+    {
+        case 0:
+            out[(*len)++] = '(';
+            generate_expression(out, len, depth + 1, max_len);
+            out[(*len)++] = ')';
+            break;
+        case 1:
+            generate_expression(out, len, depth + 1, max_len);
+            *len += sprintf(out + *len, " ? ");
+            generate_expression(out, len, depth + 1, max_len);
+            *len += sprintf(out + *len, " : ");
+            generate_expression(out, len, depth + 1, max_len);
+            break;
+        case 2: {
+            static char const *ops[] = {"&&", "||", "==", "!=", "<", "<=", ">", ">="};
+            char const *op = ops[next_random() % 8];
+            int count = next_random() % 4 == 0 ? 64 + next_random() % 20 : 2;
+            generate_expression(out, len, depth + 1, max_len);
+            for(int i = 1; i < count; ++i)
+            {
+                *len += sprintf(out + *len, " %s ", op);
+                generate_expression(out, len, depth + 3, max_len);
+            }
+        } break;
+        case 3:
+            *len += sprintf(out + *len, "sq(");
+            generate_expression(out, len, depth + 1, max_len);
+            out[(*len)++] = ')';
+            break;
+        case 4:
+            *len += sprintf(out + *len, "f(");
+            generate_expression(out, len, depth + 1, max_len);
+            out[(*len)++] = ',';
+            generate_expression(out, len, depth + 1, max_len);
+            out[(*len)++] = ')';
+            break;
+        case 5:
+            out[(*len)++] = '-';
+            generate_expression(out, len, depth + 1, max_len);
+            break;
+        default: {
+            int count = next_random() % 5 == 0 ? 70 + next_random() % 30 : 2 + next_random() % 5;
+            generate_expression(out, len, depth + 1, max_len);
+            for(int i = 1; i < count; ++i)
+            {
+                out[(*len)++] = "+-*/"[next_random() % 4];
+                generate_expression(out, len, depth + 2, max_len);
+            }
+        } break;
+    }
+    out[*len] = '\0';
+}
+
+// Whether the subtrees at a in as and b in bs are the same. Inlined calls share their arguments, so the trees are DAGs
+// and every node of bs remembers the node of as it was found equal to, so that shared subtrees are only compared once.
+static bool is_same_tree(ExprList *as, int a, ExprList *bs, int b, int *matches)
+{
+    if((a < 0) != (b < 0)) return false;
+    if(a < 0) return true;
+    if(matches[b] == a + 1) return true;
+    Expr *x = ExprList_Get(as, a), *y = ExprList_Get(bs, b);
+    if(x->type != y->type || x->value != y->value || x->cost != y->cost || x->flags != y->flags) return false;
+    if(expr_is_chain(x->type))
+    {
+        for(int i = 0; i < x->value; ++i)
+        {
+            if(!is_same_tree(as, x->lhs + i, bs, y->lhs + i, matches)) return false;
+        }
+    }
+    else if(!is_same_tree(as, x->lhs, bs, y->lhs, matches) || !is_same_tree(as, x->rhs, bs, y->rhs, matches) || !is_same_tree(as, x->cond, bs, y->cond, matches))
+    {
+        return false;
+    }
+    matches[b] = a + 1;
+    return true;
+}
+
+typedef struct {
+    bool has_parsed;
+    bool has_value;
+    int value;
+    bool is_same_tree; // Only meaningful when both parsed.
+} TestResult;
+
+// Parses and evaluates text from scratch, and compares the tree with the one of incremental.
+static TestResult full_eval(char const *text, FunctionTable *functions, IncrementalParser *incremental)
+{
+    TestResult result = {false, false, 0, true};
+    TokenList tokens;
+    TokenList_Init(&tokens);
+    ExprList exprs;
+    ExprList_Init(&exprs);
+
+    Scanner scanner;
+    Scanner_Init(&scanner, &tokens, text);
+    scanner.is_quiet = true;
+    scanner_scan(&scanner);
+    bool has_failed = scanner.has_failed || TokenList_Length(&tokens) == 0;
+    Scanner_Free(&scanner);
+
+    if(!has_failed)
+    {
+        Parser parser;
+        Parser_Init(&parser, &tokens, &exprs, functions, text);
+        int root = -1;
+        if(!parser_is_at_definition(&parser)) root = parser_parse_expr(&parser);
+        result.has_parsed = root >= 0 && !parser.has_failed;
+        Parser_Free(&parser);
+
+        if(result.has_parsed && incremental->is_valid)
+        {
+            int *matches = (int*)calloc(ExprList_Length(&exprs), sizeof(int));
+            result.is_same_tree = matches && is_same_tree(&incremental->exprs, incremental->root, &exprs, root, matches);
+            free(matches);
+        }
+        if(result.has_parsed)
+        {
+            Evaluator evaluator;
+            Evaluator_Init(&evaluator, &exprs, functions, NULL);
+            evaluator.is_checked = true;
+            result.value = evaluator_eval(&evaluator, root);
+            result.has_value = !evaluator.has_failed;
+            Evaluator_Free(&evaluator);
+        }
+    }
+
+    TokenList_Free(&tokens);
+    ExprList_Free(&exprs);
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    int formula_count = argc > 1 ? atoi(argv[1]) : 600;
+    if(argc > 2) seed = (unsigned int)strtoul(argv[2], NULL, 10);
+
+    FunctionTable functions;
+    FunctionTable_Init(&functions);
+    for(int i = 0; i < (int)(sizeof(definitions) / sizeof(definitions[0])); ++i)
+    {
+        TokenList tokens;
+        TokenList_Init(&tokens);
+        Scanner scanner;
+        Scanner_Init(&scanner, &tokens, definitions[i]);
+        scanner_scan(&scanner);
+        Scanner_Free(&scanner);
+        Parser parser;
+        Parser_Init(&parser, &tokens, &functions.exprs, &functions, definitions[i]);
+        parser_parse_definition(&parser);
+        Parser_Free(&parser);
+        TokenList_Free(&tokens);
+    }
+
+    static char generated[TEST_TEXT_MAX];
+    static char text[TEST_TEXT_MAX]; // What the text of the incremental parser should be.
+    long long check_count = 0, mismatch_count = 0, tree_mismatch_count = 0, valid_count = 0, incremental_count = 0;
+
+    for(int formula = 0; formula < formula_count; ++formula)
+    {
+        int kind = formula % TEST_EDIT_KIND_COUNT;
+        int len = 0;
+        generate_expression(generated, &len, 0, 50 + next_random() % 2000);
+        IncrementalParser incremental;
+        IncrementalParser_Init(&incremental, &functions);
+        incremental_parser_set_text(&incremental, generated, len);
+        memcpy(text, generated, len + 1);
+
+        for(int edit = 0; edit < TEST_EDITS_PER_FORMULA; ++edit)
+        {
+            int begin = len ? next_random() % (len + 1) : 0;
+            int end = begin + (next_random() % 3 == 0 ? next_random() % 4 : 0);
+            char const *insert = next_random() % 4 == 0 ? "" : snippets[next_random() % (sizeof(snippets) / sizeof(snippets[0]))];
+            if(kind != TEST_EDIT_SNIPPET)
+            {
+                while(begin < len && !scanner_is_number(text[begin])) begin += 1;
+                end = kind == TEST_EDIT_REPLACE_DIGIT && begin < len ? begin + 1 : begin;
+                insert = (char const*[]){"1", "5", "9", "0"}[next_random() % 4];
+            }
+            if(end > len) end = len;
+            int insert_len = (int)strlen(insert);
+            if(len - (end - begin) + insert_len >= TEST_TEXT_MAX) break;
+
+            int full_parse_count = incremental.full_parse_count;
+            bool has_parsed = incremental_parser_edit(&incremental, begin, end, insert, insert_len);
+            incremental_count += incremental.full_parse_count == full_parse_count;
+            memmove(text + begin + insert_len, text + end, len - end + 1);
+            memcpy(text + begin, insert, insert_len);
+            len += insert_len - (end - begin);
+            if(next_random() % 8 == 0 && strcmp(text, incremental_parser_text(&incremental)) != 0)
+            {
+                printf("Text mismatch in formula %d after edit %d\n", formula, edit);
+                return 1;
+            }
+
+            int value = 0;
+            bool has_value = incremental_parser_eval(&incremental, &value);
+            TestResult expected = full_eval(text, &functions, &incremental);
+            check_count += 1;
+            valid_count += expected.has_value;
+            tree_mismatch_count += !expected.is_same_tree;
+            if(has_parsed != expected.has_parsed || has_value != expected.has_value || (has_value && value != expected.value))
+            {
+                mismatch_count += 1;
+                if(mismatch_count <= 5)
+                {
+                    printf("Mismatch in formula %d after edit %d: parsed %d / %d, value %d (%d) / %d (%d), text '%.200s'\n", formula, edit,
+                        has_parsed, expected.has_parsed, value, has_value, expected.value, expected.has_value, text);
+                }
+            }
+
+            // Start over from a valid formula from time to time, so that broken ones don't take all of the edits.
+            if(!expected.has_parsed && next_random() % 2)
+            {
+                int generated_len = 0;
+                generate_expression(generated, &generated_len, 0, 50 + next_random() % 2000);
+                incremental_parser_edit(&incremental, 0, len, generated, generated_len);
+                memcpy(text, generated, generated_len + 1);
+                len = generated_len;
+            }
+        }
+        IncrementalParser_Free(&incremental);
+    }
+    FunctionTable_Free(&functions);
+
+    printf("%lld checks, %lld mismatches, %lld tree mismatches, %lld valid, %lld edits without a full parse\n",
+        check_count, mismatch_count, tree_mismatch_count, valid_count, incremental_count);
+    return mismatch_count != 0 || tree_mismatch_count != 0;
+}
@@ -0,0 +1,100 @@
+// Regression test for a write that fails in the middle of a chunk of the UringPipeline, which used to go on formatting
+// results past the end of the full output buffer. The output file is limited with RLIMIT_FSIZE, and SIGXFSZ is
+// ignored so that writing past the limit fails with EFBIG instead. Every line of the input gives the longest result
+// there is, so a 64 KiB chunk fills the output buffer and then some.
+//
+// The plain pipeline writes as soon as the buffer is full, so a limit of half a buffer makes the first write fail in the
+// middle of the first chunk, with results left in it. The ring only finds out about a write when it flushes the next
+// buffer, and the limit lets the first write through so that it's the next ones that fail. Its writes are done by
+// io_uring workers though, and when they fail (or come out short) depends on the kernel, so the ring is only checked
+// for staying within its buffers. Best run under -fsanitize=address.
+//
+// Build: cc -O2 -pthread test_uring_write.c -o test_uring_write
+// Usage: ./test_uring_write
+
+#include "platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "eval.h"
+
+#define TEST_INPUT_SIZE (4 * URING_PIPELINE_BUFFER_SIZE)
+
+// Writes the input to a temporary file, and returns it opened for reading, or -1.
+static int make_input(void)
+{
+    char path[] = "/tmp/test_uring_write_in_XXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0) return -1;
+    unlink(path);
+    FILE *file = fdopen(dup(fd), "w");
+    if(!file) return -1;
+    for(int len = 0; len < TEST_INPUT_SIZE; len += 10) fputs("pow(2,31)\n", file); // "-2147483648\n"
+    fclose(file);
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+static bool run(int in_fd, bool has_ring, long long limit)
+{
+    char path[] = "/tmp/test_uring_write_out_XXXXXX";
+    int out_fd = mkstemp(path);
+    if(in_fd < 0 || out_fd < 0)
+    {
+        fprintf(stderr, "Could not create the temporary files\n");
+        return false;
+    }
+    unlink(path);
+    struct rlimit rlimit = {(rlim_t)limit, RLIM_INFINITY};
+    if(setrlimit(RLIMIT_FSIZE, &rlimit) != 0)
+    {
+        perror("setrlimit");
+        return false;
+    }
+
+    FunctionTable functions;
+    FunctionTable_Init(&functions);
+    UringPipeline pipeline;
+    bool ans = UringPipeline_Init(&pipeline, in_fd, out_fd, &functions);
+    if(pipeline.has_ring && !has_ring)
+    {
+        Uring_Free(&pipeline.ring);
+        pipeline.has_ring = false;
+        pipeline.has_fixed_buffers = false;
+    }
+    if(ans && has_ring && !pipeline.has_ring)
+    {
+        printf("ring: skipped, io_uring is not available\n");
+    }
+    else if(ans)
+    {
+        uring_pipeline_run(&pipeline);
+        struct stat st;
+        fstat(out_fd, &st);
+        // Stopped means the write failed while the stream was still feeding the chunk, which is what's tested here.
+        ans = pipeline.has_failed && (has_ring || pipeline.stream.is_stopped) && pipeline.out_len <= URING_PIPELINE_BUFFER_SIZE && st.st_size <= limit;
+        printf("%s: %s, %lld bytes written\n", has_ring ? "ring" : "plain", ans ? "ok" : "FAILED", (long long)st.st_size);
+    }
+    UringPipeline_Free(&pipeline);
+    FunctionTable_Free(&functions);
+    close(in_fd);
+    close(out_fd);
+    return ans;
+}
+
+int main(void)
+{
+    // The inputs are bigger than the limits, so they're written before any is set.
+    int ring_in_fd = make_input(), plain_in_fd = make_input();
+    signal(SIGXFSZ, SIG_IGN);
+    int full_len = URING_PIPELINE_BUFFER_SIZE - URING_PIPELINE_BUFFER_SIZE % URING_PIPELINE_RESULT_MAX; // Of a full buffer.
+    bool has_passed = run(ring_in_fd, true, full_len + URING_PIPELINE_BUFFER_SIZE / 8);
+    has_passed &= run(plain_in_fd, false, URING_PIPELINE_BUFFER_SIZE / 2);
+    return has_passed ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// Includes from std
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+// A minimal fork-join pool. threadpool_run() splits a job into a number of tasks that are picked up by the workers and
+// by the calling thread itself, and returns once all of them are done. Jobs must not call threadpool_run() on the
+// same pool from within a task.
+
+typedef void (*ThreadPoolTask)(void *ctx, int task);
+
+typedef struct {
+    pthread_t *threads;
+    int thread_count; // Includes the calling thread, so a pool of 1 thread runs everything inline.
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    ThreadPoolTask task_fn;
+    void *task_ctx;
+    int task_count;
+    atomic_int next_task;
+    int busy_workers;
+    unsigned int generation; // Bumped for every job so that workers know there is new work to pick up.
+    bool quit;
+} ThreadPool;
+
+// Forward declarations
+bool ThreadPool_Init(ThreadPool*, int);
+void ThreadPool_Free(ThreadPool*);
+
+void threadpool_run(ThreadPool*, ThreadPoolTask, void*, int);
+void threadpool_run_tasks(ThreadPool*);
+void *threadpool_worker(void*);
+
+// Implementation
+
+bool ThreadPool_Init(ThreadPool *self, int thread_count)
+{
+	if(thread_count < 1) thread_count = 1;
+	self->thread_count = thread_count;
+	self->task_fn = NULL;
+	self->task_ctx = NULL;
+	self->task_count = 0;
+	atomic_init(&self->next_task, 0);
+	self->busy_workers = 0;
+	self->generation = 0;
+	self->quit = false;
+	pthread_mutex_init(&self->mutex, NULL);
+	pthread_cond_init(&self->work_cond, NULL);
+	pthread_cond_init(&self->done_cond, NULL);
+
+	self->threads = (pthread_t*)malloc(thread_count * sizeof(pthread_t));
+	if(!self->threads) return false;
+	for(int i = 0; i < thread_count - 1; ++i)
+	{
+		if(pthread_create(&self->threads[i], NULL, threadpool_worker, self) != 0)
+		{
+			self->thread_count = i + 1; // Keep the workers we could create.
+			break;
+		}
+	}
+	return true;
+}
+
+void ThreadPool_Free(ThreadPool *self)
+{
+	pthread_mutex_lock(&self->mutex);
+	self->quit = true;
+	pthread_cond_broadcast(&self->work_cond);
+	pthread_mutex_unlock(&self->mutex);
+	for(int i = 0; i < self->thread_count - 1; ++i)
+	{
+		pthread_join(self->threads[i], NULL);
+	}
+	free(self->threads);
+	self->threads = NULL;
+	self->thread_count = 0;
+	pthread_mutex_destroy(&self->mutex);
+	pthread_cond_destroy(&self->work_cond);
+	pthread_cond_destroy(&self->done_cond);
+}
+
+void threadpool_run_tasks(ThreadPool *self)
+{
+    int task;
+    while((task = atomic_fetch_add(&self->next_task, 1)) < self->task_count)
+    {
+        self->task_fn(self->task_ctx, task);
+    }
+}
+
+void *threadpool_worker(void *arg)
+{
+    ThreadPool *self = (ThreadPool*)arg;
+    unsigned int seen_generation = 0;
+    pthread_mutex_lock(&self->mutex);
+    while(true)
+    {
+        while(!self->quit && self->generation == seen_generation) pthread_cond_wait(&self->work_cond, &self->mutex);
+        if(self->quit) break;
+        seen_generation = self->generation;
+        self->busy_workers += 1;
+        pthread_mutex_unlock(&self->mutex);
+
+        threadpool_run_tasks(self);
+
+        pthread_mutex_lock(&self->mutex);
+        self->busy_workers -= 1;
+        if(self->busy_workers == 0) pthread_cond_signal(&self->done_cond);
+    }
+    pthread_mutex_unlock(&self->mutex);
+    return NULL;
+}
+
+void threadpool_run(ThreadPool *self, ThreadPoolTask task_fn, void *task_ctx, int task_count)
+{
+    pthread_mutex_lock(&self->mutex);
+    // A worker that woke up too late for the previous job may still be draining it, wait for it before replacing it.
+    while(self->busy_workers > 0) pthread_cond_wait(&self->done_cond, &self->mutex);
+    self->task_fn = task_fn;
+    self->task_ctx = task_ctx;
+    self->task_count = task_count;
+    atomic_store(&self->next_task, 0);
+    self->generation += 1;
+    pthread_cond_broadcast(&self->work_cond);
+    pthread_mutex_unlock(&self->mutex);
+
+    threadpool_run_tasks(self);
+
+    // Once the calling thread runs out of tasks, the remaining ones are already being run by the workers, so we only
+    // need to wait for the workers that joined this job to be done with them.
+    pthread_mutex_lock(&self->mutex);
+    while(self->busy_workers > 0) pthread_cond_wait(&self->done_cond, &self->mutex);
+    pthread_mutex_unlock(&self->mutex);
+}
+
+#endif
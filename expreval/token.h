@@ -6,6 +6,11 @@ enum TokenType
     TOKEN_NONE = 0,
     TOKEN_PAREN_L, TOKEN_PAREN_R,
     TOKEN_OP_PLUS, TOKEN_OP_MINUS, TOKEN_OP_STAR, TOKEN_OP_SLASH,
+    TOKEN_OP_LT, TOKEN_OP_LE, TOKEN_OP_GT, TOKEN_OP_GE, TOKEN_OP_EQ, TOKEN_OP_NE,
+    TOKEN_OP_AND, TOKEN_OP_OR,
+    TOKEN_QUESTION, TOKEN_COLON,
+    TOKEN_COMMA, TOKEN_ASSIGN,
+    TOKEN_IDENTIFIER,
     TOKEN_LITERAL_NUMBER,
 	TOKEN_EOF,
     TOKEN_COUNT,
@@ -15,6 +20,11 @@ static char const * const TokenTypeName[] = {
     "TOKEN_NONE",
     "TOKEN_PAREN_L", "TOKEN_PAREN_R",
     "TOKEN_OP_PLUS", "TOKEN_OP_MINUS", "TOKEN_OP_STAR", "TOKEN_OP_SLASH",
+    "TOKEN_OP_LT", "TOKEN_OP_LE", "TOKEN_OP_GT", "TOKEN_OP_GE", "TOKEN_OP_EQ", "TOKEN_OP_NE",
+    "TOKEN_OP_AND", "TOKEN_OP_OR",
+    "TOKEN_QUESTION", "TOKEN_COLON",
+    "TOKEN_COMMA", "TOKEN_ASSIGN",
+    "TOKEN_IDENTIFIER",
     "TOKEN_LITERAL_NUMBER",
 	"TOKEN_EOF",
     "TOKEN_COUNT",
@@ -23,6 +33,7 @@ static char const * const TokenTypeName[] = {
 typedef struct {
     int type;
     int value;
+    int start, length; // Location of the lexeme within the source string, used to get the name of identifiers.
 } Token;
 
 #endif
@@ -0,0 +1,476 @@
+#ifndef URING_H
+#define URING_H
+
+// Feature test macros, for syscall() and MAP_POPULATE
+#include "platform.h"
+
+// Includes from std
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+
+// Includes from system (Linux only, io_uring through raw syscalls)
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// Includes from project
+#include "exprlist.h"
+#include "functions.h"
+#include "streameval.h"
+
+// Batch input and output for pipes, sockets and files that can't be mapped. The bytes of in_fd are fed to a
+// StreamEvaluator chunk by chunk, and the results are written to out_fd, without ever blocking the evaluation on
+// either of them: while chunk N is being scanned and evaluated, the read of chunk N + 1 and the write of the results
+// of chunk N - 1 are in flight in an io_uring.
+//
+// There are four buffers, registered with the ring so that the kernel doesn't have to map them on every operation:
+// two for input, which the reads and the evaluation take turns on, and two for output, one being filled with results
+// while the other one is written. Results are flushed at the end of every chunk, and whenever the output buffer is
+// full. Expressions that straddle two chunks need nothing special, the StreamEvaluator keeps its state across feeds.
+//
+// The ring is set up with raw syscalls, there's no dependency on liburing. When io_uring is not available (old kernel,
+// seccomp filter, io_uring_disabled sysctl...) the same pipeline runs on plain blocking read() and write().
+
+// Defines
+#ifndef URING_PIPELINE_BUFFER_SIZE
+#define URING_PIPELINE_BUFFER_SIZE 65536
+#endif
+
+#define URING_PIPELINE_BUFFER_COUNT 4 // Two for input, two for output.
+#define URING_PIPELINE_RESULT_MAX 12 // "-2147483648\n"
+#define URING_ENTRIES 4 // At most one read and one write are ever in flight.
+
+// Results are formatted straight into the output buffer once it has room for the longest one.
+_Static_assert(URING_PIPELINE_BUFFER_SIZE >= URING_PIPELINE_RESULT_MAX, "URING_PIPELINE_BUFFER_SIZE must fit at least one result");
+
+enum UringOp
+{
+    URING_OP_READ = 1,
+    URING_OP_WRITE,
+};
+
+// Process side view of a ring. The pointers point into the rings shared with the kernel.
+typedef struct {
+	int fd;
+	uint32_t features;
+	_Atomic uint32_t *sq_head, *sq_tail;
+	uint32_t *sq_mask, *sq_entries, *sq_array;
+	struct io_uring_sqe *sqes;
+	_Atomic uint32_t *cq_head, *cq_tail;
+	uint32_t *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring; // The same mapping when the kernel has IORING_FEAT_SINGLE_MMAP.
+	size_t sq_ring_size, cq_ring_size, sqes_size;
+} Uring;
+
+typedef struct {
+	Uring ring;
+	bool has_ring; // Otherwise plain read() and write() are used.
+	bool has_fixed_buffers; // The buffers are registered with the ring.
+	int in_fd, out_fd;
+	char *buffers; // URING_PIPELINE_BUFFER_COUNT buffers of URING_PIPELINE_BUFFER_SIZE bytes, input ones first.
+	int read_buffer; // Input buffer the read in flight fills, or -1 when no read is in flight.
+	int read_result; // Bytes read by the last completed read, or -errno.
+	int out_buffer; // Output buffer the results are appended to.
+	int out_len;
+	int write_buffer; // Output buffer being written, or -1 when no write is in flight.
+	int write_offset, write_len; // Part of write_buffer left to write, short writes are resubmitted for the rest.
+	StreamEvaluator stream;
+	bool has_failed;
+} UringPipeline;
+
+// Forward declarations
+bool Uring_Init(Uring*, unsigned int);
+void Uring_Free(Uring*);
+
+bool uring_submit(Uring*, struct io_uring_sqe const*);
+bool uring_pop_cqe(Uring*, struct io_uring_cqe*);
+int uring_wait(Uring*);
+bool uring_register_buffers(Uring*, struct iovec const*, int);
+
+bool UringPipeline_Init(UringPipeline*, int, int, FunctionTable*);
+void UringPipeline_Free(UringPipeline*);
+
+char *uring_pipeline_buffer(UringPipeline*, int);
+void uring_pipeline_run(UringPipeline*);
+void uring_pipeline_run_ring(UringPipeline*);
+void uring_pipeline_run_plain(UringPipeline*);
+void uring_pipeline_on_result(void*, int, bool);
+void uring_pipeline_flush(UringPipeline*);
+void uring_pipeline_submit_read(UringPipeline*, int);
+void uring_pipeline_submit_write(UringPipeline*);
+bool uring_pipeline_reap(UringPipeline*);
+int uring_pipeline_format(int, char*);
+
+// Implementation
+
+// Returns false if the kernel doesn't provide io_uring, or one that can't read and write at the current file position.
+bool Uring_Init(Uring *self, unsigned int entries)
+{
+	memset(self, 0, sizeof(Uring));
+	self->fd = -1;
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+	if(fd < 0) return false;
+	self->fd = fd;
+	self->features = params.features;
+	if(!(params.features & IORING_FEAT_RW_CUR_POS))
+	{
+		Uring_Free(self);
+		return false;
+	}
+
+	self->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	self->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	self->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	bool is_single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+	if(is_single_mmap && self->cq_ring_size > self->sq_ring_size) self->sq_ring_size = self->cq_ring_size;
+
+	self->sq_ring = mmap(NULL, self->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	self->cq_ring = is_single_mmap ? self->sq_ring : mmap(NULL, self->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	self->sqes = (struct io_uring_sqe*)mmap(NULL, self->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if(self->sq_ring == MAP_FAILED || self->cq_ring == MAP_FAILED || self->sqes == MAP_FAILED)
+	{
+		Uring_Free(self);
+		return false;
+	}
+
+	char *sq = (char*)self->sq_ring;
+	self->sq_head = (_Atomic uint32_t*)(sq + params.sq_off.head);
+	self->sq_tail = (_Atomic uint32_t*)(sq + params.sq_off.tail);
+	self->sq_mask = (uint32_t*)(sq + params.sq_off.ring_mask);
+	self->sq_entries = (uint32_t*)(sq + params.sq_off.ring_entries);
+	self->sq_array = (uint32_t*)(sq + params.sq_off.array);
+	char *cq = (char*)self->cq_ring;
+	self->cq_head = (_Atomic uint32_t*)(cq + params.cq_off.head);
+	self->cq_tail = (_Atomic uint32_t*)(cq + params.cq_off.tail);
+	self->cq_mask = (uint32_t*)(cq + params.cq_off.ring_mask);
+	self->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+	return true;
+}
+
+void Uring_Free(Uring *self)
+{
+	if(self->sqes && self->sqes != MAP_FAILED) munmap(self->sqes, self->sqes_size);
+	if(self->cq_ring && self->cq_ring != MAP_FAILED && self->cq_ring != self->sq_ring) munmap(self->cq_ring, self->cq_ring_size);
+	if(self->sq_ring && self->sq_ring != MAP_FAILED) munmap(self->sq_ring, self->sq_ring_size);
+	if(self->fd >= 0) close(self->fd);
+	memset(self, 0, sizeof(Uring));
+	self->fd = -1;
+}
+
+// Copies sqe into the submission queue and submits it right away. Returns false if the queue is full or the kernel
+// refused it.
+bool uring_submit(Uring *self, struct io_uring_sqe const *sqe)
+{
+    uint32_t tail = atomic_load_explicit(self->sq_tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(self->sq_head, memory_order_acquire);
+    if(tail - head >= *self->sq_entries) return false;
+    uint32_t idx = tail & *self->sq_mask;
+    self->sqes[idx] = *sqe;
+    self->sq_array[idx] = idx;
+    atomic_store_explicit(self->sq_tail, tail + 1, memory_order_release); // The kernel must see the entry before the tail.
+
+    int ans;
+    do
+    {
+        ans = (int)syscall(__NR_io_uring_enter, self->fd, 1, 0, 0, NULL, 0);
+    }
+    while(ans < 0 && errno == EINTR);
+    return ans == 1;
+}
+
+// Takes the oldest completion, if there is one.
+bool uring_pop_cqe(Uring *self, struct io_uring_cqe *cqe)
+{
+    uint32_t head = atomic_load_explicit(self->cq_head, memory_order_relaxed);
+    if(head == atomic_load_explicit(self->cq_tail, memory_order_acquire)) return false;
+    *cqe = self->cqes[head & *self->cq_mask];
+    atomic_store_explicit(self->cq_head, head + 1, memory_order_release); // Frees the entry for the kernel.
+    return true;
+}
+
+// Blocks until there's at least one completion. Returns 0, or -errno.
+int uring_wait(Uring *self)
+{
+    int ans = (int)syscall(__NR_io_uring_enter, self->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    return ans < 0 && errno != EINTR ? -errno : 0;
+}
+
+bool uring_register_buffers(Uring *self, struct iovec const *buffers, int count)
+{
+    return syscall(__NR_io_uring_register, self->fd, IORING_REGISTER_BUFFERS, buffers, count) == 0;
+}
+
+// Returns false if the buffers could not be allocated. Not having io_uring is not an error, see has_ring.
+bool UringPipeline_Init(UringPipeline *self, int in_fd, int out_fd, FunctionTable *functions)
+{
+	self->in_fd = in_fd;
+	self->out_fd = out_fd;
+	self->read_buffer = -1;
+	self->read_result = 0;
+	self->out_buffer = 2;
+	self->out_len = 0;
+	self->write_buffer = -1;
+	self->write_offset = 0;
+	self->write_len = 0;
+	self->has_failed = false;
+	StreamEvaluator_Init(&self->stream, functions, uring_pipeline_on_result, self);
+	self->buffers = (char*)EXPR_LIST_MALLOC(URING_PIPELINE_BUFFER_COUNT * URING_PIPELINE_BUFFER_SIZE);
+	self->has_ring = self->buffers && Uring_Init(&self->ring, URING_ENTRIES);
+	self->has_fixed_buffers = false;
+	if(self->has_ring)
+	{
+		struct iovec iovecs[URING_PIPELINE_BUFFER_COUNT];
+		for(int i = 0; i < URING_PIPELINE_BUFFER_COUNT; ++i)
+		{
+			iovecs[i].iov_base = uring_pipeline_buffer(self, i);
+			iovecs[i].iov_len = URING_PIPELINE_BUFFER_SIZE;
+		}
+		// Registering can fail on the locked memory limit, the ring still works with unregistered buffers then.
+		self->has_fixed_buffers = uring_register_buffers(&self->ring, iovecs, URING_PIPELINE_BUFFER_COUNT);
+	}
+	return self->buffers != NULL;
+}
+
+void UringPipeline_Free(UringPipeline *self)
+{
+	if(self->has_ring) Uring_Free(&self->ring);
+	if(self->buffers) EXPR_LIST_FREE(self->buffers);
+	self->buffers = NULL;
+	self->has_ring = false;
+	self->has_fixed_buffers = false;
+	self->read_buffer = -1;
+	self->write_buffer = -1;
+	self->out_len = 0;
+	self->has_failed = false;
+	StreamEvaluator_Free(&self->stream);
+}
+
+char *uring_pipeline_buffer(UringPipeline *self, int buffer)
+{
+    return self->buffers + (size_t)buffer * URING_PIPELINE_BUFFER_SIZE;
+}
+
+// Evaluates everything in in_fd, until its end or an I/O error (has_failed is set then).
+void uring_pipeline_run(UringPipeline *self)
+{
+    if(self->has_ring) uring_pipeline_run_ring(self);
+    else uring_pipeline_run_plain(self);
+}
+
+void uring_pipeline_run_ring(UringPipeline *self)
+{
+    // The read in flight always targets the current input buffer, the other one is the one being evaluated.
+    int current = 0;
+    uring_pipeline_submit_read(self, current);
+    while(!self->has_failed)
+    {
+        while(self->read_buffer >= 0 && !self->has_failed) uring_pipeline_reap(self);
+        if(self->has_failed || self->read_result == 0) break;
+        int len = self->read_result;
+        if(len < 0)
+        {
+            if(len == -EINTR || len == -EAGAIN)
+            {
+                uring_pipeline_submit_read(self, current);
+                continue;
+            }
+            fprintf(stderr, "Could not read: %s\n", strerror(-len));
+            self->has_failed = true;
+            break;
+        }
+        uring_pipeline_submit_read(self, current ^ 1);
+        stream_evaluator_feed(&self->stream, uring_pipeline_buffer(self, current), len);
+        uring_pipeline_flush(self);
+        current ^= 1;
+    }
+    if(!self->has_failed)
+    {
+        stream_evaluator_finish(&self->stream);
+        uring_pipeline_flush(self);
+    }
+    // Nothing can be left in flight, even after a failure, since the kernel would keep using the buffers.
+    while((self->read_buffer >= 0 || self->write_buffer >= 0) && uring_pipeline_reap(self)) {}
+}
+
+void uring_pipeline_run_plain(UringPipeline *self)
+{
+    char *buf = uring_pipeline_buffer(self, 0);
+    while(!self->has_failed)
+    {
+        ssize_t len = read(self->in_fd, buf, URING_PIPELINE_BUFFER_SIZE);
+        if(len == 0) break;
+        if(len < 0)
+        {
+            if(errno == EINTR || errno == EAGAIN) continue;
+            fprintf(stderr, "Could not read: %s\n", strerror(errno));
+            self->has_failed = true;
+            break;
+        }
+        stream_evaluator_feed(&self->stream, buf, (int)len);
+        uring_pipeline_flush(self);
+    }
+    if(!self->has_failed)
+    {
+        stream_evaluator_finish(&self->stream);
+        uring_pipeline_flush(self);
+    }
+}
+
+void uring_pipeline_on_result(void *ctx, int value, bool has_failed)
+{
+    UringPipeline *self = (UringPipeline*)ctx;
+    if(has_failed || self->has_failed) return;
+    if(self->out_len + URING_PIPELINE_RESULT_MAX > URING_PIPELINE_BUFFER_SIZE) uring_pipeline_flush(self);
+    // A failed flush leaves the buffer full, and the results have nowhere to go anyway.
+    if(self->has_failed)
+    {
+        stream_evaluator_stop(&self->stream);
+        return;
+    }
+    self->out_len += uring_pipeline_format(value, uring_pipeline_buffer(self, self->out_buffer) + self->out_len);
+}
+
+// Hands the results gathered so far to the writer. With the ring, this only waits for the write before it to complete,
+// the new one is left in flight.
+void uring_pipeline_flush(UringPipeline *self)
+{
+    if(self->out_len == 0 || self->has_failed) return;
+    if(!self->has_ring)
+    {
+        char *buf = uring_pipeline_buffer(self, self->out_buffer);
+        for(int done = 0; done < self->out_len; )
+        {
+            ssize_t len = write(self->out_fd, buf + done, self->out_len - done);
+            if(len < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+            if(len <= 0)
+            {
+                fprintf(stderr, "Could not write: %s\n", strerror(errno));
+                self->has_failed = true;
+                return;
+            }
+            done += (int)len;
+        }
+        self->out_len = 0;
+        return;
+    }
+
+    while(self->write_buffer >= 0 && !self->has_failed) uring_pipeline_reap(self);
+    if(self->has_failed) return;
+    self->write_buffer = self->out_buffer;
+    self->write_offset = 0;
+    self->write_len = self->out_len;
+    uring_pipeline_submit_write(self);
+    self->out_buffer = self->out_buffer == 2 ? 3 : 2;
+    self->out_len = 0;
+}
+
+void uring_pipeline_submit_read(UringPipeline *self, int buffer)
+{
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = self->has_fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe.fd = self->in_fd;
+    sqe.addr = (uint64_t)(uintptr_t)uring_pipeline_buffer(self, buffer);
+    sqe.len = URING_PIPELINE_BUFFER_SIZE;
+    sqe.off = (uint64_t)-1; // The current position, files are read in order and pipes have none.
+    sqe.buf_index = (uint16_t)buffer;
+    sqe.user_data = URING_OP_READ;
+    self->read_buffer = buffer;
+    if(!uring_submit(&self->ring, &sqe))
+    {
+        fprintf(stderr, "Could not submit a read\n");
+        self->read_buffer = -1;
+        self->has_failed = true;
+    }
+}
+
+void uring_pipeline_submit_write(UringPipeline *self)
+{
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = self->has_fixed_buffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe.fd = self->out_fd;
+    sqe.addr = (uint64_t)(uintptr_t)(uring_pipeline_buffer(self, self->write_buffer) + self->write_offset);
+    sqe.len = (uint32_t)(self->write_len - self->write_offset);
+    sqe.off = (uint64_t)-1;
+    sqe.buf_index = (uint16_t)self->write_buffer;
+    sqe.user_data = URING_OP_WRITE;
+    if(!uring_submit(&self->ring, &sqe))
+    {
+        fprintf(stderr, "Could not submit a write\n");
+        self->write_buffer = -1;
+        self->has_failed = true;
+    }
+}
+
+// Waits for at least one completion and handles all the available ones. Returns false if waiting failed.
+bool uring_pipeline_reap(UringPipeline *self)
+{
+    struct io_uring_cqe cqe;
+    while(!uring_pop_cqe(&self->ring, &cqe))
+    {
+        int error = uring_wait(&self->ring);
+        if(error < 0)
+        {
+            fprintf(stderr, "Could not wait for completions: %s\n", strerror(-error));
+            self->has_failed = true;
+            return false;
+        }
+    }
+    do
+    {
+        if(cqe.user_data == URING_OP_READ)
+        {
+            self->read_result = cqe.res;
+            self->read_buffer = -1;
+        }
+        else if(cqe.res == -EINTR || cqe.res == -EAGAIN)
+        {
+            uring_pipeline_submit_write(self);
+        }
+        else if(cqe.res <= 0)
+        {
+            fprintf(stderr, "Could not write: %s\n", cqe.res < 0 ? strerror(-cqe.res) : "nothing written");
+            self->write_buffer = -1;
+            self->has_failed = true;
+        }
+        else
+        {
+            self->write_offset += cqe.res;
+            if(self->write_offset < self->write_len) uring_pipeline_submit_write(self);
+            else self->write_buffer = -1;
+        }
+    }
+    while(uring_pop_cqe(&self->ring, &cqe));
+    return true;
+}
+
+// Writes value and a newline to buf, which must have room for URING_PIPELINE_RESULT_MAX chars. Returns the length.
+int uring_pipeline_format(int value, char *buf)
+{
+    char tmp[URING_PIPELINE_RESULT_MAX];
+    int len = 0;
+    unsigned int v = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    do
+    {
+        tmp[len++] = (char)('0' + v % 10);
+        v /= 10;
+    }
+    while(v > 0);
+    int ans = 0;
+    if(value < 0) buf[ans++] = '-';
+    while(len > 0) buf[ans++] = tmp[--len];
+    buf[ans++] = '\n';
+    return ans;
+}
+
+#endif